@@ -0,0 +1,405 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <deque>
+#include <algorithm>
+#include <pthread.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include "batch.h"
+
+extern char ** environ;
+
+static std::vector<std::string> split(const std::string & s, char sep)
+{
+     std::vector<std::string> parts;
+     std::string part;
+     std::istringstream in(s);
+     while (std::getline(in, part, sep)) {
+	  if (!part.empty()) parts.push_back(part);
+     }
+     return parts;
+}
+
+int batch_read_stages(const std::string & filename, std::vector<BatchStage> & stages)
+{
+     std::ifstream in(filename.c_str());
+     if (!in) {
+	  std::cerr << "batch_read_stages(): cannot open " << filename << "\n";
+	  return 1;
+     }
+     stages.clear();
+     std::string line;
+     while (std::getline(in, line)) {
+	  if (line.empty() || line[0] == '#') continue;
+	  std::istringstream fields(line);
+	  BatchStage st;
+	  std::string deps;
+	  if (!(fields >> st.name >> st.cores >> st.mem_mb >> deps) || !std::getline(fields >> std::ws, st.command) || st.command.empty()) {
+	       std::cerr << "batch_read_stages(): bad line in " << filename << ": " << line << "\n";
+	       return 1;
+	  }
+	  st.cores = std::max(st.cores, 1u);
+	  std::vector<std::string> names = split(deps, ',');
+	  for (unsigned i = 0; i < names.size() && deps != "-"; i ++) {
+	       unsigned s = 0;
+	       while (s < stages.size() && stages[s].name != names[i]) s ++;
+	       if (s == stages.size()) {
+		    std::cerr << "batch_read_stages(): stage " << st.name << " depends on " << names[i] << ", which is not an earlier stage.\n";
+		    return 1;
+	       }
+	       st.deps.push_back(s);
+	  }
+	  stages.push_back(st);
+     }
+     return 0;
+}
+
+int batch_read_manifest(const std::string & filename, std::vector<BatchSubject> & subjects)
+{
+     std::ifstream in(filename.c_str());
+     if (!in) {
+	  std::cerr << "batch_read_manifest(): cannot open " << filename << "\n";
+	  return 1;
+     }
+     subjects.clear();
+     std::string line;
+     while (std::getline(in, line)) {
+	  if (line.empty() || line[0] == '#') continue;
+	  std::istringstream fields(line);
+	  BatchSubject sub;
+	  if (!(fields >> sub.name)) continue;
+	  std::string kv;
+	  while (fields >> kv) {
+	       size_t eq = kv.find('=');
+	       if (eq == std::string::npos || eq == 0) {
+		    std::cerr << "batch_read_manifest(): bad key=value " << kv << " of subject " << sub.name << "\n";
+		    return 1;
+	       }
+	       sub.vars[kv.substr(0, eq)] = kv.substr(eq + 1);
+	  }
+	  subjects.push_back(sub);
+     }
+     return 0;
+}
+
+static bool is_name_start(char c)
+{
+     return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+}
+
+static bool is_name_char(char c)
+{
+     return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+int batch_expand(const std::string & command, const BatchSubject & subject, std::string & out)
+{
+     out.clear();
+     size_t i = 0;
+     while (i < command.size()) {
+	  size_t open = command.find('{', i);
+	  if (open == std::string::npos) {
+	       out += command.substr(i);
+	       break;
+	  }
+	  out += command.substr(i, open - i);
+	  // {{ is a literal {.
+	  if (open + 1 < command.size() && command[open + 1] == '{') {
+	       out += '{';
+	       i = open + 2;
+	       continue;
+	  }
+	  // only {name} is a placeholder, and not ${name} of the shell. Other
+	  // braces, e.g. of awk or a brace expansion, are copied.
+	  size_t close = open + 1;
+	  if (close < command.size() && is_name_start(command[close])) {
+	       while (close < command.size() && is_name_char(command[close])) close ++;
+	  }
+	  if (close == open + 1 || close == command.size() || command[close] != '}' || (open > 0 && command[open - 1] == '$')) {
+	       out += '{';
+	       i = open + 1;
+	       continue;
+	  }
+	  const std::string key = command.substr(open + 1, close - open - 1);
+	  std::map<std::string, std::string>::const_iterator it = subject.vars.find(key);
+	  if (key == "subject") {
+	       out += subject.name;
+	  }
+	  else if (it != subject.vars.end()) {
+	       out += it->second;
+	  }
+	  else {
+	       std::cerr << "batch_expand(): subject " << subject.name << " has no " << key << " for: " << command << "\n";
+	       return 1;
+	  }
+	  i = close + 1;
+     }
+     return 0;
+}
+
+struct BatchTask
+{
+     unsigned subject;
+     unsigned stage;
+};
+
+struct Scheduler
+{
+     const std::vector<BatchStage> * stages;
+     const std::vector<BatchSubject> * subjects;
+     std::vector<std::vector<unsigned> > dependents; // stages that depend on each stage.
+     std::vector<unsigned> n_waiting; // unfinished deps of each task.
+     std::vector<bool> settled;       // the task ran, or was skipped.
+     std::vector<std::deque<BatchTask> > ready; // one deque per worker.
+
+     pthread_mutex_t lock;
+     pthread_cond_t changed; // a task finished, so there are new ready tasks or free budget.
+     unsigned n_cores, free_cores;
+     unsigned long mem_mb, free_mem;
+     unsigned n_left;        // tasks not settled.
+     unsigned n_failed;
+     std::string log_dir;
+     unsigned short verbose;
+     struct timeval start;
+};
+
+struct WorkerArg
+{
+     Scheduler * s;
+     unsigned id;
+};
+
+static unsigned task_cores(const Scheduler & s, const BatchTask & t)
+{
+     return std::min((*s.stages)[t.stage].cores, s.n_cores);
+}
+
+static unsigned long task_mem(const Scheduler & s, const BatchTask & t)
+{
+     return std::min((*s.stages)[t.stage].mem_mb, s.mem_mb);
+}
+
+static bool fits(const Scheduler & s, const BatchTask & t)
+{
+     return task_cores(s, t) <= s.free_cores && task_mem(s, t) <= s.free_mem;
+}
+
+// the next task of worker w that fits in the budget: the newest of its own,
+// or else the oldest of another worker.
+static bool take(Scheduler & s, unsigned w, BatchTask & t)
+{
+     std::deque<BatchTask> & own = s.ready[w];
+     for (size_t i = own.size(); i > 0; i --) {
+	  if (fits(s, own[i - 1])) {
+	       t = own[i - 1];
+	       own.erase(own.begin() + (i - 1));
+	       return true;
+	  }
+     }
+     const unsigned n_workers = s.ready.size();
+     for (unsigned k = 1; k < n_workers; k ++) {
+	  std::deque<BatchTask> & other = s.ready[(w + k) % n_workers];
+	  for (size_t i = 0; i < other.size(); i ++) {
+	       if (fits(s, other[i])) {
+		    t = other[i];
+		    other.erase(other.begin() + i);
+		    return true;
+	       }
+	  }
+     }
+     return false;
+}
+
+// skip the stages of the subject that depend on a failed stage.
+static void skip_dependents(Scheduler & s, unsigned subject, unsigned stage)
+{
+     const unsigned n_stages = s.stages->size();
+     for (unsigned k = 0; k < s.dependents[stage].size(); k ++) {
+	  unsigned d = s.dependents[stage][k];
+	  if (s.settled[subject * n_stages + d]) continue;
+	  s.settled[subject * n_stages + d] = true;
+	  s.n_left --;
+	  s.n_failed ++;
+	  std::cerr << "batch_run(): " << (*s.subjects)[subject].name << " " << (*s.stages)[d].name << " skipped.\n";
+	  skip_dependents(s, subject, d);
+     }
+}
+
+static double elapsed(const Scheduler & s)
+{
+     struct timeval now;
+     gettimeofday(&now, 0);
+     return (now.tv_sec - s.start.tv_sec) + (now.tv_usec - s.start.tv_usec) * 1e-6;
+}
+
+// run the command of a task through the shell. Returns the exit status.
+static int run_task(const Scheduler & s, const BatchTask & t)
+{
+     const BatchStage & st = (*s.stages)[t.stage];
+     const BatchSubject & sub = (*s.subjects)[t.subject];
+     std::string command;
+     batch_expand(st.command, sub, command);
+
+     // the environment of the batch, with the cores of the stage for OpenMP.
+     std::vector<std::string> env;
+     for (char ** e = environ; *e; e ++) {
+	  if (std::string(*e).compare(0, 16, "OMP_NUM_THREADS=") != 0) env.push_back(*e);
+     }
+     std::ostringstream omp;
+     omp << "OMP_NUM_THREADS=" << task_cores(s, t);
+     env.push_back(omp.str());
+     std::vector<char *> envp;
+     for (size_t i = 0; i < env.size(); i ++) envp.push_back(const_cast<char *>(env[i].c_str()));
+     envp.push_back(0);
+
+     posix_spawn_file_actions_t actions;
+     posix_spawn_file_actions_init(&actions);
+     if (!s.log_dir.empty()) {
+	  const std::string log_file = s.log_dir + "/" + sub.name + "." + st.name + ".log";
+	  posix_spawn_file_actions_addopen(&actions, 1, log_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	  posix_spawn_file_actions_adddup2(&actions, 1, 2);
+     }
+     const char * argv[] = {"sh", "-c", command.c_str(), 0};
+     pid_t pid;
+     int err = posix_spawn(&pid, "/bin/sh", &actions, 0, const_cast<char * const *>(argv), &envp[0]);
+     posix_spawn_file_actions_destroy(&actions);
+     if (err != 0) return -1;
+     int status;
+     while (waitpid(pid, &status, 0) < 0) {
+	  if (errno != EINTR) return -1;
+     }
+     return WIFEXITED(status)? WEXITSTATUS(status) : -1;
+}
+
+static void * batch_worker(void * arg)
+{
+     Scheduler & s = *((WorkerArg *)arg)->s;
+     const unsigned w = ((WorkerArg *)arg)->id;
+     const unsigned n_stages = s.stages->size();
+     pthread_mutex_lock(&s.lock);
+     while (s.n_left > 0) {
+	  BatchTask t;
+	  if (!take(s, w, t)) {
+	       pthread_cond_wait(&s.changed, &s.lock);
+	       continue;
+	  }
+	  s.free_cores -= task_cores(s, t);
+	  s.free_mem -= task_mem(s, t);
+	  const std::string & sub = (*s.subjects)[t.subject].name;
+	  const std::string & st = (*s.stages)[t.stage].name;
+	  if (s.verbose >= 1) {
+	       printf("[%8.1fs] worker %u: %s %s started.\n", elapsed(s), w, sub.c_str(), st.c_str());
+	       fflush(stdout);
+	  }
+	  pthread_mutex_unlock(&s.lock);
+
+	  int status = run_task(s, t);
+
+	  pthread_mutex_lock(&s.lock);
+	  s.free_cores += task_cores(s, t);
+	  s.free_mem += task_mem(s, t);
+	  s.settled[t.subject * n_stages + t.stage] = true;
+	  s.n_left --;
+	  if (status != 0) {
+	       s.n_failed ++;
+	       std::cerr << "batch_run(): " << sub << " " << st << " failed with status " << status << ".\n";
+	       skip_dependents(s, t.subject, t.stage);
+	  }
+	  else {
+	       if (s.verbose >= 1) {
+		    printf("[%8.1fs] worker %u: %s %s done.\n", elapsed(s), w, sub.c_str(), st.c_str());
+		    fflush(stdout);
+	       }
+	       for (unsigned k = 0; k < s.dependents[t.stage].size(); k ++) {
+		    unsigned d = s.dependents[t.stage][k];
+		    if (-- s.n_waiting[t.subject * n_stages + d] == 0) {
+			 BatchTask next = {t.subject, d};
+			 s.ready[w].push_back(next);
+		    }
+	       }
+	  }
+	  pthread_cond_broadcast(&s.changed);
+     }
+     pthread_mutex_unlock(&s.lock);
+     return 0;
+}
+
+unsigned batch_run(const std::vector<BatchStage> & stages, const std::vector<BatchSubject> & subjects, unsigned n_cores, unsigned long mem_mb, const std::string & log_dir, unsigned short verbose)
+{
+     const unsigned n_stages = stages.size(), n_subjects = subjects.size();
+     Scheduler s;
+     s.stages = &stages;
+     s.subjects = &subjects;
+     s.n_cores = s.free_cores = std::max(n_cores, 1u);
+     s.mem_mb = s.free_mem = mem_mb;
+     s.n_left = n_stages * n_subjects;
+     s.n_failed = 0;
+     s.log_dir = log_dir;
+     s.verbose = verbose;
+     gettimeofday(&s.start, 0);
+     if (s.n_left == 0) return 0;
+
+     // the commands are expanded once before anything runs, so a missing key
+     // in the manifest fails the batch at the start.
+     std::string command;
+     for (unsigned j = 0; j < n_subjects; j ++) {
+	  for (unsigned i = 0; i < n_stages; i ++) {
+	       if (batch_expand(stages[i].command, subjects[j], command)) return s.n_left;
+	  }
+     }
+
+     // one worker per core. The first stages of the subjects are dealt to
+     // the workers in turn, and the workers steal to balance the rest.
+     const unsigned n_workers = std::min(s.n_cores, s.n_left);
+     s.dependents.resize(n_stages);
+     s.n_waiting.resize(s.n_left);
+     s.settled.assign(s.n_left, false);
+     s.ready.resize(n_workers);
+     for (unsigned i = 0; i < n_stages; i ++) {
+	  for (unsigned k = 0; k < stages[i].deps.size(); k ++) {
+	       s.dependents[stages[i].deps[k]].push_back(i);
+	  }
+     }
+     unsigned n = 0;
+     for (unsigned j = 0; j < n_subjects; j ++) {
+	  for (unsigned i = 0; i < n_stages; i ++) {
+	       s.n_waiting[j * n_stages + i] = stages[i].deps.size();
+	       if (stages[i].deps.empty()) {
+		    BatchTask t = {j, i};
+		    s.ready[n ++ % n_workers].push_back(t);
+	       }
+	  }
+     }
+
+     pthread_mutex_init(&s.lock, 0);
+     pthread_cond_init(&s.changed, 0);
+     std::vector<pthread_t> threads;
+     std::vector<WorkerArg> args(n_workers);
+     for (unsigned w = 0; w < n_workers; w ++) {
+	  args[w].s = &s;
+	  args[w].id = w;
+	  pthread_t t;
+	  if (w > 0 && pthread_create(&t, 0, batch_worker, &args[w]) == 0) {
+	       threads.push_back(t);
+	  }
+     }
+     // the calling thread is worker 0. The tasks of workers that could not be
+     // started are stolen by the others.
+     batch_worker(&args[0]);
+     for (unsigned i = 0; i < threads.size(); i ++) {
+	  pthread_join(threads[i], 0);
+     }
+     pthread_cond_destroy(&s.changed);
+     pthread_mutex_destroy(&s.lock);
+
+     if (verbose >= 1) {
+	  printf("batch_run(): %u tasks in %.1fs, %u failed or skipped.\n", n_stages * n_subjects, elapsed(s), s.n_failed);
+     }
+     return s.n_failed;
+}
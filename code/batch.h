@@ -0,0 +1,64 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <string>
+#include <vector>
+#include <map>
+
+// Batch runs of the tools over many subjects. A stage is a shell command run
+// once per subject, after the stages it depends on for the same subject.
+// Each (subject, stage) task reserves its cores and memory from a global
+// budget while it runs, so stages that need much memory (multiscale_hessian,
+// dijk) are not run together beyond the memory of the node, and the cores are
+// kept busy with other subjects meanwhile.
+//
+// Scheduling is by work stealing: each worker thread has a deque of ready
+// tasks. The stages made ready by a finished task are pushed to the back of
+// the deque of its worker, and a worker takes its next task from the back of
+// its own deque, so a subject tends to run to the end on one worker while its
+// files are in the page cache. An idle worker steals from the front of the
+// deques of the others, i.e. the oldest, least local tasks. A task that does
+// not fit in the budget left is skipped for the next one that does.
+
+struct BatchStage
+{
+     std::string name;
+     unsigned cores;              // reserved cores, and OMP_NUM_THREADS of the command.
+     unsigned long mem_mb;        // reserved memory in MB.
+     std::vector<unsigned> deps;  // indices of earlier stages.
+     std::string command;         // with {subject} and {key} placeholders.
+};
+
+struct BatchSubject
+{
+     std::string name;
+     std::map<std::string, std::string> vars;
+};
+
+// Stage file, one stage per line:
+//     name cores mem_mb deps command...
+// deps is a comma separated list of earlier stages, or - for none. The
+// command is the rest of the line. Lines starting with '#' are comments.
+// Returns 1 on a bad line or an unknown dependency.
+int batch_read_stages(const std::string & filename, std::vector<BatchStage> & stages);
+
+// Manifest, one subject per line:
+//     name key=value ...
+// {subject} in a command is the name, and {key} the value of the key. Only
+// {name} with name of letters, digits and _ (not starting with a digit) is a
+// placeholder, and not when it follows a $, so ${VAR} is left to the shell.
+// Other braces are copied, and {{ is a literal {, e.g. awk '{{print $1}'.
+int batch_read_manifest(const std::string & filename, std::vector<BatchSubject> & subjects);
+
+// the command of a stage for a subject. Returns 1 on an unknown placeholder.
+int batch_expand(const std::string & command, const BatchSubject & subject, std::string & out);
+
+// run all the stages of all the subjects with n_cores worker threads, and at
+// most n_cores cores and mem_mb MB reserved at a time. A task that needs more
+// than the budget runs alone. The output of each command goes to
+// log_dir/subject.stage.log if log_dir is given. When a task fails, the
+// stages that depend on it are skipped for that subject, and other subjects go
+// on. Returns the number of failed or skipped tasks.
+unsigned batch_run(const std::vector<BatchStage> & stages, const std::vector<BatchSubject> & subjects, unsigned n_cores, unsigned long mem_mb, const std::string & log_dir, unsigned short verbose = 0);
+
+#endif
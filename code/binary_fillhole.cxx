@@ -3,9 +3,8 @@
 #include "itkCommand.h"
 #include "itkSimpleFilterWatcher.h"
 
-// #include "itkLabelObject.h"
-// #include "itkLabelMap.h"
-#include "itkBinaryFillholeImageFilter.h"
+#include "bitmask.h"
+#include "fillhole.h"
 
 
 int main(int argc, char * argv[])
@@ -27,15 +26,21 @@ int main(int argc, char * argv[])
   reader->SetFileName( argv[1] );
   reader->Update();
   
- typedef itk::BinaryFillholeImageFilter< IType > I2LType;
-  I2LType::Pointer reconstruction = I2LType::New();
-  reconstruction->SetInput( reader->GetOutput() );
-  reconstruction->SetFullyConnected( atoi(argv[3]) );
-  reconstruction->SetForegroundValue( atoi(argv[4]) );
+  // 3D hole filling with the same output as BinaryFillholeImageFilter.
+  const unsigned char fg = atoi(argv[4]);
+  BitMask mask;
+  bm_from_image(reader->GetOutput(), mask, fg);
+  bm_fill_holes_3d(mask, atoi(argv[3]));
+
+  IType::Pointer outPtr = IType::New();
+  outPtr->SetRegions(reader->GetOutput()->GetLargestPossibleRegion());
+  outPtr->Allocate();
+  outPtr->CopyInformation(reader->GetOutput());
+  bm_to_image(mask, outPtr, fg, fg == 0? 255 : 0);
 
   typedef itk::ImageFileWriter< IType > WriterType;
   WriterType::Pointer writer = WriterType::New();
-  writer->SetInput( reconstruction->GetOutput() );
+  writer->SetInput( outPtr );
   writer->SetFileName( argv[2] );
   writer->Update();
   return 0;
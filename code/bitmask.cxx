@@ -0,0 +1,355 @@
+#include <cmath>
+#include <algorithm>
+#include "bitmask.h"
+
+static const uint64_t ALL_ONES = ~(uint64_t)0;
+
+// mask of the valid bits in the last word of a row.
+static uint64_t tail_mask(unsigned nx)
+{
+     return (nx & 63) == 0? ALL_ONES : (((uint64_t)1 << (nx & 63)) - 1);
+}
+
+// out[x] = in[x + s]. Words beyond the row read as fill.
+static void shift_down(const uint64_t * in, uint64_t * out, unsigned W, unsigned s, uint64_t fill)
+{
+     const unsigned q = s >> 6, b = s & 63;
+     for (unsigned i = 0; i < W; i ++) {
+	  uint64_t lo = i + q < W? in[i + q] : fill;
+	  if (b == 0) {
+	       out[i] = lo;
+	  }
+	  else {
+	       uint64_t hi = i + q + 1 < W? in[i + q + 1] : fill;
+	       out[i] = (lo >> b) | (hi << (64 - b));
+	  }
+     }
+}
+
+// out[x] = in[x - s]. Words before the row read as fill.
+static void shift_up(const uint64_t * in, uint64_t * out, unsigned W, unsigned s, uint64_t fill)
+{
+     const unsigned q = s >> 6, b = s & 63;
+     for (unsigned i = 0; i < W; i ++) {
+	  uint64_t lo = i >= q? in[i - q] : fill;
+	  if (b == 0) {
+	       out[i] = lo;
+	  }
+	  else {
+	       uint64_t lo2 = i >= q + 1? in[i - q - 1] : fill;
+	       out[i] = (lo << b) | (lo2 >> (64 - b));
+	  }
+     }
+}
+
+// out[x] = OP of in[x .. x + w] (or in[x - w .. x] if backward), where in has
+// the bits beyond the row set to fill. Built by doubling the window, so a row
+// takes O(log w) shifts. tmp is a scratch row.
+static void half_window(const uint64_t * in, uint64_t * out, uint64_t * tmp, unsigned W, unsigned w, bool backward, bool erode, uint64_t fill)
+{
+     std::copy(in, in + W, out);
+     unsigned covered = 1;
+     while (covered < w + 1) {
+	  unsigned s = std::min(covered, w + 1 - covered);
+	  if (backward) {
+	       shift_up(out, tmp, W, s, fill);
+	  }
+	  else {
+	       shift_down(out, tmp, W, s, fill);
+	  }
+	  if (erode) {
+	       for (unsigned i = 0; i < W; i ++) out[i] &= tmp[i];
+	  }
+	  else {
+	       for (unsigned i = 0; i < W; i ++) out[i] |= tmp[i];
+	  }
+	  covered += s;
+     }
+}
+
+// out[x] = OR (or AND if erode) of in[x - w .. x + w], with voxels beyond the
+// row equal to fill. row and tmp are scratch rows.
+static void row_window(const uint64_t * in, uint64_t * out, uint64_t * row, uint64_t * tmp, unsigned W, unsigned nx, unsigned w, bool erode, uint64_t fill)
+{
+     const uint64_t tail = tail_mask(nx);
+     std::copy(in, in + W, row);
+     row[W - 1] = (row[W - 1] & tail) | (fill & ~tail);
+     if (w == 0) {
+	  std::copy(row, row + W, out);
+     }
+     else {
+	  half_window(row, out, tmp, W, w, false, erode, fill);
+	  half_window(row, row, tmp, W, w, true, erode, fill);
+	  if (erode) {
+	       for (unsigned i = 0; i < W; i ++) out[i] &= row[i];
+	  }
+	  else {
+	       for (unsigned i = 0; i < W; i ++) out[i] |= row[i];
+	  }
+     }
+     out[W - 1] &= tail;
+}
+
+// dilation or erosion by the ball. See bitmask.h.
+static void morphology(const BitMask & in, BitMask & out, unsigned radius, bool erode, bool border_foreground)
+{
+     const unsigned W = in.n_words;
+     const int ny = in.size[1], nz = in.size[2];
+     const int r = radius;
+     const int r2 = r * (r + 1);
+     const uint64_t fill = (erode && border_foreground)? ALL_ONES : 0;
+     const uint64_t tail = tail_mask(in.size[0]);
+
+     bm_allocate(out, in.size);
+     if (erode) {
+	  std::fill(out.bits.begin(), out.bits.end(), ALL_ONES);
+     }
+
+     // (dy, dz) offsets of the ball, grouped by the half width of the x run.
+     std::vector<std::vector<std::pair<int, int> > > groups(r + 1);
+     for (int dz = -r; dz <= r; dz ++) {
+	  for (int dy = -r; dy <= r; dy ++) {
+	       int d2 = dy * dy + dz * dz;
+	       if (d2 <= r2) {
+		    int w = (int)floor(sqrt((double)(r2 - d2)));
+		    while (w * w > r2 - d2) w --;
+		    while ((w + 1) * (w + 1) <= r2 - d2) w ++;
+		    groups[w].push_back(std::make_pair(dy, dz));
+	       }
+	  }
+     }
+
+     // for each run width, compute the x window of all rows once, then
+     // combine the rows at the (dy, dz) offsets of this width.
+     BitMask win;
+     bm_allocate(win, in.size);
+     for (int w = 0; w <= r; w ++) {
+	  if (groups[w].empty()) continue;
+#pragma omp parallel
+	  {
+	       std::vector<uint64_t> row(W), tmp(W);
+#pragma omp for
+	       for (int z = 0; z < nz; z ++) {
+		    for (int y = 0; y < ny; y ++) {
+			 row_window(in.row(y, z), win.row(y, z), &row[0], &tmp[0], W, in.size[0], w, erode, fill);
+		    }
+	       }
+	  }
+
+#pragma omp parallel for
+	  for (int z = 0; z < nz; z ++) {
+	       for (int y = 0; y < ny; y ++) {
+		    uint64_t * o = out.row(y, z);
+		    for (unsigned n = 0; n < groups[w].size(); n ++) {
+			 int yy = y + groups[w][n].first, zz = z + groups[w][n].second;
+			 if (yy < 0 || yy >= ny || zz < 0 || zz >= nz) {
+			      if (erode && !border_foreground) {
+				   std::fill(o, o + W, (uint64_t)0);
+			      }
+			      continue;
+			 }
+			 const uint64_t * src = win.row(yy, zz);
+			 if (erode) {
+			      for (unsigned i = 0; i < W; i ++) o[i] &= src[i];
+			 }
+			 else {
+			      for (unsigned i = 0; i < W; i ++) o[i] |= src[i];
+			 }
+		    }
+	       }
+	  }
+     }
+
+     // clear the bits beyond the row.
+     for (size_t n = W - 1; n < out.bits.size(); n += W) {
+	  out.bits[n] &= tail;
+     }
+}
+
+void bm_pad(const BitMask & in, BitMask & out, unsigned pad)
+{
+     unsigned size[3] = {in.size[0] + 2 * pad, in.size[1] + 2 * pad, in.size[2] + 2 * pad};
+     bm_allocate(out, size);
+     const unsigned W = out.n_words;
+#pragma omp parallel
+     {
+	  std::vector<uint64_t> tmp(W, 0);
+#pragma omp for
+	  for (int z = 0; z < (int)in.size[2]; z ++) {
+	       for (unsigned y = 0; y < in.size[1]; y ++) {
+		    std::copy(in.row(y, z), in.row(y, z) + in.n_words, tmp.begin());
+		    shift_up(&tmp[0], out.row(y + pad, z + pad), W, pad, 0);
+	       }
+	  }
+     }
+}
+
+void bm_crop(const BitMask & in, BitMask & out, unsigned pad)
+{
+     unsigned size[3] = {in.size[0] - 2 * pad, in.size[1] - 2 * pad, in.size[2] - 2 * pad};
+     bm_allocate(out, size);
+     const unsigned W = in.n_words;
+     const uint64_t tail = tail_mask(size[0]);
+#pragma omp parallel
+     {
+	  std::vector<uint64_t> tmp(W);
+#pragma omp for
+	  for (int z = 0; z < (int)size[2]; z ++) {
+	       for (unsigned y = 0; y < size[1]; y ++) {
+		    shift_down(in.row(y + pad, z + pad), &tmp[0], W, pad, 0);
+		    uint64_t * o = out.row(y, z);
+		    std::copy(tmp.begin(), tmp.begin() + out.n_words, o);
+		    o[out.n_words - 1] &= tail;
+	       }
+	  }
+     }
+}
+
+void bm_allocate(BitMask & bm, const unsigned size[3])
+{
+     bm.size[0] = size[0];
+     bm.size[1] = size[1];
+     bm.size[2] = size[2];
+     bm.n_words = (size[0] + 63) / 64;
+     bm.bits.assign((size_t)bm.n_words * size[1] * size[2], 0);
+}
+
+size_t bm_count(const BitMask & bm)
+{
+     size_t count = 0;
+     const long n = bm.bits.size();
+#pragma omp parallel for reduction(+:count)
+     for (long i = 0; i < n; i ++) {
+	  count += __builtin_popcountll(bm.bits[i]);
+     }
+     return count;
+}
+
+bool bm_bounding_box(const BitMask & bm, unsigned lo[3], unsigned hi[3])
+{
+     const int nz = bm.size[2];
+     for (unsigned d = 0; d < 3; d ++) {
+	  lo[d] = bm.size[d];
+	  hi[d] = 0;
+     }
+#pragma omp parallel
+     {
+	  unsigned my_lo[3] = {lo[0], lo[1], lo[2]}, my_hi[3] = {0, 0, 0};
+#pragma omp for
+	  for (int z = 0; z < nz; z ++) {
+	       for (unsigned y = 0; y < bm.size[1]; y ++) {
+		    const uint64_t * row = bm.row(y, z);
+		    for (unsigned i = 0; i < bm.n_words; i ++) {
+			 if (row[i] == 0) continue;
+			 unsigned x0 = i * 64 + __builtin_ctzll(row[i]);
+			 unsigned x1 = x0;
+			 for (unsigned j = bm.n_words; j > i; j --) {
+			      if (row[j - 1] != 0) {
+				   x1 = (j - 1) * 64 + 63 - __builtin_clzll(row[j - 1]);
+				   break;
+			      }
+			 }
+			 my_lo[0] = std::min(my_lo[0], x0);
+			 my_hi[0] = std::max(my_hi[0], x1);
+			 my_lo[1] = std::min(my_lo[1], y);
+			 my_hi[1] = std::max(my_hi[1], y);
+			 my_lo[2] = std::min(my_lo[2], (unsigned)z);
+			 my_hi[2] = std::max(my_hi[2], (unsigned)z);
+			 break;
+		    }
+	       }
+	  }
+#pragma omp critical
+	  {
+	       for (unsigned d = 0; d < 3; d ++) {
+		    lo[d] = std::min(lo[d], my_lo[d]);
+		    hi[d] = std::max(hi[d], my_hi[d]);
+	       }
+	  }
+     }
+     return lo[0] <= hi[0];
+}
+
+void bm_dilate(const BitMask & in, BitMask & out, unsigned radius)
+{
+     morphology(in, out, radius, false, false);
+}
+
+void bm_erode(const BitMask & in, BitMask & out, unsigned radius, bool border_foreground)
+{
+     morphology(in, out, radius, true, border_foreground);
+}
+
+void bm_closing(const BitMask & in, BitMask & out, unsigned radius)
+{
+     // with a padding of radius, the erosion of the voxels in the volume
+     // never reaches beyond the padded volume.
+     BitMask padded, dilated;
+     bm_pad(in, padded, radius);
+     bm_dilate(padded, dilated, radius);
+     bm_erode(dilated, padded, radius, true);
+     dilated.bits.clear();
+     bm_crop(padded, out, radius);
+
+     // closing is extensive.
+     const long n = out.bits.size();
+#pragma omp parallel for
+     for (long i = 0; i < n; i ++) {
+	  out.bits[i] |= in.bits[i];
+     }
+}
+
+void bm_opening(const BitMask & in, BitMask & out, unsigned radius)
+{
+     BitMask eroded;
+     bm_erode(in, eroded, radius, true);
+     bm_dilate(eroded, out, radius);
+}
+
+// set the voxels equal to foreground, or all nonzero voxels if nonzero is set.
+static void from_image(ImageType3UC::Pointer imagePtr, BitMask & bm, unsigned char foreground, bool nonzero)
+{
+     ImageType3UC::SizeType imageSize = imagePtr->GetLargestPossibleRegion().GetSize();
+     unsigned size[3] = {(unsigned)imageSize[0], (unsigned)imageSize[1], (unsigned)imageSize[2]};
+     bm_allocate(bm, size);
+     const unsigned char * buffer = imagePtr->GetBufferPointer();
+     const long n_rows = (long)size[1] * size[2];
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  const unsigned char * src = buffer + r * size[0];
+	  uint64_t * dst = &bm.bits[r * bm.n_words];
+	  for (unsigned i = 0; i < bm.n_words; i ++) {
+	       uint64_t word = 0;
+	       unsigned x0 = i * 64, x1 = std::min(x0 + 64, size[0]);
+	       for (unsigned x = x0; x < x1; x ++) {
+		    bool set = nonzero? src[x] != 0 : src[x] == foreground;
+		    word |= (uint64_t)set << (x - x0);
+	       }
+	       dst[i] = word;
+	  }
+     }
+}
+
+void bm_from_image(ImageType3UC::Pointer imagePtr, BitMask & bm, unsigned char foreground)
+{
+     from_image(imagePtr, bm, foreground, false);
+}
+
+void bm_from_nonzero(ImageType3UC::Pointer imagePtr, BitMask & bm)
+{
+     from_image(imagePtr, bm, 0, true);
+}
+
+void bm_to_image(const BitMask & bm, ImageType3UC::Pointer imagePtr, unsigned char foreground, unsigned char background)
+{
+     unsigned char * buffer = imagePtr->GetBufferPointer();
+     const long n_rows = (long)bm.size[1] * bm.size[2];
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  unsigned char * dst = buffer + r * bm.size[0];
+	  const uint64_t * src = &bm.bits[r * bm.n_words];
+	  for (unsigned x = 0; x < bm.size[0]; x ++) {
+	       dst[x] = (src[x >> 6] >> (x & 63)) & 1? foreground : background;
+	  }
+     }
+}
@@ -0,0 +1,78 @@
+#ifndef __BITMASK_H__
+#define __BITMASK_H__
+
+#include <vector>
+#include <stdint.h>
+#include <common.h>
+
+// Binary volume with one bit per voxel, 64 voxels per word along x. Every row
+// (y, z) starts at a new word, and the bits beyond size[0] in the last word of
+// a row are always zero.
+struct BitMask
+{
+     unsigned size[3];
+     unsigned n_words; // words per row.
+     std::vector<uint64_t> bits;
+
+     uint64_t * row(unsigned y, unsigned z) {
+	  return &bits[((size_t)z * size[1] + y) * n_words];
+     }
+     const uint64_t * row(unsigned y, unsigned z) const {
+	  return &bits[((size_t)z * size[1] + y) * n_words];
+     }
+     bool get(unsigned x, unsigned y, unsigned z) const {
+	  return (row(y, z)[x >> 6] >> (x & 63)) & 1;
+     }
+     void set(unsigned x, unsigned y, unsigned z) {
+	  row(y, z)[x >> 6] |= (uint64_t)1 << (x & 63);
+     }
+};
+
+// allocate a mask and set all voxels to zero.
+void bm_allocate(BitMask & bm, const unsigned size[3]);
+
+// number of foreground voxels.
+size_t bm_count(const BitMask & bm);
+
+// bounding box [lo, hi] of the foreground voxels, inclusive. Returns false if
+// the mask is empty.
+bool bm_bounding_box(const BitMask & bm, unsigned lo[3], unsigned hi[3]);
+
+// copy in into the center of a mask padded with pad background voxels on each
+// side, and the inverse.
+void bm_pad(const BitMask & in, BitMask & out, unsigned pad);
+void bm_crop(const BitMask & in, BitMask & out, unsigned pad);
+
+// Morphology with the same ball as itk::BinaryBallStructuringElement, i.e. all
+// offsets o with |o|^2 <= radius * (radius + 1). The ball is decomposed into
+// x runs: for each (dy, dz) offset, a run of half width
+// floor(sqrt(radius * (radius + 1) - dy^2 - dz^2)) along x, computed by
+// word-parallel shifts.
+//
+// Voxels outside the volume are background for dilation. For erosion, they are
+// foreground if border_foreground is set (as ITK's BinaryErodeImageFilter), or
+// background otherwise.
+void bm_dilate(const BitMask & in, BitMask & out, unsigned radius);
+void bm_erode(const BitMask & in, BitMask & out, unsigned radius, bool border_foreground);
+
+// closing as BinaryMorphologicalClosingImageFilter with safe border: the
+// volume is padded with background before dilation, and the result includes
+// the input.
+void bm_closing(const BitMask & in, BitMask & out, unsigned radius);
+
+// opening as BinaryMorphologicalOpeningImageFilter: erosion with foreground
+// border, then dilation.
+void bm_opening(const BitMask & in, BitMask & out, unsigned radius);
+
+// convert between ITK volumes and bit masks. Voxels equal to foreground are
+// set in the mask.
+void bm_from_image(ImageType3UC::Pointer imagePtr, BitMask & bm, unsigned char foreground);
+
+// all nonzero voxels are set in the mask.
+void bm_from_nonzero(ImageType3UC::Pointer imagePtr, BitMask & bm);
+
+// write foreground to the voxels set in the mask and background to others.
+// The image must be allocated with the same size as the mask.
+void bm_to_image(const BitMask & bm, ImageType3UC::Pointer imagePtr, unsigned char foreground, unsigned char background);
+
+#endif
@@ -0,0 +1,115 @@
+#include <common.h>
+#include <utility.h>
+#include <fstream>
+#include "bitmask.h"
+#include "edt.h"
+#include "components.h"
+#include "fillhole.h"
+
+namespace po = boost::program_options;
+int main(int argc, char* argv[])
+{
+     std::string in_file, out_file, bbox_file;
+     int th = -500;
+     unsigned short radius = 5, verbose = 0;
+     bool edt = false;
+
+     po::options_description mydesc("Because of the need of negative number as arguments, there is no short form of argument in this code.");
+     mydesc.add_options()
+	  ("help,h", "Extract the body mask from a CT volume: threshold, hole filling, closing and the largest connected component, all in memory. Same as extract_body() in processing.py.")
+	  ("input", po::value<std::string>(&in_file)->default_value("input.nii.gz"),
+	   "Input CT volume.")
+	  ("output", po::value<std::string>(&out_file)->default_value("body.nii.gz"),
+	   "Output body mask. Body is 1, others 0.")
+	  ("th", po::value<int>(&th)->default_value(-500),
+	   "Threshold. Voxels above it will be assumed body.")
+	  ("radius", po::value<unsigned short>(&radius)->default_value(5),
+	   "Radius of the structure element of closing. 0 for no closing.")
+	  ("edt", po::bool_switch(&edt),
+	   "Use the distance transform for closing. Same output, faster for large radius.")
+	  ("bbox", po::value<std::string>(&bbox_file),
+	   "If given, save the bounding box of the body in this text file, as 'xs xm ys ym zs zm' (start index and size of each axis, same as the options of extract_roi).")
+	  ("verbose", po::value<unsigned short>(&verbose)->default_value(0),
+	   "verbose level. 0 for minimal output. 3 for most output.");
+
+     po::variables_map vm;
+     po::store(po::parse_command_line(argc, argv, mydesc, po::command_line_style::unix_style ^ po::command_line_style::allow_short), vm);
+     po::notify(vm);
+
+     try {
+	  if ( (vm.count("help")) | (argc == 1) ) {
+	       std::cout << "Usage: body_extract [options]\n";
+	       std::cout << mydesc << "\n";
+	       return 0;
+	  }
+     }
+     catch(std::exception& e) {
+	  std::cout << e.what() << "\n";
+	  return 1;
+     }
+
+     ReaderType3F::Pointer inReader = ReaderType3F::New();
+     inReader->SetFileName(in_file);
+     inReader->Update();
+     ImageType3F::Pointer inPtr = inReader->GetOutput();
+     ImageType3F::SizeType inSize = inPtr->GetLargestPossibleRegion().GetSize();
+     const unsigned size[3] = {(unsigned)inSize[0], (unsigned)inSize[1], (unsigned)inSize[2]};
+     const float * inBuffer = inPtr->GetBufferPointer();
+
+     // threshold. fslmaths -uthr th, -add 1 and -bin on the integer volume
+     // keep the voxels above th, and the voxels with v + 1 > 0.
+     BitMask mask, tmp;
+     bm_allocate(mask, size);
+     const long n_rows = (long)size[1] * size[2];
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  const float * src = inBuffer + r * size[0];
+	  uint64_t * dst = &mask.bits[r * mask.n_words];
+	  for (unsigned x = 0; x < size[0]; x ++) {
+	       int v = (int)src[x];
+	       bool in_body = v > th || v + 1 > 0;
+	       dst[x >> 6] |= (uint64_t)in_body << (x & 63);
+	  }
+     }
+     if (verbose >= 1) printf("threshold: %ld voxels.\n", (long)bm_count(mask));
+
+     // lung is still outside of body. Add it in by filling holes.
+     bm_fill_holes_2d(mask);
+     if (verbose >= 1) printf("fill holes: %ld voxels.\n", (long)bm_count(mask));
+
+     // closing, to remove small regions connected to the main body.
+     if (radius > 0) {
+	  if (edt) edt_closing(mask, tmp, radius);
+	  else bm_closing(mask, tmp, radius);
+	  mask.bits.swap(tmp.bits);
+	  if (verbose >= 1) printf("closing: %ld voxels.\n", (long)bm_count(mask));
+     }
+
+     unsigned n_comp = cc_keep_largest(mask, tmp, 1, verbose);
+     if (verbose >= 1) printf("largest of %u components: %ld voxels.\n", n_comp, (long)bm_count(tmp));
+
+     ImageType3UC::Pointer outPtr = ImageType3UC::New();
+     outPtr->SetRegions(inPtr->GetLargestPossibleRegion());
+     outPtr->Allocate();
+     outPtr->SetOrigin(inPtr->GetOrigin());
+     outPtr->SetSpacing(inPtr->GetSpacing());
+     outPtr->SetDirection(inPtr->GetDirection());
+     bm_to_image(tmp, outPtr, 1, 0);
+     save_volume(outPtr, out_file);
+
+     // bounding box, so later steps can crop to the body.
+     unsigned lo[3], hi[3];
+     if (!bm_bounding_box(tmp, lo, hi)) {
+	  std::cout << "Body mask is empty.\n";
+	  return 1;
+     }
+     printf("bounding box: x [%u, %u], y [%u, %u], z [%u, %u].\n", lo[0], hi[0], lo[1], hi[1], lo[2], hi[2]);
+     if (vm.count("bbox")) {
+	  std::ofstream out(bbox_file.c_str());
+	  out << lo[0] << " " << hi[0] - lo[0] + 1 << " "
+	      << lo[1] << " " << hi[1] - lo[1] + 1 << " "
+	      << lo[2] << " " << hi[2] - lo[2] + 1 << std::endl;
+     }
+
+     return 0;
+}
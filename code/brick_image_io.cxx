@@ -0,0 +1,139 @@
+#include <cstring>
+#include <vector>
+#include <itkVersion.h>
+#include "brick_image_io.h"
+
+static bool is_brick_file(const char * filename)
+{
+     if (!filename) return false;
+     const std::string s = filename;
+     return s.size() > 6 && s.compare(s.size() - 6, 6, ".brick") == 0;
+}
+
+BrickImageIO::BrickImageIO()
+{
+     this->SetNumberOfDimensions(3);
+}
+
+bool BrickImageIO::CanReadFile(const char * filename)
+{
+     if (!is_brick_file(filename)) return false;
+     BrickFile bf;
+     if (brick_open(filename, bf)) return false;
+     brick_close(bf);
+     return true;
+}
+
+bool BrickImageIO::CanWriteFile(const char * filename)
+{
+     return is_brick_file(filename);
+}
+
+void BrickImageIO::ReadImageInformation()
+{
+     BrickFile bf;
+     if (brick_open(this->GetFileName(), bf)) {
+	  itkExceptionMacro(<< "Cannot read " << this->GetFileName());
+     }
+     brick_close(bf);
+     this->SetNumberOfDimensions(3);
+     for (unsigned d = 0; d < 3; d ++) {
+	  this->SetDimensions(d, bf.h.size[d]);
+	  this->SetSpacing(d, bf.h.spacing[d]);
+	  this->SetOrigin(d, bf.h.origin[d]);
+	  std::vector<double> axis(3);
+	  for (unsigned r = 0; r < 3; r ++) axis[r] = bf.h.direction[r * 3 + d];
+	  this->SetDirection(d, axis);
+     }
+     this->SetComponentType((IOComponentType)bf.h.component_type);
+     this->SetPixelType((IOPixelType)bf.h.pixel_type);
+     this->SetNumberOfComponents(bf.h.n_components);
+     if (this->GetComponentSize() * bf.h.n_components != bf.h.pixel_bytes) {
+	  itkExceptionMacro(<< "Bad pixel type in " << this->GetFileName());
+     }
+}
+
+// the requested region, as a 3D region. Only its chunks are read.
+itk::ImageIORegion BrickImageIO::GenerateStreamableReadRegionFromRequestedRegion(const itk::ImageIORegion & requested) const
+{
+     itk::ImageIORegion region(3);
+     for (unsigned d = 0; d < 3; d ++) {
+	  if (d < requested.GetImageDimension()) {
+	       region.SetIndex(d, requested.GetIndex(d));
+	       region.SetSize(d, requested.GetSize(d));
+	  }
+	  else {
+	       region.SetIndex(d, 0);
+	       region.SetSize(d, this->GetDimensions(d));
+	  }
+     }
+     return region;
+}
+
+void BrickImageIO::Read(void * buffer)
+{
+     BrickFile bf;
+     if (brick_open(this->GetFileName(), bf)) {
+	  itkExceptionMacro(<< "Cannot read " << this->GetFileName());
+     }
+     const itk::ImageIORegion & region = this->GetIORegion();
+     unsigned lo[3], size[3];
+     for (unsigned d = 0; d < 3; d ++) {
+	  lo[d] = d < region.GetImageDimension()? region.GetIndex(d) : 0;
+	  size[d] = d < region.GetImageDimension()? region.GetSize(d) : 1;
+     }
+     int err = brick_read_region(bf, lo, size, buffer);
+     brick_close(bf);
+     if (err) {
+	  itkExceptionMacro(<< "Cannot read the chunks of " << this->GetFileName());
+     }
+}
+
+void BrickImageIO::Write(const void * buffer)
+{
+     if (this->GetNumberOfDimensions() > 3) {
+	  itkExceptionMacro(<< "Only volumes of up to 3 dimensions can be saved as .brick");
+     }
+     BrickHeader h;
+     memset(&h, 0, sizeof(h));
+     for (unsigned d = 0; d < 3; d ++) {
+	  bool in = d < this->GetNumberOfDimensions();
+	  h.size[d] = in? this->GetDimensions(d) : 1;
+	  h.spacing[d] = in? this->GetSpacing(d) : 1;
+	  h.origin[d] = in? this->GetOrigin(d) : 0;
+	  for (unsigned r = 0; r < 3; r ++) {
+	       h.direction[r * 3 + d] = in && r < this->GetNumberOfDimensions()? this->GetDirection(d)[r] : (r == d);
+	  }
+     }
+     h.chunk = BRICK_CHUNK;
+     h.component_type = this->GetComponentType();
+     h.pixel_type = this->GetPixelType();
+     h.n_components = this->GetNumberOfComponents();
+     h.pixel_bytes = this->GetComponentSize() * h.n_components;
+     if (brick_write(this->GetFileName(), h, buffer)) {
+	  itkExceptionMacro(<< "Cannot write " << this->GetFileName());
+     }
+}
+
+BrickImageIOFactory::BrickImageIOFactory()
+{
+     this->RegisterOverride("itkImageIOBase", "BrickImageIO", "Bricked volume IO", 1, itk::CreateObjectFunction<BrickImageIO>::New());
+}
+
+const char * BrickImageIOFactory::GetITKSourceVersion() const
+{
+     return ITK_SOURCE_VERSION;
+}
+
+const char * BrickImageIOFactory::GetDescription() const
+{
+     return "Bricked volume IO";
+}
+
+void brick_image_io_register()
+{
+     static bool registered = false;
+     if (registered) return;
+     registered = true;
+     itk::ObjectFactoryBase::RegisterFactory(BrickImageIOFactory::New());
+}
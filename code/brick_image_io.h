@@ -0,0 +1,66 @@
+#ifndef __BRICK_IMAGE_IO_H__
+#define __BRICK_IMAGE_IO_H__
+
+#include <string>
+#include <itkImageIOBase.h>
+#include <itkObjectFactoryBase.h>
+#include "brick_volume.h"
+
+// image IO of .brick files (brick_volume.h). Reads are streamed: a reader
+// that requests a region only inflates the chunks of that region. The
+// factory is registered by common.h, so all the readers of common.h and
+// save_volume() handle .brick.
+class BrickImageIO : public itk::ImageIOBase
+{
+public:
+     typedef BrickImageIO Self;
+     typedef itk::ImageIOBase Superclass;
+     typedef itk::SmartPointer<Self> Pointer;
+
+     itkNewMacro(Self);
+     itkTypeMacro(BrickImageIO, ImageIOBase);
+
+     virtual bool CanReadFile(const char * filename);
+     virtual void ReadImageInformation();
+     virtual void Read(void * buffer);
+     virtual bool CanStreamRead() { return true; }
+     virtual itk::ImageIORegion GenerateStreamableReadRegionFromRequestedRegion(const itk::ImageIORegion & requested) const;
+
+     virtual bool CanWriteFile(const char * filename);
+     virtual void WriteImageInformation() {}
+     virtual void Write(const void * buffer);
+
+protected:
+     BrickImageIO();
+     ~BrickImageIO() {}
+
+private:
+     BrickImageIO(const Self &);
+     void operator=(const Self &);
+};
+
+class BrickImageIOFactory : public itk::ObjectFactoryBase
+{
+public:
+     typedef BrickImageIOFactory Self;
+     typedef itk::ObjectFactoryBase Superclass;
+     typedef itk::SmartPointer<Self> Pointer;
+
+     virtual const char * GetITKSourceVersion() const;
+     virtual const char * GetDescription() const;
+
+     itkFactorylessNewMacro(Self);
+     itkTypeMacro(BrickImageIOFactory, ObjectFactoryBase);
+
+protected:
+     BrickImageIOFactory();
+
+private:
+     BrickImageIOFactory(const Self &);
+     void operator=(const Self &);
+};
+
+// register BrickImageIOFactory. Calls after the first do nothing.
+void brick_image_io_register();
+
+#endif
@@ -0,0 +1,284 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <itkImageIOBase.h>
+#include "itk_zlib.h"
+#include "brick_volume.h"
+
+typedef unsigned long long uint64;
+
+static const char brick_magic[8] = {'V', 'B', 'R', 'I', 'C', 'K', '0', '2'};
+
+// written in native byte order after the magic, so a file from a machine of
+// the other byte order is refused instead of read as garbage.
+static const unsigned brick_byte_order = 0x01020304;
+
+// bytes of the header before the chunk index.
+static const size_t header_bytes = 8 + 4 + 4 * 4 + 4 * 4 + 15 * 8;
+
+// largest ratio of raw to deflated size zlib can reach.
+#define MAX_DEFLATE_RATIO 1032
+
+// bytes of one component of an itk::ImageIOBase component type, 0 if unknown.
+static unsigned component_bytes(int type)
+{
+     switch (type) {
+     case itk::ImageIOBase::UCHAR: case itk::ImageIOBase::CHAR: return 1;
+     case itk::ImageIOBase::USHORT: case itk::ImageIOBase::SHORT: return 2;
+     case itk::ImageIOBase::UINT: case itk::ImageIOBase::INT: case itk::ImageIOBase::FLOAT: return 4;
+     case itk::ImageIOBase::ULONG: case itk::ImageIOBase::LONG: return sizeof(long);
+     case itk::ImageIOBase::DOUBLE: return 8;
+     default: return 0;
+     }
+}
+
+static void set_chunks(BrickFile & bf)
+{
+     for (unsigned d = 0; d < 3; d ++) {
+	  bf.n_chunks[d] = (bf.h.size[d] + bf.h.chunk - 1) / bf.h.chunk;
+     }
+}
+
+void brick_chunk_box(const BrickFile & bf, long c, unsigned lo[3], unsigned size[3])
+{
+     long idx[3] = {c % bf.n_chunks[0], c / bf.n_chunks[0] % bf.n_chunks[1], c / bf.n_chunks[0] / bf.n_chunks[1]};
+     for (unsigned d = 0; d < 3; d ++) {
+	  lo[d] = idx[d] * bf.h.chunk;
+	  size[d] = std::min(bf.h.chunk, bf.h.size[d] - lo[d]);
+     }
+}
+
+// copy a box of the given size from src_lo in a volume of src_size to dst_lo
+// in a volume of dst_size, row by row.
+static void copy_box(const char * src, const unsigned src_size[3], const unsigned src_lo[3],
+		     char * dst, const unsigned dst_size[3], const unsigned dst_lo[3],
+		     const unsigned size[3], unsigned pixel_bytes)
+{
+     const size_t row = (size_t)size[0] * pixel_bytes;
+     for (unsigned z = 0; z < size[2]; z ++) {
+	  for (unsigned y = 0; y < size[1]; y ++) {
+	       size_t s = (((size_t)(src_lo[2] + z) * src_size[1] + src_lo[1] + y) * src_size[0] + src_lo[0]) * pixel_bytes;
+	       size_t t = (((size_t)(dst_lo[2] + z) * dst_size[1] + dst_lo[1] + y) * dst_size[0] + dst_lo[0]) * pixel_bytes;
+	       memcpy(dst + t, src + s, row);
+	  }
+     }
+}
+
+static bool write_header(FILE * fp, const BrickHeader & h)
+{
+     return fwrite(brick_magic, 1, 8, fp) == 8 && fwrite(&brick_byte_order, 4, 1, fp) == 1
+	  && fwrite(h.size, 4, 3, fp) == 3 && fwrite(&h.chunk, 4, 1, fp) == 1
+	  && fwrite(&h.component_type, 4, 1, fp) == 1 && fwrite(&h.pixel_type, 4, 1, fp) == 1
+	  && fwrite(&h.n_components, 4, 1, fp) == 1 && fwrite(&h.pixel_bytes, 4, 1, fp) == 1
+	  && fwrite(h.spacing, 8, 3, fp) == 3 && fwrite(h.origin, 8, 3, fp) == 3
+	  && fwrite(h.direction, 8, 9, fp) == 9;
+}
+
+static bool read_header(FILE * fp, BrickHeader & h)
+{
+     char magic[8];
+     unsigned byte_order = 0;
+     return fread(magic, 1, 8, fp) == 8 && memcmp(magic, brick_magic, 8) == 0
+	  && fread(&byte_order, 4, 1, fp) == 1 && byte_order == brick_byte_order
+	  && fread(h.size, 4, 3, fp) == 3 && fread(&h.chunk, 4, 1, fp) == 1
+	  && fread(&h.component_type, 4, 1, fp) == 1 && fread(&h.pixel_type, 4, 1, fp) == 1
+	  && fread(&h.n_components, 4, 1, fp) == 1 && fread(&h.pixel_bytes, 4, 1, fp) == 1
+	  && fread(h.spacing, 8, 3, fp) == 3 && fread(h.origin, 8, 3, fp) == 3
+	  && fread(h.direction, 8, 9, fp) == 9;
+}
+
+int brick_write(const std::string & filename, const BrickHeader & h, const void * buffer)
+{
+     BrickFile bf;
+     bf.h = h;
+     if (h.chunk == 0 || h.pixel_bytes == 0) return 1;
+     set_chunks(bf);
+     const long n = brick_n_chunks(bf);
+     bf.offset.assign(n, 0);
+     bf.length.assign(n, 0);
+
+     FILE * fp = fopen(filename.c_str(), "wb");
+     if (!fp) return 1;
+     // the index is written after the chunks, when their lengths are known.
+     bool ok = write_header(fp, h) && fseek(fp, header_bytes + (size_t)n * 16, SEEK_SET) == 0;
+     uint64 pos = header_bytes + (uint64)n * 16;
+
+     // one layer of chunks along z at a time, compressed in parallel.
+     const long layer = (long)bf.n_chunks[0] * bf.n_chunks[1];
+     std::vector<std::vector<unsigned char> > packed(layer);
+     for (long c0 = 0; ok && c0 < n; c0 += layer) {
+	  int err = 0;
+#pragma omp parallel reduction(+:err)
+	  {
+	       std::vector<char> raw;
+#pragma omp for schedule(dynamic)
+	       for (long i = 0; i < layer; i ++) {
+		    unsigned lo[3], size[3];
+		    const unsigned zero[3] = {0, 0, 0};
+		    brick_chunk_box(bf, c0 + i, lo, size);
+		    raw.resize((size_t)size[0] * size[1] * size[2] * h.pixel_bytes);
+		    copy_box((const char *)buffer, h.size, lo, &raw[0], size, zero, size, h.pixel_bytes);
+		    uLongf len = compressBound(raw.size());
+		    packed[i].resize(len);
+		    if (compress2(&packed[i][0], &len, (const Bytef *)&raw[0], raw.size(), Z_BEST_SPEED) != Z_OK) {
+			 err ++;
+		    }
+		    else if (len >= raw.size()) {
+			 packed[i].assign(raw.begin(), raw.end());
+		    }
+		    else {
+			 packed[i].resize(len);
+		    }
+	       }
+	  }
+	  if (err) ok = false;
+	  for (long i = 0; ok && i < layer; i ++) {
+	       bf.offset[c0 + i] = pos;
+	       bf.length[c0 + i] = packed[i].size();
+	       pos += packed[i].size();
+	       ok = fwrite(&packed[i][0], 1, packed[i].size(), fp) == packed[i].size();
+	  }
+     }
+     ok = ok && fseek(fp, header_bytes, SEEK_SET) == 0;
+     for (long c = 0; ok && c < n; c ++) {
+	  ok = fwrite(&bf.offset[c], 8, 1, fp) == 1 && fwrite(&bf.length[c], 8, 1, fp) == 1;
+     }
+     if (fclose(fp) != 0) ok = false;
+     return ok? 0 : 1;
+}
+
+// the header and the index must describe a volume that fits in the file:
+// known pixel type, chunk lengths within the file, and no chunk larger than
+// its data can inflate to.
+static bool check_header(const BrickHeader & h, uint64 file_size)
+{
+     if (h.chunk == 0 || h.n_components == 0) return false;
+     for (unsigned d = 0; d < 3; d ++) {
+	  if (h.size[d] == 0) return false;
+     }
+     const unsigned bytes = component_bytes(h.component_type);
+     return bytes > 0 && h.pixel_bytes == bytes * h.n_components && h.pixel_bytes / bytes == h.n_components
+	  && file_size >= header_bytes;
+}
+
+int brick_open(const std::string & filename, BrickFile & bf)
+{
+     bf.fd = -1;
+     struct stat st;
+     if (stat(filename.c_str(), &st) != 0) return 1;
+     const uint64 file_size = st.st_size;
+     FILE * fp = fopen(filename.c_str(), "rb");
+     if (!fp) return 1;
+     bool ok = read_header(fp, bf.h) && check_header(bf.h, file_size);
+     uint64 n = 0;
+     if (ok) {
+	  // the index of n chunks must fit in the file, before it is allocated.
+	  set_chunks(bf);
+	  const uint64 max_chunks = (file_size - header_bytes) / 16;
+	  n = 1;
+	  for (unsigned d = 0; ok && d < 3; d ++) {
+	       ok = bf.n_chunks[d] <= max_chunks / n;
+	       n *= bf.n_chunks[d];
+	  }
+     }
+     if (ok) {
+	  const uint64 data_start = header_bytes + n * 16;
+	  bf.offset.resize(n);
+	  bf.length.resize(n);
+	  for (uint64 c = 0; ok && c < n; c ++) {
+	       ok = fread(&bf.offset[c], 8, 1, fp) == 1 && fread(&bf.length[c], 8, 1, fp) == 1
+		    && bf.offset[c] >= data_start && bf.length[c] <= file_size && bf.offset[c] <= file_size - bf.length[c];
+	  }
+	  for (uint64 c = 0; ok && c < n; c ++) {
+	       unsigned lo[3], size[3];
+	       brick_chunk_box(bf, c, lo, size);
+	       const uint64 raw = (uint64)size[0] * size[1] * size[2] * bf.h.pixel_bytes;
+	       ok = bf.length[c] == raw || (bf.length[c] < raw && raw / MAX_DEFLATE_RATIO <= bf.length[c]);
+	  }
+     }
+     fclose(fp);
+     if (!ok) {
+	  std::fprintf(stderr, "brick_open(): %s is not a valid .brick file of this machine.\n", filename.c_str());
+	  return 1;
+     }
+     bf.fd = open(filename.c_str(), O_RDONLY);
+     return bf.fd >= 0? 0 : 1;
+}
+
+void brick_close(BrickFile & bf)
+{
+     if (bf.fd >= 0) close(bf.fd);
+     bf.fd = -1;
+}
+
+int brick_read_chunk(const BrickFile & bf, long c, std::vector<char> & out)
+{
+     unsigned lo[3], size[3];
+     brick_chunk_box(bf, c, lo, size);
+     // runs on the threads of brick_read_region, where an exception would
+     // end the process.
+     std::vector<unsigned char> packed;
+     try {
+	  out.resize((size_t)size[0] * size[1] * size[2] * bf.h.pixel_bytes);
+	  packed.resize(bf.length[c]);
+     }
+     catch (std::bad_alloc &) {
+	  return 1;
+     }
+     size_t done = 0;
+     while (done < packed.size()) {
+	  ssize_t r = pread(bf.fd, &packed[done], packed.size() - done, bf.offset[c] + done);
+	  if (r <= 0) return 1;
+	  done += r;
+     }
+     if (packed.size() == out.size()) {
+	  if (!out.empty()) memcpy(&out[0], &packed[0], out.size());
+	  return 0;
+     }
+     uLongf len = out.size();
+     if (uncompress((Bytef *)&out[0], &len, &packed[0], packed.size()) != Z_OK || len != out.size()) {
+	  return 1;
+     }
+     return 0;
+}
+
+int brick_read_region(const BrickFile & bf, const unsigned lo[3], const unsigned size[3], void * dst)
+{
+     unsigned c_lo[3], c_hi[3];
+     for (unsigned d = 0; d < 3; d ++) {
+	  if (size[d] == 0) return 0;
+	  if (lo[d] + size[d] > bf.h.size[d]) return 1;
+	  c_lo[d] = lo[d] / bf.h.chunk;
+	  c_hi[d] = (lo[d] + size[d] - 1) / bf.h.chunk;
+     }
+     const long nx = c_hi[0] - c_lo[0] + 1, ny = c_hi[1] - c_lo[1] + 1, nz = c_hi[2] - c_lo[2] + 1;
+     int err = 0;
+#pragma omp parallel reduction(+:err)
+     {
+	  std::vector<char> chunk;
+#pragma omp for schedule(dynamic)
+	  for (long i = 0; i < nx * ny * nz; i ++) {
+	       long c = ((c_lo[2] + i / nx / ny) * bf.n_chunks[1] + c_lo[1] + i / nx % ny) * bf.n_chunks[0] + c_lo[0] + i % nx;
+	       if (brick_read_chunk(bf, c, chunk)) {
+		    err ++;
+		    continue;
+	       }
+	       // the intersection of the chunk and the region.
+	       unsigned box_lo[3], box_size[3], src_lo[3], dst_lo[3], common[3];
+	       brick_chunk_box(bf, c, box_lo, box_size);
+	       for (unsigned d = 0; d < 3; d ++) {
+		    unsigned a = std::max(box_lo[d], lo[d]);
+		    unsigned b = std::min(box_lo[d] + box_size[d], lo[d] + size[d]);
+		    src_lo[d] = a - box_lo[d];
+		    dst_lo[d] = a - lo[d];
+		    common[d] = b - a;
+	       }
+	       copy_box(&chunk[0], box_size, src_lo, (char *)dst, size, dst_lo, common, bf.h.pixel_bytes);
+	  }
+     }
+     return err;
+}
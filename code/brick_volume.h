@@ -0,0 +1,73 @@
+#ifndef __BRICK_VOLUME_H__
+#define __BRICK_VOLUME_H__
+
+#include <string>
+#include <vector>
+
+// Bricked volume files (.brick). The volume is cut into chunks of
+// chunk^3 voxels (smaller at the far edges), each compressed on its own with
+// zlib at the fastest level, or stored raw if that is not smaller. An index
+// after the header gives the offset and length of every chunk, so a region is
+// read by inflating only the chunks it touches, and a tool can walk a volume
+// chunk by chunk.
+//
+// File layout, in native byte order:
+//   "VBRICK02"
+//   uint32 0x01020304 (byte order mark)
+//   uint32 size[3], chunk
+//   int32 component_type, pixel_type (itk::ImageIOBase enums)
+//   uint32 n_components, pixel_bytes
+//   double spacing[3], origin[3], direction[9] (row major)
+//   uint64 offset, length of each chunk, x fastest
+//   chunk data
+#define BRICK_CHUNK 64
+
+struct BrickHeader
+{
+     unsigned size[3];
+     unsigned chunk;
+     int component_type;
+     int pixel_type;
+     unsigned n_components;
+     unsigned pixel_bytes;
+     double spacing[3];
+     double origin[3];
+     double direction[9];
+};
+
+struct BrickFile
+{
+     int fd;
+     BrickHeader h;
+     unsigned n_chunks[3]; // chunks along each axis.
+     std::vector<unsigned long long> offset;
+     std::vector<unsigned long long> length;
+};
+
+// write the volume in buffer, x fastest, as a .brick file. Returns 0 on
+// success.
+int brick_write(const std::string & filename, const BrickHeader & h, const void * buffer);
+
+// read the header and the chunk index. Returns 1 if the file is not a valid
+// .brick file of this byte order: unknown pixel type, pixel_bytes not that of
+// the pixel type, or chunks outside the file.
+int brick_open(const std::string & filename, BrickFile & bf);
+void brick_close(BrickFile & bf);
+
+inline long brick_n_chunks(const BrickFile & bf)
+{
+     return (long)bf.n_chunks[0] * bf.n_chunks[1] * bf.n_chunks[2];
+}
+
+// the voxel box of chunk c.
+void brick_chunk_box(const BrickFile & bf, long c, unsigned lo[3], unsigned size[3]);
+
+// the voxels of chunk c, x fastest over its box. Safe to call from several
+// threads on one open file.
+int brick_read_chunk(const BrickFile & bf, long c, std::vector<char> & out);
+
+// the voxels of the box at lo of the given size, x fastest, into dst. The
+// chunks touching the box are inflated in parallel.
+int brick_read_region(const BrickFile & bf, const unsigned lo[3], const unsigned size[3], void * dst);
+
+#endif
@@ -15,6 +15,8 @@
 #include "itkImageRegionConstIterator.h"
 #include "itkNeighborhoodIterator.h"
 #include "itkConstantBoundaryCondition.h"
+#include "nifti_gz_io.h"
+#include "brick_image_io.h"
 #include <vcl_iostream.h>
 #include <vnl/vnl_matlab_print.h>
 
@@ -56,6 +58,7 @@ typedef itk::Image<Array3F, 3> ImageTypeArray3F;
 typedef itk::SymmetricSecondRankTensor< float, 3 > HessianPixelType;
 typedef itk::Image< HessianPixelType, 3 >           HessianImageType;
 typedef itk::Image<double, 4> ImageType4D;
+typedef itk::Image<float, 4> ImageType4F;
 
 
 typedef itk::ImageFileReader< ImageType2DF >  ReaderType2D;
@@ -73,6 +76,14 @@ typedef itk::ImageFileReader< ImageType3U >  ReaderType3U;
 typedef itk::ImageFileReader< ImageTypeArray3D >  ReaderTypeArray3D;
 typedef itk::ImageFileReader< ImageTypeArray3F >  ReaderTypeArray3F;
 
+// .nii.gz files are read through NiftiGzImageIO, which inflates in parallel,
+// and .brick files through BrickImageIO. The factories are registered before
+// main() by this object.
+static struct ImageIORegistration
+{
+     ImageIORegistration() { nifti_gz_io_register(); brick_image_io_register(); }
+} image_io_registration;
+
 typedef itk::ImageFileWriter< ImageType2DF >  WriterType2DF;
 typedef itk::ImageFileWriter< ImageType2UC >  WriterType2UC;
 typedef itk::ImageFileWriter< ImageType3DS >  WriterType3DS;
@@ -88,6 +99,7 @@ typedef itk::ImageFileWriter< ImageType3F >  WriterType3F;
 typedef itk::ImageFileWriter< ImageTypeArray3D >  WriterTypeArray3D;
 typedef itk::ImageFileWriter< ImageTypeArray3F >  WriterTypeArray3F;
 typedef itk::ImageFileWriter< ImageType4D >  WriterType4D;
+typedef itk::ImageFileWriter< ImageType4F >  WriterType4F;
 
 typedef itk::ImageRegionConstIterator< ImageType2DF > ConstIteratorType2DF;
 typedef itk::ImageRegionConstIterator< ImageType3DF > ConstIteratorType3DF;
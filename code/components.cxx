@@ -0,0 +1,206 @@
+#include <cstdio>
+#include <algorithm>
+#include "components.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// foreground run [x0, x1) of a row.
+struct Run
+{
+     unsigned x0;
+     unsigned x1;
+};
+
+// number of foreground runs of a row.
+static unsigned count_runs(const uint64_t * row, unsigned W)
+{
+     unsigned n = 0;
+     uint64_t carry = 0;
+     for (unsigned i = 0; i < W; i ++) {
+	  // bits whose left neighbor is background start a run.
+	  n += __builtin_popcountll(row[i] & ~((row[i] << 1) | carry));
+	  carry = row[i] >> 63;
+     }
+     return n;
+}
+
+// write the foreground runs of a row to runs. The bits beyond the row are zero.
+static void row_runs(const uint64_t * row, unsigned nx, Run * runs)
+{
+     unsigned x = 0;
+     while (x < nx) {
+	  uint64_t w = row[x >> 6] >> (x & 63);
+	  if (w == 0) {
+	       x = (x | 63) + 1;
+	       continue;
+	  }
+	  x += __builtin_ctzll(w);
+	  runs->x0 = x;
+	  // the run ends at the first zero bit.
+	  while (x < nx) {
+	       uint64_t nw = ~row[x >> 6] >> (x & 63);
+	       if (nw == 0) {
+		    x = (x | 63) + 1;
+	       }
+	       else {
+		    x += __builtin_ctzll(nw);
+		    break;
+	       }
+	  }
+	  runs->x1 = std::min(x, nx);
+	  runs ++;
+     }
+}
+
+static unsigned uf_find(std::vector<unsigned> & parent, unsigned i)
+{
+     while (parent[i] != i) {
+	  parent[i] = parent[parent[i]];
+	  i = parent[i];
+     }
+     return i;
+}
+
+// the smaller root becomes the parent.
+static void uf_join(std::vector<unsigned> & parent, unsigned a, unsigned b)
+{
+     a = uf_find(parent, a);
+     b = uf_find(parent, b);
+     if (a < b) parent[b] = a;
+     else if (b < a) parent[a] = b;
+}
+
+// join the overlapping runs of two rows.
+static void join_rows(const std::vector<Run> & runs, std::vector<unsigned> & parent, size_t a0, size_t a1, size_t b0, size_t b1)
+{
+     size_t a = a0, b = b0;
+     while (a < a1 && b < b1) {
+	  if (runs[a].x0 < runs[b].x1 && runs[b].x0 < runs[a].x1) {
+	       uf_join(parent, a, b);
+	  }
+	  if (runs[a].x1 < runs[b].x1) a ++;
+	  else b ++;
+     }
+}
+
+// larger components first. Ties go to the smaller id.
+struct CompareSize
+{
+     const std::vector<size_t> & size;
+     CompareSize(const std::vector<size_t> & s) : size(s) {};
+     bool operator()(unsigned a, unsigned b) const {
+	  return size[a] > size[b] || (size[a] == size[b] && a < b);
+     }
+};
+
+// set the bits [x0, x1) of a row.
+static void fill_run(uint64_t * row, unsigned x0, unsigned x1)
+{
+     unsigned i0 = x0 >> 6, i1 = (x1 - 1) >> 6;
+     uint64_t first = ~(uint64_t)0 << (x0 & 63);
+     uint64_t last = ~(uint64_t)0 >> (63 - ((x1 - 1) & 63));
+     if (i0 == i1) {
+	  row[i0] |= first & last;
+	  return;
+     }
+     row[i0] |= first;
+     for (unsigned i = i0 + 1; i < i1; i ++) row[i] = ~(uint64_t)0;
+     row[i1] |= last;
+}
+
+unsigned cc_keep_largest(const BitMask & in, BitMask & out, unsigned n_keep, unsigned short verbose)
+{
+     const unsigned nx = in.size[0], ny = in.size[1];
+     const int nz = in.size[2];
+     const long n_rows = (long)ny * nz;
+
+     // runs of all rows. Row r has the runs [row_start[r], row_start[r+1]).
+     std::vector<size_t> row_start(n_rows + 1, 0);
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  row_start[r + 1] = count_runs(&in.bits[r * in.n_words], in.n_words);
+     }
+     for (long r = 0; r < n_rows; r ++) {
+	  row_start[r + 1] += row_start[r];
+     }
+     const size_t n_runs = row_start[n_rows];
+     std::vector<Run> runs(n_runs);
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  if (row_start[r + 1] > row_start[r]) {
+	       row_runs(&in.bits[r * in.n_words], nx, &runs[row_start[r]]);
+	  }
+     }
+
+     // join the runs with the previous row and the previous slice. Slabs of
+     // slices are joined in parallel. A slab only touches the parents of its
+     // own runs, since the smaller root always becomes the parent. The slab
+     // borders are joined afterwards.
+     std::vector<unsigned> parent(n_runs);
+     for (size_t i = 0; i < n_runs; i ++) parent[i] = i;
+     int n_slabs = 1;
+#ifdef _OPENMP
+     n_slabs = std::min(nz, omp_get_max_threads() * 4);
+#endif
+     std::vector<int> slab_start(n_slabs + 1);
+     for (int s = 0; s <= n_slabs; s ++) slab_start[s] = (long)nz * s / n_slabs;
+
+#pragma omp parallel for schedule(dynamic)
+     for (int s = 0; s < n_slabs; s ++) {
+	  for (int z = slab_start[s]; z < slab_start[s + 1]; z ++) {
+	       for (unsigned y = 0; y < ny; y ++) {
+		    long r = (long)z * ny + y;
+		    if (y > 0) join_rows(runs, parent, row_start[r - 1], row_start[r], row_start[r], row_start[r + 1]);
+		    if (z > slab_start[s]) join_rows(runs, parent, row_start[r - ny], row_start[r - ny + 1], row_start[r], row_start[r + 1]);
+	       }
+	  }
+     }
+     for (int s = 1; s < n_slabs; s ++) {
+	  int z = slab_start[s];
+	  for (unsigned y = 0; y < ny; y ++) {
+	       long r = (long)z * ny + y;
+	       join_rows(runs, parent, row_start[r - ny], row_start[r - ny + 1], row_start[r], row_start[r + 1]);
+	  }
+     }
+
+     // compact equivalence table: component id of each run, and the size of
+     // each component. A root is always the first run of its component, so
+     // the ids follow the raster order, as ITK's labels.
+     std::vector<unsigned> & comp = parent;
+     std::vector<size_t> comp_size;
+     for (size_t i = 0; i < n_runs; i ++) {
+	  if (parent[i] == i) {
+	       comp[i] = comp_size.size();
+	       comp_size.push_back(0);
+	  }
+	  else {
+	       // parent[i] < i is already a component id.
+	       comp[i] = comp[parent[i]];
+	  }
+	  comp_size[comp[i]] += runs[i].x1 - runs[i].x0;
+     }
+     const unsigned n_comp = comp_size.size();
+
+     // the n_keep largest components. Ties go to the first in raster order.
+     std::vector<unsigned> order(n_comp);
+     for (unsigned c = 0; c < n_comp; c ++) order[c] = c;
+     n_keep = std::min(n_keep, n_comp);
+     std::partial_sort(order.begin(), order.begin() + n_keep, order.end(), CompareSize(comp_size));
+     std::vector<unsigned char> keep(n_comp, 0);
+     for (unsigned k = 0; k < n_keep; k ++) {
+	  keep[order[k]] = 1;
+	  if (verbose >= 1) printf("component %u: %ld voxels.\n", order[k], (long)comp_size[order[k]]);
+     }
+
+     bm_allocate(out, in.size);
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  uint64_t * row = &out.bits[r * out.n_words];
+	  for (size_t i = row_start[r]; i < row_start[r + 1]; i ++) {
+	       if (keep[comp[i]]) fill_run(row, runs[i].x0, runs[i].x1);
+	  }
+     }
+     return n_comp;
+}
@@ -0,0 +1,17 @@
+#ifndef __COMPONENTS_H__
+#define __COMPONENTS_H__
+
+#include "bitmask.h"
+
+// Keep the n_keep largest face connected (6-neighborhood) components of a
+// mask, same as ITK's ConnectedComponentImageFilter followed by
+// LabelShapeKeepNObjectsImageFilter on the number of pixels, but the output is
+// a mask instead of a label volume.
+//
+// The foreground runs of each row are labeled with a union-find forest, and the
+// component sizes are counted from the runs, so the memory is proportional to
+// the number of runs, not voxels. Runs are extracted and joined in parallel
+// over slabs of slices. Returns the number of components.
+unsigned cc_keep_largest(const BitMask & in, BitMask & out, unsigned n_keep, unsigned short verbose = 0);
+
+#endif
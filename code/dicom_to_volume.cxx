@@ -0,0 +1,283 @@
+#include <common.h>
+#include <utility.h>
+#include <cmath>
+#include <algorithm>
+#include <itkGDCMImageIO.h>
+#include <itkGDCMSeriesFileNames.h>
+
+// one file of the series. The header is read first, and the slices are
+// sorted by their position along the normal before any pixel is decoded, so
+// each slice is decoded straight into its place in the volume.
+struct DicomSlice
+{
+     std::string file;
+     itk::GDCMImageIO::Pointer io;
+     double position; // position along the normal of the first slice.
+     bool operator<(const DicomSlice & s) const { return position < s.position; }
+};
+
+// convert a slice of the component type of the file into the pixel type of
+// the volume.
+template <class TIn, class TOut>
+static void convert_slice(const void * in, TOut * out, size_t n)
+{
+     const TIn * src = (const TIn *)in;
+     for (size_t i = 0; i < n; i ++) out[i] = static_cast<TOut>(src[i]);
+}
+
+template <class TOut>
+static bool convert_slice(itk::ImageIOBase::IOComponentType type, const void * in, TOut * out, size_t n)
+{
+     switch (type) {
+     case itk::ImageIOBase::UCHAR: convert_slice<unsigned char>(in, out, n); break;
+     case itk::ImageIOBase::CHAR: convert_slice<char>(in, out, n); break;
+     case itk::ImageIOBase::USHORT: convert_slice<unsigned short>(in, out, n); break;
+     case itk::ImageIOBase::SHORT: convert_slice<short>(in, out, n); break;
+     case itk::ImageIOBase::UINT: convert_slice<unsigned int>(in, out, n); break;
+     case itk::ImageIOBase::INT: convert_slice<int>(in, out, n); break;
+     case itk::ImageIOBase::FLOAT: convert_slice<float>(in, out, n); break;
+     case itk::ImageIOBase::DOUBLE: convert_slice<double>(in, out, n); break;
+     default: return false;
+     }
+     return true;
+}
+
+// read the headers of all slices in parallel, check them, and sort the
+// slices by position. dz is the slice spacing.
+static int read_series(const std::vector<std::string> & files, std::vector<DicomSlice> & slices, double & dz)
+{
+     const long n_slices = files.size();
+     slices.resize(n_slices);
+
+     // the IOs are created here, and the first header read on its own, as
+     // the GDCM dictionaries are set up on first use.
+     for (long k = 0; k < n_slices; k ++) {
+	  slices[k].file = files[k];
+	  slices[k].io = itk::GDCMImageIO::New();
+	  slices[k].io->SetFileName(files[k]);
+     }
+     long n_failed = 0;
+     try {
+	  slices[0].io->ReadImageInformation();
+     }
+     catch (itk::ExceptionObject & err) {
+	  std::cerr << "dicom_to_volume(): cannot read " << files[0] << ": " << err << "\n";
+	  return 1;
+     }
+#pragma omp parallel for schedule(dynamic) reduction(+:n_failed)
+     for (long k = 1; k < n_slices; k ++) {
+	  try {
+	       slices[k].io->ReadImageInformation();
+	  }
+	  catch (itk::ExceptionObject & err) {
+#pragma omp critical
+	       std::cerr << "dicom_to_volume(): cannot read " << files[k] << ": " << err << "\n";
+	       n_failed ++;
+	  }
+     }
+     if (n_failed > 0) return 1;
+
+     // all slices must have the size and orientation of the first one.
+     itk::GDCMImageIO * first = slices[0].io;
+     if (first->GetNumberOfDimensions() < 3) {
+	  std::cerr << "dicom_to_volume(): no slice position in " << files[0] << ".\n";
+	  return 1;
+     }
+     const unsigned nx = first->GetDimensions(0), ny = first->GetDimensions(1);
+     const std::vector<double> normal = first->GetDirection(2);
+     for (long k = 0; k < n_slices; k ++) {
+	  itk::GDCMImageIO * io = slices[k].io;
+	  if (io->GetDimensions(0) != nx || io->GetDimensions(1) != ny || (io->GetNumberOfDimensions() > 2 && io->GetDimensions(2) != 1) || io->GetNumberOfComponents() != 1) {
+	       std::cerr << "dicom_to_volume(): " << files[k] << " is not a single slice of the size of " << files[0] << ".\n";
+	       return 1;
+	  }
+	  slices[k].position = 0;
+	  for (unsigned d = 0; d < 3; d ++) {
+	       slices[k].position += io->GetOrigin(d) * normal[d];
+	  }
+     }
+     std::sort(slices.begin(), slices.end());
+
+     // slice spacing from the positions, as the slice thickness in the headers
+     // is not always the spacing.
+     dz = n_slices > 1? (slices[n_slices - 1].position - slices[0].position) / (n_slices - 1) : first->GetSpacing(2);
+     for (long k = 1; k < n_slices; k ++) {
+	  double gap = slices[k].position - slices[k - 1].position;
+	  if (gap <= 0) {
+	       std::cerr << "dicom_to_volume(): " << slices[k - 1].file << " and " << slices[k].file << " are at the same position. Is the series more than one acquisition?\n";
+	       return 1;
+	  }
+	  if (fabs(gap - dz) > 0.01 * dz) {
+	       std::cout << "dicom_to_volume(): warning: gap of " << gap << " between " << slices[k - 1].file << " and " << slices[k].file << ", while the mean spacing is " << dz << ".\n";
+	  }
+     }
+     return 0;
+}
+
+// decode the sorted slices in parallel into one volume.
+template <class TImage>
+static int ingest(std::vector<DicomSlice> & slices, double dz, const std::string & out_file, unsigned short verbose)
+{
+     typedef typename TImage::PixelType PixelType;
+     const long n_slices = slices.size();
+     const unsigned nx = slices[0].io->GetDimensions(0), ny = slices[0].io->GetDimensions(1);
+     long n_failed = 0;
+
+     typename TImage::Pointer outPtr = TImage::New();
+     typename TImage::SizeType size;
+     size[0] = nx;
+     size[1] = ny;
+     size[2] = n_slices;
+     typename TImage::RegionType region;
+     region.SetSize(size);
+     outPtr->SetRegions(region);
+     outPtr->Allocate();
+     typename TImage::SpacingType spacing;
+     typename TImage::PointType origin;
+     typename TImage::DirectionType direction;
+     for (unsigned d = 0; d < 3; d ++) {
+	  spacing[d] = d < 2? slices[0].io->GetSpacing(d) : dz;
+	  origin[d] = slices[0].io->GetOrigin(d);
+	  for (unsigned c = 0; c < 3; c ++) {
+	       direction[d][c] = slices[0].io->GetDirection(c)[d];
+	  }
+     }
+     outPtr->SetSpacing(spacing);
+     outPtr->SetOrigin(origin);
+     outPtr->SetDirection(direction);
+     if (verbose >= 1) {
+	  printf("%ld slices of %u x %u, spacing %.4f %.4f %.4f.\n", n_slices, nx, ny, spacing[0], spacing[1], spacing[2]);
+     }
+
+     // decode. A slice already in the pixel type of the volume is decoded in
+     // place, others through a buffer of the thread.
+     PixelType * outBuffer = outPtr->GetBufferPointer();
+     const size_t slice_size = (size_t)nx * ny;
+     const itk::ImageIOBase::IOComponentType out_type = itk::ImageIOBase::MapPixelType<PixelType>::CType;
+#pragma omp parallel reduction(+:n_failed)
+     {
+	  std::vector<char> buf;
+#pragma omp for schedule(dynamic)
+	  for (long k = 0; k < n_slices; k ++) {
+	       itk::GDCMImageIO * io = slices[k].io;
+	       PixelType * out = outBuffer + k * slice_size;
+	       try {
+		    if (io->GetComponentType() == out_type) {
+			 io->Read(out);
+		    }
+		    else {
+			 buf.resize(io->GetImageSizeInBytes());
+			 io->Read(&buf[0]);
+			 if (!convert_slice(io->GetComponentType(), &buf[0], out, slice_size)) {
+#pragma omp critical
+			      std::cerr << "dicom_to_volume(): pixel type of " << slices[k].file << " not supported.\n";
+			      n_failed ++;
+			 }
+		    }
+	       }
+	       catch (itk::ExceptionObject & err) {
+#pragma omp critical
+		    std::cerr << "dicom_to_volume(): cannot decode " << slices[k].file << ": " << err << "\n";
+		    n_failed ++;
+	       }
+	       slices[k].io = 0;
+	  }
+     }
+     if (n_failed > 0) return 1;
+
+     save_volume(outPtr, out_file);
+     return save_volume_flush() > 0? 1 : 0;
+}
+
+namespace po = boost::program_options;
+int main(int argc, char* argv[])
+{
+     std::string in_dir, out_file, series, type;
+     unsigned short verbose = 0;
+     bool list = false;
+
+     po::options_description mydesc("Options can only used at commandline");
+     mydesc.add_options()
+	  ("help,h", "Convert a DICOM series into a volume. The slices are decoded in parallel and sorted by their position. The format of the output is given by its extension: .nii (uncompressed), .brick (chunked) or .nii.gz (parallel gzip).")
+	  ("input,i", po::value<std::string>(&in_dir)->default_value("."),
+	   "Directory of the DICOM files. Its subdirectories are searched too.")
+	  ("output,o", po::value<std::string>(&out_file)->default_value("output.nii"),
+	   "Output volume.")
+	  ("series,s", po::value<std::string>(&series),
+	   "UID of the series to convert. The series with the most slices if not given.")
+	  ("list,l", po::bool_switch(&list),
+	   "List the series of the directory, and exit.")
+	  ("type,t", po::value<std::string>(&type)->default_value("short"),
+	   "Pixel type of the output: short (CT in Hounsfield units) or float. A series with a rescale slope or intercept that is not integer is always saved as float.")
+	  ("verbose,v", po::value<unsigned short>(&verbose)->default_value(0),
+	   "verbose level. 0 for minimal output. 3 for most output.");
+
+     po::variables_map vm;
+     po::store(po::parse_command_line(argc, argv, mydesc), vm);
+     po::notify(vm);
+
+     try {
+	  if ( (vm.count("help")) | (argc == 1) ) {
+	       std::cout << "Usage: dicom_to_volume [options]\n";
+	       std::cout << mydesc << "\n";
+	       return 0;
+	  }
+     }
+     catch(std::exception& e) {
+	  std::cout << e.what() << "\n";
+	  return 1;
+     }
+     if (type != "short" && type != "float") {
+	  std::cout << "type must be short or float.\n";
+	  return 1;
+     }
+
+     itk::GDCMSeriesFileNames::Pointer names = itk::GDCMSeriesFileNames::New();
+     names->SetUseSeriesDetails(true);
+     names->SetRecursive(true);
+     names->SetDirectory(in_dir);
+     const std::vector<std::string> & uids = names->GetSeriesUIDs();
+     if (uids.empty()) {
+	  std::cerr << "dicom_to_volume(): no DICOM series in " << in_dir << "\n";
+	  return 1;
+     }
+     size_t largest = 0, n_largest = 0;
+     for (size_t s = 0; s < uids.size(); s ++) {
+	  size_t n = names->GetFileNames(uids[s]).size();
+	  if (list) std::cout << uids[s] << ": " << n << " files.\n";
+	  if (n > n_largest) {
+	       largest = s;
+	       n_largest = n;
+	  }
+     }
+     if (list) return 0;
+     if (series.empty()) {
+	  series = uids[largest];
+	  if (verbose >= 1 || uids.size() > 1) {
+	       std::cout << "dicom_to_volume(): " << uids.size() << " series in " << in_dir << ", converting " << series << ".\n";
+	  }
+     }
+     else if (std::find(uids.begin(), uids.end(), series) == uids.end()) {
+	  std::cerr << "dicom_to_volume(): no series " << series << " in " << in_dir << "\n";
+	  return 1;
+     }
+
+     const std::vector<std::string> files = names->GetFileNames(series);
+     std::vector<DicomSlice> slices;
+     double dz = 0;
+     if (read_series(files, slices, dz)) {
+	  return 1;
+     }
+
+     // the pixels of a series with a rescale slope or intercept that is not
+     // integer are float, and would be truncated in short.
+     for (size_t k = 0; type == "short" && k < slices.size(); k ++) {
+	  itk::ImageIOBase::IOComponentType ct = slices[k].io->GetComponentType();
+	  if (ct == itk::ImageIOBase::FLOAT || ct == itk::ImageIOBase::DOUBLE) {
+	       std::cout << "dicom_to_volume(): warning: " << slices[k].file << " has pixels that are not integer, the output is float instead of short.\n";
+	       type = "float";
+	  }
+     }
+     if (type == "float") return ingest<ImageType3F>(slices, dz, out_file, verbose);
+     return ingest<ImageType3DS>(slices, dz, out_file, verbose);
+}
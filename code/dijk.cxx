@@ -1,32 +1,15 @@
 #include <common.h>
 #include <utility.h>
-
-int build_graph(lemon::StaticDigraph & g,
-		ImageType3DC::Pointer maskPtr,
-		ImageType3DU::Pointer nodemapPtr,
-		const ParType & par);
-
-int build_ijk_map(lemon::StaticDigraph & g,
-		  lemon::StaticDigraph::NodeMap<itk::Index<3> > & ijkmap,
-		  ImageType3DC::Pointer maskPtr,
-		  ImageType3DU::Pointer nodemapPtr);
-
-int build_cost_map(lemon::StaticDigraph & g,
-		   ImageType3DF::Pointer vnessPtr,
-		   ImageTypeArray3F::Pointer evPtr,
-		   lemon::StaticDigraph::NodeMap<itk::Index<3> > & ijkmap,		   
-		   lemon::StaticDigraph::ArcMap<double> & costmap);
-
-int find_target_nodes(std::set<lemon::StaticDigraph::Node> & target_set,
-		      lemon::StaticDigraph & g,
-		      ImageType3DC::Pointer maskPtr,
-		      ImageType3DU::Pointer nodemapPtr,
-		      const ParType & par);
+#include "rle_mask.h"
+#include "roi.h"
+#include "mapped_volume.h"
+#include "vessel_graph.h"
 
 namespace po = boost::program_options;
 int main(int argc, char* argv[])
 {
-     std::string mask_file, vesselness_file, lungmask_file, eigenvector_file, cost_file, accuscore_file;
+     std::string mask_file, vesselness_file, lungmask_file, eigenvector_file, cost_file, accuscore_file, roi_mode;
+     unsigned margin = 1;
      ParType par;
      // program options.
      po::options_description mydesc("Options can only used at commandline");
@@ -47,6 +30,10 @@ int main(int argc, char* argv[])
 	  ("seed,s", po::value<std::vector<int> >()->multitoken(), "Source voxel coordinates. Must be in the format of: --seed i j k. ")
 	  ("nbrs,b", po::value<unsigned short>(&par.n_nbrs)->default_value(6), 
 	   "Number of neighbors of each voxel. Must be one of 6, 18, or 26. .")
+	  ("roi", po::value<std::string>(&roi_mode)->default_value("full"),
+	   "full: keep the full volumes in memory. auto: keep only the bounding box of the mask grown by the margin. The cost map is 0 outside it, same as other voxels outside the mask.")
+	  ("margin", po::value<unsigned>(&margin)->default_value(1),
+	   "Margin of the ROI in voxels, with --roi auto.")
 	  ("verbose,v", po::value<unsigned short>(&par.verbose)->default_value(0), 
 	   "verbose level. 0 for minimal output. 3 for most output.");
 
@@ -74,29 +61,49 @@ int main(int argc, char* argv[])
 	  seedIdx[1] = seed_opt[1];
 	  seedIdx[2] = seed_opt[2];
      }
+     else {
+	  std::cout << "seed must be given as --seed i j k.\n";
+	  return 1;
+     }
      // read in mask file.
-     ReaderType3DC::Pointer maskReader = ReaderType3DC::New();
-     maskReader->SetFileName(mask_file);
-     maskReader->Update();
-     ImageType3DC::Pointer maskPtr = maskReader->GetOutput();
+     ImageType3DC::Pointer maskPtr = read_volume_mapped<ImageType3DC>(mask_file, par.verbose);
+
+     // the graph is built from the runs of the mask, so the volumes are only
+     // needed on the bounding box of the mask.
+     RLEMask mask;
+     rle_from_image(maskPtr.GetPointer(), mask);
+     VolumeROI roi;
+     if (roi_init(roi, roi_mode, maskPtr.GetPointer(), mask, margin, par.verbose)) {
+	  return 1;
+     }
+     // the seed must be a voxel of the mask, or it has no node in the graph.
+     // The ROI holds all voxels of the mask.
+     if (!roi.region.IsInside(seedIdx)) {
+	  printf("dijk(): seed %i %i %i is not in the mask.\n", seed_opt[0], seed_opt[1], seed_opt[2]);
+	  return 1;
+     }
+     if (roi.active) {
+	  maskPtr = roi_crop(roi, maskPtr);
+	  rle_from_image(maskPtr.GetPointer(), mask);
+	  for (unsigned d = 0; d < 3; d ++) {
+	       seedIdx[d] -= roi.region.GetIndex(d);
+	  }
+     }
+     if (rle_find(mask, seedIdx[2] * mask.size[1] + seedIdx[1], seedIdx[0]) < 0) {
+	  printf("dijk(): seed %i %i %i is not in the mask.\n", seed_opt[0], seed_opt[1], seed_opt[2]);
+	  return 1;
+     }
 
      // read in lungmask file.
-     ReaderType3DC::Pointer lungmaskReader = ReaderType3DC::New();
-     lungmaskReader->SetFileName(lungmask_file);
-     lungmaskReader->Update();
-     ImageType3DC::Pointer lungmaskPtr = lungmaskReader->GetOutput();
+     ImageType3DC::Pointer lungmaskPtr = read_volume_mapped<ImageType3DC>(lungmask_file, par.verbose);
 
      // read in vesselness file
-     ReaderType3DF::Pointer vnessReader = ReaderType3DF::New();
-     vnessReader->SetFileName(vesselness_file);
-     vnessReader->Update();
-     ImageType3DF::Pointer vnessPtr = vnessReader->GetOutput();
+     ImageType3DF::Pointer vnessPtr = read_volume_mapped<ImageType3DF>(vesselness_file, par.verbose);
+     vnessPtr = roi_crop(roi, vnessPtr);
 
      // read Hessian eigenvector file
-     ReaderTypeArray3F::Pointer eigenvectorReader = ReaderTypeArray3F::New();
-     eigenvectorReader->SetFileName(eigenvector_file);
-     eigenvectorReader->Update();
-     ImageTypeArray3F::Pointer eigenvectorPtr = eigenvectorReader->GetOutput();
+     ImageTypeArray3F::Pointer eigenvectorPtr = read_volume_mapped<ImageTypeArray3F>(eigenvector_file, par.verbose);
+     eigenvectorPtr = roi_crop(roi, eigenvectorPtr);
 
      // define a volume to convert (i,j,k) to node id. 
      ImageType3DU::Pointer nodemapPtr = ImageType3DU::New();
@@ -108,13 +115,15 @@ int main(int argc, char* argv[])
      lemon::StaticDigraph g;
      
      // build the graph.
-     build_graph(g, maskPtr, nodemapPtr, par);
+     if (build_graph(g, mask, nodemapPtr, par)) {
+	  return 1;
+     }
 
      // Define a map to convert node to voxel ijk coordinates.
      lemon::StaticDigraph::NodeMap< itk::Index<3> > ijkmap(g);
 
      // build the ijkmap.
-     build_ijk_map(g, ijkmap, maskPtr, nodemapPtr);
+     build_ijk_map(g, ijkmap, mask, nodemapPtr);
 
      // define the cost of the arcs and init to zero.
      CostMap costmap(g, 0);
@@ -146,7 +155,7 @@ int main(int argc, char* argv[])
      	  costPtr->SetPixel(ijkmap[nodeIt], distmap[nodeIt]);
      }
 
-     save_volume(costPtr, cost_file);
+     save_volume(roi_paste(roi, costPtr, 0), cost_file);
 
      // // find all the target nodes.
      // std::set<lemon::StaticDigraph::Node> target_set;
@@ -208,211 +217,3 @@ int main(int argc, char* argv[])
      return 0;
 }
 
-
-int build_graph(lemon::StaticDigraph & g,
-		ImageType3DC::Pointer maskPtr,
-		ImageType3DU::Pointer nodemapPtr,
-		const ParType & par)
-{
-     typedef itk::NeighborhoodIterator< ImageType3DC> NeighborhoodIteratorType;
-     typedef itk::ConstantBoundaryCondition<ImageType3DC>  BoundaryConditionType;
-
-     // Define neighborhood iterator on mask.
-     NeighborhoodIteratorType::RadiusType radius;
-     radius.Fill(1);
-     NeighborhoodIteratorType maskIt(radius, maskPtr, maskPtr->GetLargestPossibleRegion() );
-     BoundaryConditionType constCondition;
-     constCondition.SetConstant(-1);     
-     maskIt.OverrideBoundaryCondition(&constCondition);
-
-     ImageType3DU::IndexType nodemapIdx;
-     
-     // xplus, xminus, yplus, yminus, zplus, zminus
-     // std::array<unsigned int, 6 > neiIdxSet = {{14, 12, 16, 10, 22, 4}}; 
-     unsigned int nei_set_array[] = {4, 10, 12, 14, 16, 22, // 6 neighborhood
-				     1, 3, 5, 7, 9, 11, 15, 17, 19, 21, 23, 25, // 18 neighborhood
-				     0, 2, 6, 8, 18, 20, 24, 26}; // 26 neighborhood
-
-     if (par.n_nbrs != 6 && par.n_nbrs != 18 && par.n_nbrs != 26) {
-	  printf("build_graph(): number of neighbors must be 6, 18, or 26. Other values may give inacruate results!\n");
-	  exit(1);
-     }
-
-     IteratorType3DU nodemapIt(nodemapPtr, nodemapPtr->GetLargestPossibleRegion());
-
-     // compute total number of nodes, and build nodemap. This must be separate
-     // from building the edges below, since we need to know the nodemap in
-     // order to build edges.
-     unsigned n_nodes = 0;
-     for (maskIt.GoToBegin(), nodemapIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ nodemapIt) {
-	  if (maskIt.GetCenterPixel() > 0) {
-	       nodemapIt.Set(n_nodes);
-	       n_nodes ++;
-	  }
-     }
-
-     // build edges, and also the costs.
-     std::vector<std::pair<int,int> > arcs;
-     unsigned short offset = 0;
-     unsigned cur_node_id = 0, nbr_node_id = 0;
-     for (maskIt.GoToBegin(), nodemapIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ nodemapIt) {
-	  if (maskIt.GetCenterPixel() > 0) {
-	       cur_node_id = nodemapIt.Get();
-	       for (unsigned neiIdx = 0; neiIdx < par.n_nbrs; neiIdx ++) {
-		    offset = nei_set_array[neiIdx];
-		    if (maskIt.GetPixel(offset) > 0) {
-			 // neighbor also in mask.
-			 nodemapIdx = maskIt.GetIndex(offset);
-			 nbr_node_id = nodemapPtr->GetPixel(nodemapIdx);
-			 // undirected graph is represented by directed garph
-			 // with two arcs. Each node has the chance of becoming
-			 // neighboring node, hence two arcs will be added
-			 // eventrually.
-			 arcs.push_back(std::make_pair(cur_node_id, nbr_node_id));			 
-		    } // maskIt.Get
-	       } // neiIdx
-	  } // maskIt.GetCenter
-     } // maskIt
-
-     // build the graph. 
-     g.build(n_nodes, arcs.begin(), arcs.end());     
-     return 0;
-}
-
-int build_ijk_map(lemon::StaticDigraph & g,
-		  lemon::StaticDigraph::NodeMap<itk::Index<3> > & ijkmap,
-		  ImageType3DC::Pointer maskPtr,
-		  ImageType3DU::Pointer nodemapPtr)
-
-{
-     IteratorType3DC maskIt(maskPtr, maskPtr->GetLargestPossibleRegion() );     
-     IteratorType3DU nodemapIt(nodemapPtr, nodemapPtr->GetLargestPossibleRegion() );     
-
-     // we use a push method. Given the ijk voxel coordinates, find the node, and update the ijkmap. 
-     for (maskIt.GoToBegin(), nodemapIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ nodemapIt) {
-	  if (maskIt.Get() > 0) {
-	       ijkmap[g.node(nodemapIt.Get())] = maskIt.GetIndex();
-	  }
-     }
-     return 0;
-}
-
-
-int build_cost_map(lemon::StaticDigraph & g,
-		   ImageType3DF::Pointer vnessPtr,
-		   ImageTypeArray3F::Pointer evPtr,
-		   lemon::StaticDigraph::NodeMap<itk::Index<3> > & ijkmap,		   
-		   lemon::StaticDigraph::ArcMap<double> & costmap)
-{
-     itk::Offset<3> offset;
-     offset.Fill(0);
-     double sum_of_square = 0;
-     double proj_weight = 0; // the weight of vesselness when projected on a
-			     // axis.
-     double proj_vness = 0;
-     double mag = 0; // offset unit vector magnitude
-     ImageTypeArray3D::IndexType idx;
-     idx.Fill(0);
-     Array3F ev;
-     ev.Fill(0);
-
-     // we use offset as a unit vector, and project Hessian's eigenvector to
-     // this unit vector.
-     
-     for (lemon::StaticDigraph::ArcIt arcIt(g); arcIt != lemon::INVALID; ++ arcIt) {
-	  offset = ijkmap[g.target(arcIt)] - ijkmap[g.source(arcIt)];
-	  sum_of_square = (double)(offset[0]*offset[0] + offset[1]*offset[1] + offset[2]*offset[2]);
-	  mag = sqrt(sum_of_square);
-
-	  // eigenvector is assumed to be unit already.
-	  idx = ijkmap[g.source(arcIt)];
-	  ev = evPtr->GetPixel(idx);
-	  proj_weight = (ev[0] * (double)offset[0] + ev[1] * (double)offset[1] + ev[2] * (double)offset[2]);
-	  proj_weight = fabs(proj_weight) / mag;
-	  proj_vness = vnessPtr->GetPixel(idx) * proj_weight;
-	  // costmap[arcIt] = 1 / (proj_vness + 1);
-	  costmap[arcIt] = exp(- proj_vness);
-	  // costmap[arcIt] = exp(- vnessPtr->GetPixel(ijkmap[g.source(arcIt)]) ); 
-
-     }
-}
-
-int find_target_nodes(std::set<lemon::StaticDigraph::Node> & target_set,
-		      lemon::StaticDigraph & g,
-		      ImageType3DC::Pointer maskPtr,
-		      ImageType3DU::Pointer nodemapPtr,
-		      const ParType & par)
-{
-     typedef itk::NeighborhoodIterator< ImageType3DC> NeighborhoodIteratorType;
-     typedef itk::ConstantBoundaryCondition<ImageType3DC>  BoundaryConditionType;
-
-     // Define neighborhood iterator on mask.
-     NeighborhoodIteratorType::RadiusType radius;
-     radius.Fill(1);
-     NeighborhoodIteratorType maskIt(radius, maskPtr, maskPtr->GetLargestPossibleRegion() );
-     BoundaryConditionType constCondition;
-     constCondition.SetConstant(-1);     
-     maskIt.OverrideBoundaryCondition(&constCondition);
-
-     ImageType3DU::IndexType nodemapIdx;
-     
-     // xplus, xminus, yplus, yminus, zplus, zminus
-     // std::array<unsigned int, 6 > neiIdxSet = {{14, 12, 16, 10, 22, 4}}; 
-     unsigned int nei_set_array[] = {4, 10, 12, 14, 16, 22, // 6 neighborhood
-				     1, 3, 5, 7, 9, 11, 15, 17, 19, 21, 23, 25, // 18 neighborhood
-				     0, 2, 6, 8, 18, 20, 24, 26}; // 26 neighborhood
-
-     if (par.n_nbrs != 6 && par.n_nbrs != 18 && par.n_nbrs != 26) {
-	  printf("build_graph(): number of neighbors must be 6, 18, or 26. Other values may give inacruate results!\n");
-	  exit(1);
-     }
-
-     IteratorType3DU nodemapIt(nodemapPtr, nodemapPtr->GetLargestPossibleRegion());
-
-     // build edges.
-     std::vector<std::pair<int,int> > arcs;
-     unsigned short offset = 0;
-     unsigned cur_node_id = 0, nbr_node_id = 0;
-     ImageType3DC::SizeType maskSize = maskPtr->GetLargestPossibleRegion().GetSize();
-     if (maskSize[2] == 1) { // 2D image.
-	  for (maskIt.GoToBegin(), nodemapIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ nodemapIt) {
-	       if (maskIt.GetCenterPixel() > 0) {
-		    if (maskIt.GetPixel(10) <=0 || maskIt.GetPixel(12) <= 0 || maskIt.GetPixel(14) <= 0 || maskIt.GetPixel(16) <= 0) {
-			 // one neighbor falls outside of mask. Current voxel
-			 // must be on boundary.
-			 cur_node_id = nodemapIt.Get();
-			 target_set.insert(g.node(cur_node_id));
-		    }
-	       }
-	  } // maskIt
-     }
-
-     else { // 3D volume
-	  for (maskIt.GoToBegin(), nodemapIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ nodemapIt) {
-	       if (maskIt.GetCenterPixel() > 0) {
-		    unsigned neiIdx = 0;
-		    bool outside_nbr = false; // one neighbor is outside mask. 
-		    do {
-			 // for (unsigned neiIdx = 0; neiIdx < par.n_nbrs; neiIdx ++) {
-			 offset = nei_set_array[neiIdx];
-			 if (maskIt.GetPixel(offset) <= 0) {
-			      // tell if one neighbor is outside.
-			      outside_nbr = true;
-			      // std::cout << "find_target_nodes(): found " << maskIt.GetIndex() << std::endl;
-			 }
-			 neiIdx ++;
-		    }
-		    while(neiIdx < par.n_nbrs && !outside_nbr);
-
-		    if (outside_nbr) {
-			 // one neighbor falls outside of mask. Current voxel
-			 // must be on boundary.
-			 cur_node_id = nodemapIt.Get();
-			 target_set.insert(g.node(cur_node_id));
-		    }
-	       }
-	  } // maskIt
-     }
-
-     return 0;
-}
@@ -1,15 +1,17 @@
 #include <common.h>
 #include <utility.h>
-#include "itkBinaryDilateImageFilter.h"
-#include "itkBinaryBallStructuringElement.h"
+#include "bitmask.h"
+#include "edt.h"
+#include "roi.h"
 #include "itkSubtractImageFilter.h"
 
 namespace po = boost::program_options;
 int main(int argc, char* argv[])
 {
-     std::string in_file, out_file, diff_file;
+     std::string in_file, out_file, diff_file, roi_mode;
+     unsigned margin = 0;
      unsigned short radius = 5, verbose = 0;
-     bool diff = false;
+     bool diff = false, edt = false;
 
      po::options_description mydesc("Options can only used at commandline");
      mydesc.add_options()
@@ -20,11 +22,18 @@ int main(int argc, char* argv[])
 	    "Output binary volumge.")
 	  ("radius,r", po::value<unsigned short>(&radius)->default_value(5), 
 	   "Radius of the structure elment.")
+	  ("edt,e", po::bool_switch(&edt),
+	   "Threshold an exact Euclidean distance transform instead of using the ball kernel. Same output, but the time does not depend on the radius, so it is faster for large radius.")
 	  ("diff,d", po::bool_switch(&diff),
 	   "Whether print the different of the intput and output images.")       
 	   ("diffout,t", po::value<std::string>(&diff_file)->default_value("diff.nii.gz"), 
 	    "The difference volume between input and output.")
 
+	  ("roi", po::value<std::string>(&roi_mode)->default_value("full"),
+	   "full: filter the full volume. auto: filter only the bounding box of the nonzero voxels grown by the margin. The output is the same.")
+	  ("margin", po::value<unsigned>(&margin)->default_value(0),
+	   "Margin of the ROI in voxels, with --roi auto. At least radius + 1 is used.")
+
 	  ("verbose,v", po::value<unsigned short>(&verbose)->default_value(0), 
 	   "verbose level. 0 for minimal output. 3 for most output.");
 
@@ -50,28 +59,58 @@ int main(int argc, char* argv[])
      inReader->Update();
      ImageType3UC::Pointer inPtr = inReader->GetOutput();
 
+     // voxels farther than the radius from the foreground do not change, so
+     // the filter can run on the bounding box grown by more than the radius.
+     RLEMask nonzero;
+     rle_from_image(inPtr.GetPointer(), nonzero);
+     VolumeROI roi;
+     if (roi_init(roi, roi_mode, inPtr.GetPointer(), nonzero, std::max(margin, (unsigned)radius + 1), verbose)) {
+	  return 1;
+     }
+     ImageType3UC::Pointer roiPtr = roi_crop(roi, inPtr);
+
 
-     typedef itk::BinaryBallStructuringElement<ImageType3UC::PixelType, ImageType3UC::ImageDimension>
-	  StructuringElementType;
-     StructuringElementType structuringElement;
-     structuringElement.SetRadius(radius);
      std::cout << "radius: " << radius << std::endl;
-     structuringElement.CreateStructuringElement();
 
-     typedef itk::BinaryDilateImageFilter <ImageType3UC, ImageType3UC, StructuringElementType>  FilterType;
-     FilterType::Pointer myFilter = FilterType::New();
-     myFilter->SetInput(inPtr);
-     myFilter->SetKernel(structuringElement);
-     myFilter->Update();
+     // bit-packed masks. Foreground is 255, the default of ITK's binary
+     // morphology filters, and the output is identical to them.
+     BitMask inMask, outMask;
+     bm_from_image(roiPtr, inMask, 255);
+     if (edt) {
+	  edt_dilate(inMask, outMask, radius);
+     }
+     else {
+	  bm_dilate(inMask, outMask, radius);
+     }
+
+     ImageType3UC::Pointer outPtr = ImageType3UC::New();
+     outPtr->SetRegions(roiPtr->GetLargestPossibleRegion());
+     outPtr->Allocate();
+     outPtr->SetOrigin(roiPtr->GetOrigin());
+     outPtr->SetSpacing(roiPtr->GetSpacing());
+     outPtr->SetDirection(roiPtr->GetDirection());
+     bm_to_image(outMask, outPtr, 255, 0);
+     outPtr = roi_paste(roi, outPtr, 0);
+
+     // dilated voxels are foreground. Other voxels keep the input value.
+     const unsigned char * inBuffer = inPtr->GetBufferPointer();
+     unsigned char * outBuffer = outPtr->GetBufferPointer();
+     const long n_voxels = inPtr->GetLargestPossibleRegion().GetNumberOfPixels();
+#pragma omp parallel for
+     for (long i = 0; i < n_voxels; i ++) {
+	  if (outBuffer[i] == 0) {
+	       outBuffer[i] = inBuffer[i];
+	  }
+     }
 
-     save_volume(myFilter->GetOutput(), out_file);
+     save_volume(outPtr, out_file);
 
      // print
      if (diff) {
 	  typedef itk::SubtractImageFilter<ImageType3UC> SubtractType;
 	  SubtractType::Pointer diff = SubtractType::New();
 	  diff->SetInput1(inPtr);
-	  diff->SetInput2(myFilter->GetOutput());
+	  diff->SetInput2(outPtr);
 	  save_volume(diff->GetOutput(), diff_file);
      }
 
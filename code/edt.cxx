@@ -0,0 +1,202 @@
+#include <cmath>
+#include <algorithm>
+#include "edt.h"
+
+// number of lines transformed together in the y and z passes.
+static const unsigned EDT_BLOCK = 16;
+
+// scratch buffers of one line.
+struct EDTLine
+{
+     std::vector<unsigned> f;
+     std::vector<unsigned> d;
+     std::vector<int> v;
+     std::vector<double> z;
+     EDTLine(unsigned n) : f(n), d(n), v(n), z(n + 1) {};
+};
+
+// 1D transform d[q] = min_p (q - p)^2 + f[p] by the lower envelope of the
+// parabolas rooted at the sites. Entries of f equal to EDT_INF are not sites.
+// Since d >= f, entries above limit can not give a distance within limit and
+// are not sites either. Distances above limit are EDT_INF.
+static void edt_line(EDTLine & line, unsigned n, unsigned limit)
+{
+     const unsigned * f = &line.f[0];
+     unsigned * d = &line.d[0];
+     int * v = &line.v[0];
+     double * z = &line.z[0];
+
+     // lines inside the sites.
+     bool all_zero = true;
+     for (unsigned q = 0; q < n && all_zero; q ++) all_zero = f[q] == 0;
+     if (all_zero) {
+	  std::fill(d, d + n, 0u);
+	  return;
+     }
+
+     int k = -1;
+     for (int q = 0; q < (int)n; q ++) {
+	  if (f[q] > limit) continue;
+	  double s = 0;
+	  while (k >= 0) {
+	       s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * (q - v[k]));
+	       if (s <= z[k]) k --;
+	       else break;
+	  }
+	  k ++;
+	  v[k] = q;
+	  z[k] = k == 0? -HUGE_VAL : s;
+     }
+
+     if (k < 0) {
+	  std::fill(d, d + n, EDT_INF);
+	  return;
+     }
+     z[k + 1] = HUGE_VAL;
+     int j = 0;
+     for (int q = 0; q < (int)n; q ++) {
+	  while (z[j + 1] < q) j ++;
+	  double dq = (double)(q - v[j]) * (q - v[j]) + f[v[j]];
+	  d[q] = dq > limit? EDT_INF : (unsigned)dq;
+     }
+}
+
+// transform nb adjacent lines of length n. Line b starts at base[b], and
+// consecutive points of a line are stride apart.
+static void blocked_lines(std::vector<EDTLine> & lines, unsigned * base, size_t stride, unsigned n, unsigned nb, unsigned limit)
+{
+     for (unsigned i = 0; i < n; i ++) {
+	  const unsigned * src = base + i * stride;
+	  for (unsigned b = 0; b < nb; b ++) lines[b].f[i] = src[b];
+     }
+     for (unsigned b = 0; b < nb; b ++) {
+	  edt_line(lines[b], n, limit);
+     }
+     for (unsigned i = 0; i < n; i ++) {
+	  unsigned * dst = base + i * stride;
+	  for (unsigned b = 0; b < nb; b ++) dst[b] = lines[b].d[i];
+     }
+}
+
+void edt_squared(const BitMask & mask, bool complement, std::vector<unsigned> & dist, unsigned limit)
+{
+     const unsigned nx = mask.size[0], ny = mask.size[1], nz = mask.size[2];
+     dist.resize((size_t)nx * ny * nz);
+
+     // x lines: distance to the nearest site in the row, by a forward and a
+     // backward scan.
+#pragma omp parallel
+     {
+	  std::vector<unsigned> near(nx);
+#pragma omp for
+	  for (int z = 0; z < (int)nz; z ++) {
+	       for (unsigned y = 0; y < ny; y ++) {
+		    const uint64_t * row = mask.row(y, z);
+		    unsigned * d = &dist[((size_t)z * ny + y) * nx];
+		    long last = -1;
+		    for (unsigned x = 0; x < nx; x ++) {
+			 bool bit = (row[x >> 6] >> (x & 63)) & 1;
+			 if (bit != complement) last = x;
+			 near[x] = last < 0? EDT_INF : x - last;
+		    }
+		    last = -1;
+		    for (long x = nx - 1; x >= 0; x --) {
+			 if (near[x] == 0) last = x;
+			 unsigned dx = near[x];
+			 if (last >= 0 && (unsigned)(last - x) < dx) dx = last - x;
+			 d[x] = (dx == EDT_INF || (double)dx * dx > limit)? EDT_INF : dx * dx;
+		    }
+	       }
+	  }
+     }
+
+     // y and z lines, EDT_BLOCK adjacent lines at a time so the strided reads
+     // and writes use whole cache lines.
+     const size_t slice = (size_t)nx * ny;
+     const long n_blocks = (nx + EDT_BLOCK - 1) / EDT_BLOCK;
+#pragma omp parallel
+     {
+	  std::vector<EDTLine> lines(EDT_BLOCK, EDTLine(ny));
+#pragma omp for
+	  for (long n = 0; n < nz * n_blocks; n ++) {
+	       const unsigned z = n / n_blocks, x0 = (n % n_blocks) * EDT_BLOCK;
+	       const unsigned nb = std::min(EDT_BLOCK, nx - x0);
+	       unsigned * base = &dist[z * slice + x0];
+	       blocked_lines(lines, base, nx, ny, nb, limit);
+	  }
+     }
+#pragma omp parallel
+     {
+	  std::vector<EDTLine> lines(EDT_BLOCK, EDTLine(nz));
+#pragma omp for
+	  for (long n = 0; n < ny * n_blocks; n ++) {
+	       const unsigned y = n / n_blocks, x0 = (n % n_blocks) * EDT_BLOCK;
+	       const unsigned nb = std::min(EDT_BLOCK, nx - x0);
+	       unsigned * base = &dist[(size_t)y * nx + x0];
+	       blocked_lines(lines, base, slice, nz, nb, limit);
+	  }
+     }
+}
+
+// out is set where dist <= limit, or dist > limit if above is true.
+static void threshold(const std::vector<unsigned> & dist, const unsigned size[3], unsigned limit, bool above, BitMask & out)
+{
+     bm_allocate(out, size);
+     const long n_rows = (long)size[1] * size[2];
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  const unsigned * d = &dist[r * size[0]];
+	  uint64_t * o = &out.bits[r * out.n_words];
+	  for (unsigned x = 0; x < size[0]; x ++) {
+	       bool set = above? d[x] > limit : d[x] <= limit;
+	       o[x >> 6] |= (uint64_t)set << (x & 63);
+	  }
+     }
+}
+
+void edt_dilate(const BitMask & in, BitMask & out, unsigned radius)
+{
+     std::vector<unsigned> dist;
+     edt_squared(in, false, dist, radius * (radius + 1));
+     threshold(dist, in.size, radius * (radius + 1), false, out);
+}
+
+void edt_erode(const BitMask & in, BitMask & out, unsigned radius, bool border_foreground)
+{
+     if (border_foreground) {
+	  std::vector<unsigned> dist;
+	  edt_squared(in, true, dist, radius * (radius + 1));
+	  threshold(dist, in.size, radius * (radius + 1), true, out);
+     }
+     else {
+	  // one voxel of background around the volume.
+	  BitMask padded, eroded;
+	  bm_pad(in, padded, 1);
+	  edt_erode(padded, eroded, radius, true);
+	  bm_crop(eroded, out, 1);
+     }
+}
+
+void edt_closing(const BitMask & in, BitMask & out, unsigned radius)
+{
+     // safe border, as bm_closing.
+     BitMask padded, dilated;
+     bm_pad(in, padded, radius);
+     edt_dilate(padded, dilated, radius);
+     edt_erode(dilated, padded, radius, true);
+     dilated.bits.clear();
+     bm_crop(padded, out, radius);
+
+     const long n = out.bits.size();
+#pragma omp parallel for
+     for (long i = 0; i < n; i ++) {
+	  out.bits[i] |= in.bits[i];
+     }
+}
+
+void edt_opening(const BitMask & in, BitMask & out, unsigned radius)
+{
+     BitMask eroded;
+     edt_erode(in, eroded, radius, true);
+     edt_dilate(eroded, out, radius);
+}
@@ -0,0 +1,28 @@
+#ifndef __EDT_H__
+#define __EDT_H__
+
+#include <vector>
+#include "bitmask.h"
+
+// distance of voxels with no site in the volume.
+#define EDT_INF 0xffffffffu
+
+// Exact squared Euclidean distance transform in voxel units, by the separable
+// lower envelope algorithm of Felzenszwalb and Huttenlocher. dist[i] is the
+// squared distance of voxel i to the nearest voxel set in mask (or not set,
+// if complement is true). Distances greater than limit, and the distance of
+// all voxels if there is no site, are EDT_INF. A small limit skips the sites
+// that are too far to matter. Linear in the number of voxels, and the lines of
+// each pass are computed in parallel.
+void edt_squared(const BitMask & mask, bool complement, std::vector<unsigned> & dist, unsigned limit = EDT_INF);
+
+// Morphology by thresholding the distance map: a voxel is within the ball of
+// radius r of a site iff its squared distance is at most r * (r + 1). The
+// outputs are the same as bm_dilate, bm_erode, bm_closing and bm_opening, but
+// the time does not depend on the radius.
+void edt_dilate(const BitMask & in, BitMask & out, unsigned radius);
+void edt_erode(const BitMask & in, BitMask & out, unsigned radius, bool border_foreground);
+void edt_closing(const BitMask & in, BitMask & out, unsigned radius);
+void edt_opening(const BitMask & in, BitMask & out, unsigned radius);
+
+#endif
@@ -1,56 +1,56 @@
 #include <common.h>
 #include <utility.h>
-#include <itkImageToListSampleFilter.h>
-#include "itkMeanSampleFilter.h"
-#include "itkCovarianceSampleFilter.h"
-#include "itkGaussianMembershipFunction.h"
-#include "itkSigmoidImageFilter.h"
-#include <itkRescaleIntensityImageFilter.h>
+#include "result_cache.h"
+#include "rle_mask.h"
+#include "stages.h"
 
 namespace po = boost::program_options;
 int main(int argc, char* argv[])
 {
-     std::string in_file, seed_file, out_file, bodymask_file;
-     unsigned shortverbose = 0;
-     float sigma = 0.01;
-     // float alpha = 0, beta = 1;
+     std::string in_file, bodymask_file, roi_mode;
+     unsigned margin = 0;
+     std::vector<std::string> seed_files, out_files;
+     std::vector<float> stds;
      unsigned short verbose = 0;
-     float stop_time = 100, std = 120;
+     double alpha = 0;
 
      po::options_description mydesc("Fast marching segmentation.");
      mydesc.add_options()
 	  ("help,h", "Given the seed regions defined by a mask, output the probabilistic density map of the the full volume.")
-	  ("int,i", po::value<std::string>(&in_file)->default_value("input.nii.gz"), 
+	  ("int,i", po::value<std::string>(&in_file)->default_value("input.nii.gz"),
 	   "Input intensity image.")
 
-	  ("seed,e", po::value<std::string>(&seed_file)->default_value("seed.nii.gz"), 
-	   "A mask file for the seed region.")
+	  ("seed,e", po::value<std::vector<std::string> >(&seed_files)->multitoken()->default_value(std::vector<std::string>(1, "seed.nii.gz"), "seed.nii.gz"),
+	   "Mask file(s) for the seed region(s). Each seed region defines one class, and one output density map.")
 
-	   ("bodymask,m", po::value<std::string>(&bodymask_file)->default_value("mask.nii.gz"), 
+	   ("bodymask,m", po::value<std::string>(&bodymask_file)->default_value("mask.nii.gz"),
 	    "Body mask file.")
 
-	  ("output,o", po::value<std::string>(&out_file)->default_value("output.nii.gz"), 
-	   "Output binary volumge.")
+	  ("output,o", po::value<std::vector<std::string> >(&out_files)->multitoken()->default_value(std::vector<std::string>(1, "output.nii.gz"), "output.nii.gz"),
+	   "Output density map(s), one for each seed region.")
 
-	  ("std,", po::value<float>(&std)->default_value(120), 
-	   "Manual given standard deviation of the Gaussian distribtuion.")
+	  ("std,", po::value<std::vector<float> >(&stds)->multitoken()->default_value(std::vector<float>(1, 120), "120"),
+	   "Manual given standard deviation of the Gaussian distribtuion. One value for all seed regions, or one value for each.")
 
-	  // ("alpha,", po::value<float>(&alpha)->default_value(0), 
-	  //  "Alpha of sigmoid function. Small value generate steep sigmoid function.")
+	  ("alpha,a", po::value<double>(&alpha),
+	   "If given, output the regularized speed map alpha + (1-alpha) * density instead of the density, same as reg_speed.")
 
-	  // ("beta,", po::value<float>(&beta)->default_value(1), 
-	  //  "beta of sigmoid function, indicating the center of the range.")
+	  ("roi", po::value<std::string>(&roi_mode)->default_value("full"),
+	   "full: compute the outputs on the full volume. auto: compute them on the bounding box of the body mask grown by the margin, and write the value outside the mask elsewhere.")
 
-	  ("verbose,v", po::value<unsigned short>(&verbose)->default_value(0), 
+	  ("margin", po::value<unsigned>(&margin)->default_value(0),
+	   "Margin of the ROI in voxels, with --roi auto.")
+
+	  ("verbose,v", po::value<unsigned short>(&verbose)->default_value(0),
 	   "verbose level. 0 for minimal output. 3 for most output.");
 
-     po::variables_map vm;        
+     po::variables_map vm;
      po::store(po::parse_command_line(argc, argv, mydesc), vm);
-     po::notify(vm);    
+     po::notify(vm);
 
      try {
 	  if ( (vm.count("help")) | (argc == 1) ) {
-	       std::cout << "Usage: closing_filter [options]\n";
+	       std::cout << "Usage: est_density [options]\n";
 	       std::cout << mydesc << "\n";
 	       return 0;
 	  }
@@ -58,7 +58,30 @@ int main(int argc, char* argv[])
      catch(std::exception& e) {
 	  std::cout << e.what() << "\n";
 	  return 1;
-     }    
+     }
+
+     // reuse the outputs of an earlier run with the same inputs and options.
+     const char * cache_inputs[] = {"int", "seed", "bodymask"};
+     const char * cache_outputs[] = {"output"};
+     ResultCache rc;
+     // the volumes saved for debugging.
+     std::vector<std::string> debug_files;
+     if (verbose >= 1) {
+	  debug_files.push_back("density.nii.gz");
+     }
+     if (result_cache_restore(rc, "est_density", vm, std::vector<std::string>(cache_inputs, cache_inputs + 3), std::vector<std::string>(cache_outputs, cache_outputs + 1), debug_files, verbose)) {
+	  return 0;
+     }
+
+     if (seed_files.size() != out_files.size()) {
+	  std::cout << "Number of seed files and output files must be same.\n";
+	  return 1;
+     }
+     if (stds.size() != 1 && stds.size() != seed_files.size()) {
+	  std::cout << "std must have one value, or one value for each seed file.\n";
+	  return 1;
+     }
+     bool speed_map = vm.count("alpha");
 
      // read in original intensity file
      ReaderType3F::Pointer inReader = ReaderType3F::New();
@@ -66,82 +89,28 @@ int main(int argc, char* argv[])
      inReader->Update();
      ImageType3F::Pointer inPtr = inReader->GetOutput();
 
-     // read in body mask file.
-     ReaderType3UC::Pointer maskReader = ReaderType3UC::New();
-     maskReader->SetFileName(bodymask_file);
-     maskReader->Update();
-     ImageType3UC::Pointer maskPtr = maskReader->GetOutput();
-
-     // read in seed mask file.
-     ReaderType3UC::Pointer seedReader = ReaderType3UC::New();
-     seedReader->SetFileName(seed_file);
-     seedReader->Update();
-     ImageType3UC::Pointer seedPtr = seedReader->GetOutput();
-
-
-     // convert voxels in the seed regions to samples.
-     typedef itk::Statistics::ImageToListSampleFilter<ImageType3F, ImageType3UC> SampleFilterType;
-     SampleFilterType::Pointer sample_filter = SampleFilterType::New();
-     sample_filter->SetInput(inPtr);
-     sample_filter->SetMaskImage(seedPtr);
-     sample_filter->SetMaskValue(1);
-     typedef SampleFilterType::ListSampleType SampleType;
-     typedef SampleFilterType::MeasurementVectorType  MeasurementVectorType;
-
-     typedef itk::Statistics::MeanSampleFilter< SampleType > MeanAlgorithmType;
-     MeanAlgorithmType::Pointer meanAlgorithm = MeanAlgorithmType::New();
-     meanAlgorithm->SetInput( sample_filter->GetOutput() );
-     meanAlgorithm->Update();
-
-     typedef itk::Statistics::CovarianceSampleFilter< SampleType > CovarianceAlgorithmType;
-     CovarianceAlgorithmType::Pointer covarianceAlgorithm =
-	  CovarianceAlgorithmType::New();
-     covarianceAlgorithm->SetInput( sample_filter->GetOutput() );
-     covarianceAlgorithm->Update();
-
-     if (verbose >=1 ) {
-     printf("Seed region mean: %.2f, variance: %.2f.\n", meanAlgorithm->GetMean()[0], covarianceAlgorithm->GetCovarianceMatrix()[0][0]);
-     }
-
-     // compute the density map, i.e. P(x), where x is pixel value, and P is
-     // Gaussian pdf.
-     typedef itk::Statistics::GaussianMembershipFunction< MeasurementVectorType >
-DensityFunctionType;
-     DensityFunctionType::Pointer densityFunction = DensityFunctionType::New();
-     densityFunction->SetMean(meanAlgorithm->GetMean());
-     // densityFunction->SetCovariance(covarianceAlgorithm->GetCovarianceMatrix());
-     CovarianceAlgorithmType::MatrixType covariance = covarianceAlgorithm->GetCovarianceMatrix();
-     covariance[0][0] = std * std;
-     densityFunction->SetCovariance(covariance);
-     
-     // make a density volume.
-     ImageType3F::Pointer densityPtr = ImageType3F::New();
-     densityPtr->SetRegions(inPtr->GetLargestPossibleRegion());
-     densityPtr->Allocate();
-     densityPtr->FillBuffer( 0 );
-     densityPtr->SetOrigin(inPtr->GetOrigin());
-     densityPtr->SetSpacing(inPtr->GetSpacing());
-     densityPtr->SetDirection(inPtr->GetDirection());
-     IteratorType3F densityIt(densityPtr, densityPtr->GetLargestPossibleRegion());
-     
-     IteratorType3F inIt(inPtr, inPtr->GetLargestPossibleRegion());
-     IteratorType3UC maskIt(maskPtr, maskPtr->GetLargestPossibleRegion());
-     for (inIt.GoToBegin(), maskIt.GoToBegin(), densityIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ inIt, ++ densityIt) {
-	  if (maskIt.Get() > 0) {
-	       densityIt.Set(densityFunction->Evaluate(inIt.Get()));
-	  }
-     }	       
+     // read in body mask file. Only the runs of the mask are visited.
+     RLEMask mask;
+     rle_read(bodymask_file, mask);
 
-     if (verbose >= 1) {
-	  save_volume(densityPtr, "density.nii.gz");
+     std::vector<ImageType3UC::Pointer> seeds(seed_files.size());
+     for (unsigned c = 0; c < seed_files.size(); c ++) {
+	  ReaderType3UC::Pointer seedReader = ReaderType3UC::New();
+	  seedReader->SetFileName(seed_files[c]);
+	  seedReader->Update();
+	  seeds[c] = seedReader->GetOutput();
      }
 
-     typedef itk::RescaleIntensityImageFilter< ImageType3F, ImageType3F > RescaleFilterType;
-     RescaleFilterType::Pointer rescaleFilter = RescaleFilterType::New();
-     rescaleFilter->SetInput(densityPtr);
-     rescaleFilter->SetOutputMinimum(0);
-     rescaleFilter->SetOutputMaximum(1);
-
-     save_volume(rescaleFilter->GetOutput(), out_file);
+     std::vector<ImageType3F::Pointer> outs;
+     if (density_map(inPtr, seeds, stds, mask, roi_mode, margin, speed_map, alpha, outs, verbose)) {
+	  return 1;
+     }
+     for (unsigned c = 0; c < outs.size(); c ++) {
+	  save_volume(outs[c], out_files[c]);
+     }
+     if (save_volume_flush() > 0) {
+	  return 1;
+     }
+     result_cache_store(rc, verbose);
+     return 0;
 }
-
@@ -1,11 +1,64 @@
 #include <common.h>
 #include <utility.h>
 #include <itkExtractImageFilter.h>
+#include <fstream>
+#include <sstream>
+#include "mapped_volume.h"
+
+// extract the region at start of the given size, and save it as a 2D image.
+// A size of 1 is the collapsed dimension, and -1 is up to the end of the
+// volume.
+static int extract(ImageType3F::Pointer inPtr, const unsigned start[3], const int size[3], const std::string & out_file)
+{
+     ImageType3F::IndexType desiredStart;
+     ImageType3F::SizeType desiredSize = inPtr->GetLargestPossibleRegion().GetSize();
+     for (unsigned d = 0; d < 3; d ++) {
+	  desiredStart[d] = start[d];
+	  if (size[d] == 1) {
+	       desiredSize[d] = 0;
+	  }
+	  else if (size[d] == -1) {
+	       desiredSize[d] = desiredSize[d] > start[d]? desiredSize[d] - start[d] : 0;
+	  }
+	  else {
+	       desiredSize[d] = size[d];
+	  }
+     }
+
+     typedef itk::ExtractImageFilter< ImageType3F, ImageType2DF > FilterType;
+
+     FilterType::Pointer filter = FilterType::New();
+     ImageType3F::RegionType desiredRegion(desiredStart, desiredSize);
+
+     filter->SetExtractionRegion(desiredRegion);
+     filter->SetInput(inPtr);
+     filter->SetDirectionCollapseToIdentity(); // This is required.
+     // filter->SetDirectionCollapseToSubmatrix();
+
+
+     WriterType2DF::Pointer writer = WriterType2DF::New();
+	  
+     writer->SetInput(filter->GetOutput());
+     writer->SetFileName(out_file);
+     try 
+     { 
+	  writer->Update(); 
+     } 
+     catch( itk::ExceptionObject & err ) 
+     { 
+	  std::cerr << "ExceptionObject caught !" << std::endl; 
+	  std::cerr << err << std::endl; 
+	  return EXIT_FAILURE;
+     } 
+
+     std::cout << "save_volume(): File " << out_file << " saved.\n";
+     return 0;
+}
 
 namespace po = boost::program_options;
 int main(int argc, char* argv[])
 {
-     std::string in_file, out_file;
+     std::string in_file, out_file, batch_file;
      unsigned xstart = 0, ystart = 0, zstart = 0;
      int xsize = 0, ysize = 0, zsize = 0;
      unsigned short verbose = 0;
@@ -27,6 +80,9 @@ int main(int argc, char* argv[])
 	  ("zs", po::value<unsigned>(&zstart)->default_value(0), "z start index.")
 	  ("zm", po::value<int>(&zsize)->default_value(-1), "z size.")
 
+	  ("batch,b", po::value<std::string>(&batch_file),
+	   "file with one ROI per line: xs xm ys ym zs zm output. All ROIs are extracted from one read of the input, and the ROI options are ignored.")
+
 	  ("verbose,v", po::value<unsigned short>(&verbose)->default_value(0), 
 	   "verbose level. 0 for minimal output. 3 for most output.");
 
@@ -47,78 +103,47 @@ int main(int argc, char* argv[])
      }    
 
 
-     // read input file.
+     // .brick inputs are streamed: each extraction requests its region from
+     // the reader, which inflates only the chunks of that region. Uncompressed
+     // .nii/.mha inputs are mapped, so only the pages of the extracted slabs
+     // are read from disk. Other inputs are read once in full.
      ReaderType3F::Pointer inReader = ReaderType3F::New();
-     inReader->SetFileName(in_file);
-     inReader->Update();
-     ImageType3F::Pointer inPtr = inReader->GetOutput();
-
-     ImageType3F::IndexType desiredStart;
-     ImageType3F::SizeType desiredSize = inPtr->GetLargestPossibleRegion().GetSize();
-     desiredStart[0] = xstart;
-     desiredStart[1] = ystart;
-     desiredStart[2] = zstart;
-
-     if (xsize == 1) {
-	  desiredSize[0] = 0;
-     }
-     else if (xsize == -1) {
+     ImageType3F::Pointer inPtr;
+     if (in_file.size() > 6 && in_file.compare(in_file.size() - 6, 6, ".brick") == 0) {
+	  inReader->SetFileName(in_file);
+	  inReader->UpdateOutputInformation();
+	  inPtr = inReader->GetOutput();
      }
      else {
-	  desiredSize[0] = xsize;
+	  inPtr = read_volume_mapped<ImageType3F>(in_file, verbose);
      }
 
-     if (ysize == 1) {
-	  desiredSize[1] = 0;
-     }
-     else if (ysize == -1) {
-     }
-     else {
-	  desiredSize[1] = ysize;
+     if (batch_file.empty()) {
+	  const unsigned start[3] = {xstart, ystart, zstart};
+	  const int size[3] = {xsize, ysize, zsize};
+	  return extract(inPtr, start, size, out_file);
      }
 
-
-     if (zsize == 1) {
-	  desiredSize[2] = 0;
-     }
-     else if (zsize == -1) {
+     // one ROI per line: xs xm ys ym zs zm output, same as the options.
+     std::ifstream batch(batch_file.c_str());
+     if (!batch) {
+	  std::cerr << "extract_roi(): cannot open " << batch_file << "\n";
+	  return EXIT_FAILURE;
      }
-     else {
-	  desiredSize[2] = zsize;
+     std::string line;
+     unsigned n_failed = 0;
+     while (std::getline(batch, line)) {
+	  if (line.empty() || line[0] == '#') continue;
+	  std::istringstream fields(line);
+	  unsigned start[3];
+	  int size[3];
+	  std::string file;
+	  if (!(fields >> start[0] >> size[0] >> start[1] >> size[1] >> start[2] >> size[2] >> file)) {
+	       std::cerr << "extract_roi(): bad line in " << batch_file << ": " << line << "\n";
+	       n_failed ++;
+	       continue;
+	  }
+	  if (extract(inPtr, start, size, file)) n_failed ++;
      }
-
-     typedef itk::ExtractImageFilter< ImageType3F, ImageType2DF > FilterType;
-
-     FilterType::Pointer filter = FilterType::New();
-     ImageType3F::RegionType desiredRegion(desiredStart, desiredSize);
-     desiredRegion.GetImageDimension();
-
-     filter->SetExtractionRegion(desiredRegion);
-     filter->SetInput(inPtr);
-     filter->SetDirectionCollapseToIdentity(); // This is required.
-     // filter->SetDirectionCollapseToSubmatrix();
-
-
-     WriterType2DF::Pointer writer = WriterType2DF::New();
-	  
-     writer->SetInput(filter->GetOutput());
-     writer->SetFileName(out_file);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << out_file << " saved.\n";
-
-     return 0;
+     return n_failed > 0? EXIT_FAILURE : 0;
 }
-
-
-
-
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include "fillhole.h"
+
+static const uint64_t ALL_ONES = ~(uint64_t)0;
+
+// background run [x0, x1) of row r = z * ny + y.
+struct Span
+{
+     unsigned x0;
+     unsigned x1;
+     long r;
+};
+
+// the mask, the reached background and the neighbor rows of a row. A
+// neighbor row at (dy, dz) is scanned over the x range of the run grown by
+// ext, 1 for diagonal neighbors and 0 otherwise.
+struct Flood
+{
+     const BitMask & mask;
+     std::vector<uint64_t> & outside;
+     int dy[8];
+     int dz[8];
+     unsigned n_nbrs;
+     unsigned ext;
+
+     Flood(const BitMask & m, std::vector<uint64_t> & o) : mask(m), outside(o), n_nbrs(0), ext(0) {};
+     void add(int y, int z) {
+	  dy[n_nbrs] = y;
+	  dz[n_nbrs] = z;
+	  n_nbrs ++;
+     }
+};
+
+// other threads may set bits of the same words.
+static inline uint64_t load(const uint64_t * p)
+{
+     return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+// first foreground voxel at or after x, or nx.
+static unsigned next_foreground(const uint64_t * fg, unsigned nx, unsigned x)
+{
+     const unsigned W = (nx + 63) >> 6;
+     unsigned i = x >> 6;
+     uint64_t w = fg[i] & (ALL_ONES << (x & 63));
+     while (w == 0) {
+	  if (++ i == W) return nx;
+	  w = fg[i];
+     }
+     return std::min(nx, (i << 6) + __builtin_ctzll(w));
+}
+
+// first voxel of the background run that contains x.
+static unsigned run_start(const uint64_t * fg, unsigned x)
+{
+     unsigned i = x >> 6;
+     uint64_t w = (x & 63)? fg[i] & (ALL_ONES >> (64 - (x & 63))) : 0;
+     while (w == 0) {
+	  if (i == 0) return 0;
+	  w = fg[-- i];
+     }
+     return (i << 6) + 64 - __builtin_clzll(w);
+}
+
+// first background voxel in [x, end) not reached yet, or end.
+static unsigned next_free(const uint64_t * fg, const uint64_t * out, unsigned x, unsigned end)
+{
+     if (x >= end) return end;
+     const unsigned last = (end - 1) >> 6;
+     unsigned i = x >> 6;
+     uint64_t w = ~(fg[i] | load(&out[i])) & (ALL_ONES << (x & 63));
+     while (w == 0) {
+	  if (++ i > last) return end;
+	  w = ~(fg[i] | load(&out[i]));
+     }
+     return std::min(end, (i << 6) + __builtin_ctzll(w));
+}
+
+// mark the run [x0, x1) as reached. Runs are always reached as a whole, so
+// the first bit decides which caller reached it first. Returns true for
+// that caller.
+static bool claim(uint64_t * out, unsigned x0, unsigned x1)
+{
+     const uint64_t bit = (uint64_t)1 << (x0 & 63);
+     if (__atomic_fetch_or(&out[x0 >> 6], bit, __ATOMIC_RELAXED) & bit) return false;
+     const unsigned i0 = x0 >> 6, i1 = (x1 - 1) >> 6;
+     for (unsigned i = i0; i <= i1; i ++) {
+	  uint64_t m = ALL_ONES;
+	  if (i == i0) m &= ALL_ONES << (x0 & 63);
+	  if (i == i1) m &= ALL_ONES >> (63 - ((x1 - 1) & 63));
+	  __atomic_fetch_or(&out[i], m, __ATOMIC_RELAXED);
+     }
+     return true;
+}
+
+// reach all new background runs of row r that overlap [x0, x1).
+static void reach_runs(const Flood & f, long r, unsigned x0, unsigned x1, std::vector<Span> & stack)
+{
+     const unsigned nx = f.mask.size[0];
+     const uint64_t * fg = &f.mask.bits[r * f.mask.n_words];
+     uint64_t * out = &f.outside[r * f.mask.n_words];
+     unsigned x = x0;
+     while ((x = next_free(fg, out, x, x1)) < x1) {
+	  Span s = {run_start(fg, x), next_foreground(fg, nx, x), r};
+	  if (claim(out, s.x0, s.x1)) stack.push_back(s);
+	  x = s.x1;
+     }
+}
+
+// reach the background runs touching a reached run in the neighbor rows.
+static void expand(const Flood & f, const Span & s, std::vector<Span> & stack)
+{
+     const unsigned nx = f.mask.size[0], ny = f.mask.size[1], nz = f.mask.size[2];
+     const int y = s.r % ny, z = s.r / ny;
+     const unsigned x0 = s.x0 > f.ext? s.x0 - f.ext : 0, x1 = std::min(nx, s.x1 + f.ext);
+     for (unsigned k = 0; k < f.n_nbrs; k ++) {
+	  int ny_ = y + f.dy[k], nz_ = z + f.dz[k];
+	  if (ny_ < 0 || ny_ >= (int)ny || nz_ < 0 || nz_ >= (int)nz) continue;
+	  reach_runs(f, (long)nz_ * ny + ny_, x0, x1, stack);
+     }
+}
+
+// seeds of row r: all of its background runs if it is a border row,
+// otherwise the runs at both ends of the row.
+static void seed_row(const Flood & f, long r, bool border_row, std::vector<Span> & stack)
+{
+     const unsigned nx = f.mask.size[0];
+     if (border_row) {
+	  reach_runs(f, r, 0, nx, stack);
+     }
+     else {
+	  reach_runs(f, r, 0, 1, stack);
+	  reach_runs(f, r, nx - 1, nx, stack);
+     }
+}
+
+// everything not reached is foreground.
+static void fill_unreached(BitMask & mask, const std::vector<uint64_t> & outside)
+{
+     const unsigned nx = mask.size[0], W = mask.n_words;
+     const long n_rows = (long)mask.size[1] * mask.size[2];
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  uint64_t * row = &mask.bits[r * W];
+	  const uint64_t * out = &outside[r * W];
+	  for (unsigned i = 0; i < W; i ++) row[i] = ~out[i];
+	  if (nx & 63) row[W - 1] &= ((uint64_t)1 << (nx & 63)) - 1;
+     }
+}
+
+void bm_fill_holes_2d(BitMask & mask, bool fully_connected)
+{
+     const unsigned ny = mask.size[1];
+     const int nz = mask.size[2];
+     std::vector<uint64_t> outside(mask.bits.size(), 0);
+     Flood f(mask, outside);
+     f.add(-1, 0);
+     f.add(1, 0);
+     f.ext = fully_connected? 1 : 0;
+
+#pragma omp parallel
+     {
+	  std::vector<Span> stack;
+#pragma omp for schedule(dynamic)
+	  for (int z = 0; z < nz; z ++) {
+	       for (unsigned y = 0; y < ny; y ++) {
+		    seed_row(f, (long)z * ny + y, y == 0 || y + 1 == ny, stack);
+	       }
+	       while (!stack.empty()) {
+		    Span s = stack.back();
+		    stack.pop_back();
+		    expand(f, s, stack);
+	       }
+	  }
+     }
+     fill_unreached(mask, outside);
+}
+
+// runs a thread expands on its own before the rest goes to the next front.
+#define LOCAL_BUDGET 4096
+
+void bm_fill_holes_3d(BitMask & mask, bool fully_connected)
+{
+     const unsigned ny = mask.size[1], nz = mask.size[2];
+     const long n_rows = (long)ny * nz;
+     std::vector<uint64_t> outside(mask.bits.size(), 0);
+     Flood f(mask, outside);
+     for (int dz = -1; dz <= 1; dz ++) {
+	  for (int dy = -1; dy <= 1; dy ++) {
+	       if ((dy == 0 && dz == 0) || (!fully_connected && dy != 0 && dz != 0)) continue;
+	       f.add(dy, dz);
+	  }
+     }
+     f.ext = fully_connected? 1 : 0;
+
+     // the front starts from the border. Each thread expands its share of the
+     // front depth first for a while, so fronts are few even when the
+     // background is a long thin path.
+     std::vector<Span> front;
+#pragma omp parallel
+     {
+	  std::vector<Span> stack;
+#pragma omp for schedule(dynamic, 64)
+	  for (long r = 0; r < n_rows; r ++) {
+	       unsigned y = r % ny, z = r / ny;
+	       seed_row(f, r, y == 0 || y + 1 == ny || z == 0 || z + 1 == nz, stack);
+	  }
+#pragma omp critical
+	  front.insert(front.end(), stack.begin(), stack.end());
+     }
+
+     while (!front.empty()) {
+	  std::vector<Span> next;
+#pragma omp parallel
+	  {
+	       std::vector<Span> stack;
+	       unsigned budget = LOCAL_BUDGET;
+#pragma omp for schedule(dynamic, 16)
+	       for (long i = 0; i < (long)front.size(); i ++) {
+		    expand(f, front[i], stack);
+		    while (!stack.empty() && budget > 0) {
+			 Span s = stack.back();
+			 stack.pop_back();
+			 expand(f, s, stack);
+			 budget --;
+		    }
+	       }
+#pragma omp critical
+	       next.insert(next.end(), stack.begin(), stack.end());
+	  }
+	  front.swap(next);
+     }
+     fill_unreached(mask, outside);
+}
@@ -0,0 +1,24 @@
+#ifndef __FILLHOLE_H__
+#define __FILLHOLE_H__
+
+#include "bitmask.h"
+
+// Hole filling as ITK's BinaryFillholeImageFilter: background voxels not
+// connected to the border of the image through background become foreground.
+// Background is connected through faces, or also through edges and corners if
+// fully_connected is set, same as FullyConnected of the ITK filter.
+//
+// The background is flood filled from the border by scanlines: a background
+// run of a row is reached as a whole, and the runs it touches in the neighbor
+// rows are pushed, so the work is per run, not per voxel. The reached runs are
+// marked in a bit-packed mask with the same layout as the input.
+
+// fill the holes of each z slice, same as BinaryFillholeImageFilter run
+// through SliceBySliceImageFilter. The slices are filled in parallel.
+void bm_fill_holes_2d(BitMask & mask, bool fully_connected = false);
+
+// fill the holes of the volume. The runs of each front of the flood fill are
+// expanded in parallel, and claimed with atomic bit operations.
+void bm_fill_holes_3d(BitMask & mask, bool fully_connected = false);
+
+#endif
@@ -1,15 +1,15 @@
 #include <common.h>
 #include <utility.h>
-#include <itkBinaryFillholeImageFilter.h>
 #include "itkSubtractImageFilter.h"
-#include <itkSliceBySliceImageFilter.h>
+#include "bitmask.h"
+#include "fillhole.h"
 
 namespace po = boost::program_options;
 int main(int argc, char* argv[])
 {
      std::string in_file, out_file, diff_file;
      unsigned short foreground = 1, verbose = 0;
-     bool diff = false;
+     bool diff = false, volume = false, fully_connected = false;
 
      po::options_description mydesc("Options can only used at commandline");
      mydesc.add_options()
@@ -19,7 +19,11 @@ int main(int argc, char* argv[])
 	   ("output,o", po::value<std::string>(&out_file)->default_value("output.nii.gz"), 
 	    "Output binary volumge.")
 	  ("foreground,f", po::value<unsigned short>(&foreground)->default_value(1), 
-	   "Radius of the structure elment.")
+	   "Foreground value. Other values are background.")
+	  ("volume", po::bool_switch(&volume),
+	   "Fill the holes of the 3D volume. By default the holes of each z slice are filled.")
+	  ("full,c", po::bool_switch(&fully_connected),
+	   "Background is also connected through edges and corners (8 neighbors in 2D, 26 in 3D). By default only through faces.")
 	  ("diff,d", po::bool_switch(&diff),
 	   "Whether print the different of the intput and output images.")       
 	   ("diffout,t", po::value<std::string>(&diff_file)->default_value("diff.nii.gz"), 
@@ -50,27 +54,29 @@ int main(int argc, char* argv[])
      inReader->Update();
      ImageType3UC::Pointer inPtr = inReader->GetOutput();
 
-     typedef itk::BinaryFillholeImageFilter <ImageType2UC>  FilterType;
-     FilterType::Pointer myFilter = FilterType::New();
-     // myFilter->SetInput(inReader->GetOutput());
-     myFilter->SetForegroundValue(foreground);
+     // same output values as BinaryFillholeImageFilter: foreground for the
+     // foreground and the holes, and 0 for others (or 255 if the foreground
+     // is 0).
+     BitMask mask;
+     bm_from_image(inPtr, mask, foreground);
+     if (volume) bm_fill_holes_3d(mask, fully_connected);
+     else bm_fill_holes_2d(mask, fully_connected);
 
-     // the binaryfillhole filter has a bug and does not work for 3d volume. It
-     // only works on 2d slice, so we use a slciebyslice filter to apply the
-     // fillhole filter slice by slcie.
-     typedef itk::SliceBySliceImageFilter<ImageType3UC, ImageType3UC> SBSFilter;
-     SBSFilter::Pointer sbs_filter = SBSFilter::New();
-     sbs_filter->SetInput( inReader->GetOutput() );
-     sbs_filter->SetFilter( myFilter );
-
-     save_volume(sbs_filter->GetOutput(), out_file);
+     ImageType3UC::Pointer outPtr = ImageType3UC::New();
+     outPtr->SetRegions(inPtr->GetLargestPossibleRegion());
+     outPtr->Allocate();
+     outPtr->SetOrigin(inPtr->GetOrigin());
+     outPtr->SetSpacing(inPtr->GetSpacing());
+     outPtr->SetDirection(inPtr->GetDirection());
+     bm_to_image(mask, outPtr, foreground, foreground == 0? 255 : 0);
+     save_volume(outPtr, out_file);
 
      // print
      if (diff) {
 	  typedef itk::SubtractImageFilter<ImageType3UC> SubtractType;
 	  SubtractType::Pointer diff = SubtractType::New();
 	  diff->SetInput1(inPtr);
-	  diff->SetInput2(sbs_filter->GetOutput());
+	  diff->SetInput2(outPtr);
 	  save_volume(diff->GetOutput(), diff_file);
      }
 
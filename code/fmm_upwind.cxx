@@ -1,18 +1,13 @@
 #include <common.h>
 #include <utility.h>
-#include "itkFastMarchingImageToNodePairContainerAdaptor.h"
-#include "itkFastMarchingThresholdStoppingCriterion.h"
-#include <itkFastMarchingUpwindGradientImageFilterBase.h>
-
-typedef itk::FastMarchingUpwindGradientImageFilterBase< ImageType3F, ImageType3F > FastMarchingFilterType;
-typedef itk::FastMarchingImageToNodePairContainerAdaptor< ImageType3F, ImageType3F, ImageType3UC > AdaptorType;
-typedef FastMarchingFilterType::GradientImageType  FloatGradientImage;
-typedef FloatGradientImage::PixelType   GradientPixelType;
+#include "result_cache.h"
+#include "stages.h"
 
 namespace po = boost::program_options;
 int main(int argc, char* argv[])
 {
-     std::string speed_file, seed_file, out_file, mask_file, trial_file;
+     std::string speed_file, seed_file, out_file, mask_file, trial_file, roi_mode;
+     unsigned margin = 1;
      float sigma = 0.01;
      float sigmoid_alpha = -5, sigmoid_beta = 50;
      unsigned short verbose = 0;
@@ -37,6 +32,11 @@ int main(int argc, char* argv[])
 	  ("output,o", po::value<std::string>(&out_file)->default_value("output.nii.gz"), 
 	   "Output time map.")
 
+	  ("roi", po::value<std::string>(&roi_mode)->default_value("full"),
+	   "full: march on the full volume. auto: march on the bounding box of the mask grown by the margin. The time map is 0 outside it, same as other voxels outside the mask.")
+	  ("margin", po::value<unsigned>(&margin)->default_value(1),
+	   "Margin of the ROI in voxels, with --roi auto.")
+
 	  // ("trial,r", po::value<std::string>(&trial_file)->default_value("trial.nii.gz"), 
 	  //  "Binary file containing the trail points, i.e. the front end points which will be used for voting")
 
@@ -59,12 +59,25 @@ int main(int argc, char* argv[])
 	  return 1;
      }    
 
+     // reuse the outputs of an earlier run with the same inputs and options.
+     const char * cache_inputs[] = {"speed", "seed", "mask"};
+     const char * cache_outputs[] = {"output"};
+     ResultCache rc;
+     // the volumes saved for debugging.
+     std::vector<std::string> debug_files;
+     if (verbose >= 1) {
+	  debug_files.push_back("fmm_gradient.mha");
+     }
+     if (result_cache_restore(rc, "fmm_upwind", vm, std::vector<std::string>(cache_inputs, cache_inputs + 3), std::vector<std::string>(cache_outputs, cache_outputs + 1), debug_files, verbose)) {
+	  return 0;
+     }
+
      // read in speed map.
      ReaderType3F::Pointer speedReader = ReaderType3F::New();
      speedReader->SetFileName(speed_file);
      speedReader->Update();
      speedReader->ReleaseDataFlagOn();
-     // ImageType3F::Pointer speedPtr = speedReader->GetOutput();
+     ImageType3F::Pointer speedPtr = speedReader->GetOutput();
 
      // read in mask file.
      ReaderType3UC::Pointer maskReader = ReaderType3UC::New();
@@ -80,76 +93,14 @@ int main(int argc, char* argv[])
      seedReader->ReleaseDataFlagOn();
      ImageType3UC::Pointer seedPtr = seedReader->GetOutput();
 
-     FastMarchingFilterType::Pointer marcher = FastMarchingFilterType::New();
-
-
-     marcher->SetInput( speedReader->GetOutput() );
-
-     AdaptorType::Pointer adaptor = AdaptorType::New();
-     adaptor->SetIsForbiddenImageBinaryMask( true );
-
-     // adaptor->SetAliveImage( AliveImage.GetPointer() );
-     // adaptor->SetAliveValue( 0.0 );
-
-     adaptor->SetTrialImage( seedPtr.GetPointer() );
-     adaptor->SetTrialValue( 1.0 );
-
-     adaptor->SetForbiddenImage( maskPtr.GetPointer() );
-     adaptor->Update();
-
-     marcher->SetForbiddenPoints( adaptor->GetForbiddenPoints() );
-     marcher->SetTrialPoints( adaptor->GetTrialPoints() );
-
-     // stop criterion.
-     typedef  itk::FastMarchingThresholdStoppingCriterion< ImageType3F, ImageType3F > CriterionType;
-     CriterionType::Pointer criterion = CriterionType::New();
-     criterion->SetThreshold(stop_time);
-     marcher->SetStoppingCriterion( criterion );
-
-     // run the marcher.
-     marcher->Update();
-
-     // check the results
-     FloatGradientImage::Pointer gradPtr = marcher->GetGradientImage();
-
-     if (verbose >= 1) {
-	  typedef itk::ImageFileWriter<FloatGradientImage> WriterType;
-	  WriterType::Pointer writer = WriterType::New();
-	  writer->SetInput(gradPtr);
-	  writer->SetFileName("fmm_gradient.mha");
-	  try { 
-	       writer->Update(); 
-	  } 
-	  catch( itk::ExceptionObject & err ) 
-	  { 
-	       std::cerr << "ExceptionObject caught !" << std::endl; 
-	       std::cerr << err << std::endl; 
-	       return EXIT_FAILURE;
-	  } 
-	  std::cout << "save_volume(): File " << "fmm_gradient.mha" << " saved.\n";
+     ImageType3F::Pointer timePtr = fmm_time(speedPtr, seedPtr, maskPtr, stop_time, roi_mode, margin, verbose);
+     if (!timePtr) {
+	  return 1;
      }
-
-     save_volume(marcher->GetOutput(), out_file);
-
-     // now collect trail points.
-     ImageType3UC::Pointer trialPtr = ImageType3UC::New();
-     trialPtr->SetRegions(maskPtr->GetLargestPossibleRegion());
-     trialPtr->SetSpacing(maskPtr->GetSpacing());
-     trialPtr->SetOrigin(maskPtr->GetOrigin());
-     trialPtr->SetDirection(maskPtr->GetDirection());
-     trialPtr->Allocate();
-     trialPtr->FillBuffer(0);  
-     
-     FastMarchingFilterType::NodePairContainerType::Pointer node_pairs = marcher->GetTrialPoints();
-     FastMarchingFilterType::NodePairContainerType::Iterator nodeIt;
-      
-     for(nodeIt = node_pairs->Begin(); nodeIt != node_pairs->End(); nodeIt ++)
-     {
-     	  trialPtr->SetPixel(nodeIt->Value().GetNode(), 1);
+     save_volume(timePtr, out_file);
+     if (save_volume_flush() > 0) {
+	  return 1;
      }
-     
-     // save_volume(trialPtr, trial_file);
+     result_cache_store(rc, verbose);
      return 0;
 }
-
-		       
@@ -1,33 +1,82 @@
 #include <common.h>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
 #include <utility.h>
 #include "itkVector.h"
-#include "itkListSample.h"
 #include "itkGaussianMixtureModelComponent.h"
 #include "itkExpectationMaximizationMixtureModelEstimator.h"
-#include <itkImageToListSampleFilter.h>
-#include "itkSampleClassifierFilter.h"
-#include "itkMaximumDecisionRule.h"
+#include "masked_sample.h"
+#include "gmm_em.h"
+#include "mrf.h"
+#include "roi.h"
 
 namespace po = boost::program_options;
 
 typedef itk::Vector< float, 1 > MeasurementVectorType;
-typedef itk::Statistics::ListSample< MeasurementVectorType > SampleType;
+typedef MaskedImageSample< ImageType3F, MeasurementVectorType > SampleType;
 // define components.
 typedef itk::Statistics::GaussianMixtureModelComponent< SampleType > ComponentType;
 
 // define estimator
 typedef itk::Statistics::ExpectationMaximizationMixtureModelEstimator< SampleType > EstimatorType;
-typedef itk::Statistics::SampleClassifierFilter< SampleType > FilterType;
-typedef itk::Statistics::MaximumDecisionRule  DecisionRuleType;
-typedef FilterType::ClassLabelVectorObjectType               ClassLabelVectorObjectType;
-typedef FilterType::ClassLabelVectorType                     ClassLabelVectorType;
-typedef FilterType::ClassLabelType        ClassLabelType;
+
+int multivariate_gmm(ImageType3F::Pointer inPtr,
+		     const RLEMask & mask,
+		     const VolumeROI & roi,
+		     const std::vector<std::string> & feature_files,
+		     const std::vector<double> & mean_opt,
+		     const std::vector<double> & sigma_opt,
+		     const std::vector<double> & prop_opt,
+		     unsigned n_comp,
+		     unsigned maxit,
+		     unsigned subsample,
+		     std::string seg_file,
+		     std::string savemodel_file,
+		     bool map,
+		     double beta,
+		     unsigned mrfit,
+		     unsigned short verbose);
+
+int classify_with_model(const GMMModel & model,
+			std::string input_file,
+			std::string mask_file,
+			const std::vector<std::string> & feature_files,
+			std::string seg_file,
+			unsigned warmit,
+			unsigned subsample,
+			bool map,
+			double beta,
+			unsigned mrfit,
+			unsigned short verbose);
+
+int model_batch(std::string model_file,
+		std::string batch_file,
+		std::string input_file,
+		std::string mask_file,
+		const std::vector<std::string> & feature_files,
+		std::string seg_file,
+		unsigned warmit,
+		unsigned subsample,
+		bool map,
+		double beta,
+		unsigned mrfit,
+		unsigned short verbose);
+
+int mrf_smooth(const GMMModel & model,
+	       const FeatureSet & fs,
+	       ImageType3U::Pointer labelPtr,
+	       bool map,
+	       double beta,
+	       unsigned mrfit,
+	       unsigned short verbose);
 
 int main( int argc, char* argv[] )
 {
-     std::string input_file, seg_file, mask_file;
-     unsigned n_comp = 5, maxit = 50;
+     std::string input_file, seg_file, mask_file, model_file, savemodel_file, batch_file, roi_mode;
+     unsigned n_comp = 5, maxit = 50, subsample = 1, warmit = 0, mrfit = 10, margin = 1;
+     double beta = 0;
+     bool map = false;
      unsigned short verbose = 0;
      po::options_description mydesc("Because of the need of negative number as arguments, there is no short form of argument in this code.");
      mydesc.add_options()
@@ -43,15 +92,47 @@ int main( int argc, char* argv[] )
 	  ("ncomp", po::value<unsigned >(&n_comp)->default_value(5), 
 	   "Number of components, or classes.")
 
-	  ("mean", po::value<std::vector<double> >()->multitoken(), "Initial mean vector of the GMM. Must be same number of ncomp.")
+	  ("mean", po::value<std::vector<double> >()->multitoken(), "Initial mean vector of the GMM. Must be same number of ncomp. With --feature, can also be ncomp x (number of features + 1), ordered component by component.")
 
-	  ("sigma", po::value<std::vector<double> >()->multitoken(), "Initial standard deviation vector of the GMM, assuming a diagonal cov matrix. Must be same number of ncomp")
+	  ("sigma", po::value<std::vector<double> >()->multitoken(), "Initial standard deviation vector of the GMM, assuming a diagonal cov matrix. Must be same number of ncomp. With --feature, can also be ncomp x (number of features + 1).")
 
 	  ("prop", po::value<std::vector<double> >()->multitoken(), "Initial proportion vector of the GMM, assuming a diagonal cov matrix. Must be same number of ncomp")
 
 	  ("maxit", po::value<unsigned>(&maxit)->default_value(50), 
 	   "Max number of EM iterations.")
 
+	  ("feature", po::value<std::vector<std::string> >()->multitoken(), "Additional feature volumes co-registered with the input, e.g. vesselness, scale map and density. When given, a multivariate GMM with full covariance is estimated on the intensity and these features.")
+
+	  ("subsample", po::value<unsigned>(&subsample)->default_value(1), 
+	   "Multivariate GMM only. Estimate the model on every n-th voxel in the mask, and classify all voxels in the mask.")
+
+	  ("savemodel", po::value<std::string>(&savemodel_file), 
+	   "Save the estimated model parameters to this file.")
+
+	  ("model", po::value<std::string>(&model_file), 
+	   "Classify with the model saved by --savemodel instead of estimating a new one. --mean, --sigma, --prop and --ncomp are ignored.")
+
+	  ("batch", po::value<std::string>(&batch_file), 
+	   "With --model, a text file with one volume per line: input mask seg [features...]. The volumes are classified in parallel in one process.")
+
+	  ("warmit", po::value<unsigned>(&warmit)->default_value(0), 
+	   "With --model, number of EM iterations started from the model for each volume before classification.")
+
+	  ("map", po::bool_switch(&map),
+	   "Label each voxel by the maximum a posteriori component, weighted by the estimated proportions. By default the label is the maximum likelihood component, without the proportions. Also the data term of the MRF smoothing.")
+
+	  ("beta", po::value<double>(&beta)->default_value(0), 
+	   "Weight of the Potts MRF prior for spatial smoothing of the labels. 0 for no smoothing.")
+
+	  ("mrfit", po::value<unsigned>(&mrfit)->default_value(10), 
+	   "Max number of ICM sweeps of the MRF smoothing.")
+
+	  ("roi", po::value<std::string>(&roi_mode)->default_value("full"),
+	   "full: keep the full volumes in memory. auto: keep only the bounding box of the mask grown by the margin. The labels are 0 outside it, same as other voxels outside the mask. Not used with --model.")
+
+	  ("margin", po::value<unsigned>(&margin)->default_value(1),
+	   "Margin of the ROI in voxels, with --roi auto.")
+
 	  ("verbose", po::value<unsigned short>(&verbose)->default_value(0), 
 	   "verbose level. 0 for minimal output. 3 for most output.");
 
@@ -72,14 +153,24 @@ int main( int argc, char* argv[] )
 	  return 1;
      }    
 
+     std::vector<std::string> feature_files;
+     if (!vm["feature"].empty()) {
+	  feature_files = vm["feature"].as<std::vector<std::string> >();
+     }
+     unsigned n_dim = feature_files.size() + 1;
+
+     if (vm.count("model")) {
+	  return model_batch(model_file, batch_file, input_file, mask_file, feature_files, seg_file, warmit, subsample, map, beta, mrfit, verbose);
+     }
+
      std::vector<double> mean_opt, sigma_opt, prop_opt;
-     if (!vm["mean"].empty() && (mean_opt = vm["mean"].as<std::vector<double> >()).size() == n_comp) {
+     if (!vm["mean"].empty() && ((mean_opt = vm["mean"].as<std::vector<double> >()).size() == n_comp || mean_opt.size() == n_comp * n_dim)) {
      }
      else {
 	  std::cout << "mean parameter must have length n_comp.\n";
 	  exit(1);
      }
-     if (!vm["sigma"].empty() && (sigma_opt = vm["sigma"].as<std::vector<double> >()).size() == n_comp) {
+     if (!vm["sigma"].empty() && ((sigma_opt = vm["sigma"].as<std::vector<double> >()).size() == n_comp || sigma_opt.size() == n_comp * n_dim)) {
      }
      else {
 	  std::cout << "Sigma parameter must have length n_comp.\n";
@@ -97,40 +188,29 @@ int main( int argc, char* argv[] )
      inReader->Update();
      ImageType3F::Pointer inPtr = inReader->GetOutput();
 
-     // read mask file
-     ReaderType3UC::Pointer maskReader = ReaderType3UC::New();
-     maskReader->SetFileName(mask_file);
-     maskReader->Update();
-     ImageType3UC::Pointer maskPtr = maskReader->GetOutput();
-
-     // convert image to list sample. ITK has imageToListSample filter, but
-     // could not save the correspondence between voxels and samples. We need
-     // such correspondence since we need to save a label volume. So, here we
-     // convert the volume to samples by hand, and same the mapping, too.
-
-     // first define a image buffer to map voxel to linear sample index. 
-     ImageType3U::Pointer to_samplePtr = ImageType3U::New();
-     to_samplePtr->SetRegions(inPtr->GetLargestPossibleRegion());
-     to_samplePtr->Allocate();
-     to_samplePtr->FillBuffer(0);
-     itk::ImageRegionIterator<ImageType3U> to_sampleIt(to_samplePtr, to_samplePtr->GetLargestPossibleRegion());
-     
-     SampleType::Pointer sample = SampleType::New();
+     // read mask file. Only the voxels in the mask are classified, so the
+     // volumes can be cropped to the bounding box of the mask.
+     RLEMask full_mask, mask;
+     rle_read(mask_file, full_mask);
+     VolumeROI roi;
+     if (roi_init(roi, roi_mode, inPtr.GetPointer(), full_mask, margin, verbose)) {
+	  return 1;
+     }
+     inPtr = roi_crop(roi, inPtr);
+     roi_crop(roi, full_mask, mask);
 
-     itk::ImageRegionIterator<ImageType3UC> maskIt(maskPtr, maskPtr->GetLargestPossibleRegion());
-     itk::ImageRegionIterator<ImageType3F> featureIt(inPtr, inPtr->GetLargestPossibleRegion());
-     
-     unsigned n  = 0;
-     MeasurementVectorType this_sample;
-     for(maskIt.GoToBegin(), featureIt.GoToBegin(), to_sampleIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ featureIt, ++ to_sampleIt) {
-     	  if (maskIt.Get() > 0) {
-     	       this_sample[0] = featureIt.Get();
-     	       sample->PushBack(this_sample);
-     	       to_sampleIt.Set(n);
-     	       n ++;
-     	  }
+     if (n_dim > 1) {
+	  return multivariate_gmm(inPtr, mask, roi, feature_files, mean_opt, sigma_opt, prop_opt, n_comp, maxit, subsample, seg_file, savemodel_file, map, beta, mrfit, verbose);
      }
 
+     // view the masked voxels as a sample. Only the buffer offsets of the
+     // masked voxels are saved, and the intensity is read from the image buffer
+     // on the fly, so there is no copy of the intensity and no full-size
+     // voxel-to-sample map. The offsets are also used to save the labels.
+     SampleType::Pointer sample = SampleType::New();
+     sample->SetImage(inPtr);
+     sample->SetMask(mask);
+
      printf("gmm(), total number of samples inside mask: %i\n", sample->Size());
 
      // init mean and sigma
@@ -178,25 +258,17 @@ int main( int argc, char* argv[] )
 	  std::cout << std::setprecision(4) << "         " << estimator->GetProportions()[i] << std::endl;
      }
 
-     // Display the membership of each sample
-     DecisionRuleType::Pointer    decisionRule = DecisionRuleType::New();
-     ClassLabelVectorObjectType::Pointer  classLabelsObject = ClassLabelVectorObjectType::New();
-     ClassLabelVectorType & classLabelVector  = classLabelsObject->Get();
-
+     // full parameters of a 1-d component are mean and variance.
+     GMMModel model;
+     gmm_init_model(model, n_comp, 1);
      for (unsigned k = 0; k < n_comp; k ++) {
-	  classLabelVector.push_back( k + 1);
-	  }
-  
-     FilterType::Pointer sampleClassifierFilter = FilterType::New();
-     sampleClassifierFilter->SetInput( sample );
-     sampleClassifierFilter->SetNumberOfClasses( n_comp  );
-     sampleClassifierFilter->SetClassLabels( classLabelsObject );
-     sampleClassifierFilter->SetDecisionRule( decisionRule );
-     sampleClassifierFilter->SetMembershipFunctions( estimator->GetOutput() );
-     sampleClassifierFilter->Update();
-
-     const FilterType::MembershipSampleType* membershipSample = sampleClassifierFilter->GetOutput();
-     FilterType::MembershipSampleType::ConstIterator iter = membershipSample->Begin();
+	  model.prop[k] = estimator->GetProportions()[k];
+	  model.mean[k] = components[k]->GetFullParameters()[0];
+	  model.cov[k] = components[k]->GetFullParameters()[1];
+     }
+     if (!savemodel_file.empty() && gmm_save_model(model, savemodel_file)) {
+	  return 1;
+     }
 
      // save label to volume
      // first define a image buffer to save labels.
@@ -207,16 +279,290 @@ int main( int argc, char* argv[] )
      labelPtr->SetOrigin(inPtr->GetOrigin());
      labelPtr->SetDirection(inPtr->GetDirection());
      labelPtr->SetSpacing(inPtr->GetSpacing());
-     itk::ImageRegionIterator<ImageType3U> labelIt(labelPtr, labelPtr->GetLargestPossibleRegion());
 
-     ImageType3UC::IndexType maskIdx;
-     for(maskIt.GoToBegin(), to_sampleIt.GoToBegin(), labelIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ to_sampleIt, ++ labelIt) {
-     	  if (maskIt.Get() > 0) {
-     	       maskIdx = maskIt.GetIndex();
-     	       labelIt.Set(membershipSample->GetClassLabel(to_sampleIt.Get()));
-     	  }
+     // classify each sample with the model just built, by the same rule as
+     // --model, so a saved model gives the same labels.
+     FeatureSet fs;
+     fs.buffers.push_back(inPtr->GetBufferPointer());
+     fs.offsets = sample->GetOffsets();
+     if (gmm_classify(model, fs, labelPtr->GetBufferPointer(), map)) {
+	  return 1;
+     }
+
+     if (beta > 0 && mrf_smooth(model, fs, labelPtr, map, beta, mrfit, verbose)) {
+	  return 1;
      }
 
-     save_volume(labelPtr, seg_file);
+     return save_volume(roi_paste(roi, labelPtr, 0), seg_file);
 }
 
+int multivariate_gmm(ImageType3F::Pointer inPtr,
+		     const RLEMask & mask,
+		     const VolumeROI & roi,
+		     const std::vector<std::string> & feature_files,
+		     const std::vector<double> & mean_opt,
+		     const std::vector<double> & sigma_opt,
+		     const std::vector<double> & prop_opt,
+		     unsigned n_comp,
+		     unsigned maxit,
+		     unsigned subsample,
+		     std::string seg_file,
+		     std::string savemodel_file,
+		     bool map,
+		     double beta,
+		     unsigned mrfit,
+		     unsigned short verbose)
+{
+     unsigned n_dim = feature_files.size() + 1;
+     if (subsample == 0) subsample = 1;
+
+     // read feature volumes. They must have the same size as the intensity
+     // volume, and are cropped to the same ROI.
+     std::vector<ImageType3F::Pointer> featurePtrs(1, inPtr);
+     for (unsigned d = 0; d < feature_files.size(); d ++) {
+	  ReaderType3F::Pointer featureReader = ReaderType3F::New();
+	  featureReader->SetFileName(feature_files[d]);
+	  featureReader->Update();
+	  ImageType3F::Pointer featurePtr = featureReader->GetOutput();
+	  if (featurePtr->GetLargestPossibleRegion() != roi.full) {
+	       std::cout << "multivariate_gmm(): feature volume " << feature_files[d] << " has different size with input.\n";
+	       return 1;
+	  }
+	  featurePtrs.push_back(roi_crop(roi, featurePtr));
+     }
+
+     // the full sample set for classification, and a subsampled set for the
+     // estimation. Both only save the buffer offsets of the voxels.
+     FeatureSet full_set, fit_set;
+     for (unsigned d = 0; d < n_dim; d ++) {
+	  full_set.buffers.push_back(featurePtrs[d]->GetBufferPointer());
+     }
+     fit_set.buffers = full_set.buffers;
+     rle_offsets(mask, full_set.offsets);
+     for (size_t n = 0; n < full_set.offsets.size(); n += subsample) {
+	  fit_set.offsets.push_back(full_set.offsets[n]);
+     }
+     printf("multivariate_gmm(), samples inside mask: %i, samples for estimation: %i\n", (int)full_set.offsets.size(), (int)fit_set.offsets.size());
+
+     // init model. Means and standard deviations not given for the additional
+     // features are initialized by the sample mean and standard deviation.
+     GMMModel model;
+     gmm_init_model(model, n_comp, n_dim);
+     std::vector<double> fmean(n_dim, 0), fstd(n_dim, 0);
+     for (unsigned d = 0; d < n_dim; d ++) {
+	  double sum = 0, sum2 = 0;
+	  for (unsigned i = 0; i < fit_set.offsets.size(); i ++) {
+	       double v = fit_set.buffers[d][fit_set.offsets[i]];
+	       sum += v;
+	       sum2 += v * v;
+	  }
+	  fmean[d] = sum / fit_set.offsets.size();
+	  fstd[d] = sqrt(std::max(sum2 / fit_set.offsets.size() - fmean[d] * fmean[d], EPS));
+     }
+     for (unsigned k = 0; k < n_comp; k ++) {
+	  model.prop[k] = prop_opt.size() == n_comp? prop_opt[k] : 1.0 / n_comp;
+	  for (unsigned d = 0; d < n_dim; d ++) {
+	       double mu = fmean[d], sigma = fstd[d];
+	       if (mean_opt.size() == n_comp * n_dim) mu = mean_opt[k * n_dim + d];
+	       else if (d == 0) mu = mean_opt[k];
+	       if (sigma_opt.size() == n_comp * n_dim) sigma = sigma_opt[k * n_dim + d];
+	       else if (d == 0 && sigma_opt.size() == n_comp) sigma = sigma_opt[k];
+	       model.mean[k * n_dim + d] = mu;
+	       model.cov[k * n_dim * n_dim + d * n_dim + d] = sigma * sigma;
+	  }
+     }
+
+     if (gmm_em(model, fit_set, maxit, 1e-6, verbose)) {
+	  return 1;
+     }
+     gmm_print_model(model);
+     if (!savemodel_file.empty() && gmm_save_model(model, savemodel_file)) {
+	  return 1;
+     }
+
+     ImageType3U::Pointer labelPtr = ImageType3U::New();
+     labelPtr->SetRegions(inPtr->GetLargestPossibleRegion());
+     labelPtr->Allocate();
+     labelPtr->FillBuffer(0);
+     labelPtr->SetOrigin(inPtr->GetOrigin());
+     labelPtr->SetDirection(inPtr->GetDirection());
+     labelPtr->SetSpacing(inPtr->GetSpacing());
+
+     if (gmm_classify(model, full_set, labelPtr->GetBufferPointer(), map)) {
+	  return 1;
+     }
+     if (beta > 0 && mrf_smooth(model, full_set, labelPtr, map, beta, mrfit, verbose)) {
+	  return 1;
+     }
+     return save_volume(roi_paste(roi, labelPtr, 0), seg_file);
+}
+
+int classify_with_model(const GMMModel & model,
+			std::string input_file,
+			std::string mask_file,
+			const std::vector<std::string> & feature_files,
+			std::string seg_file,
+			unsigned warmit,
+			unsigned subsample,
+			bool map,
+			double beta,
+			unsigned mrfit,
+			unsigned short verbose)
+{
+     if (feature_files.size() + 1 != model.n_dim) {
+	  printf("classify_with_model(): %s: model has %i dimensions, but %i feature volumes are given.\n", input_file.c_str(), model.n_dim, (int)feature_files.size() + 1);
+	  return 1;
+     }
+
+     std::vector<std::string> files(1, input_file);
+     files.insert(files.end(), feature_files.begin(), feature_files.end());
+     std::vector<ImageType3F::Pointer> featurePtrs;
+     FeatureSet full_set, fit_set;
+     try {
+	  for (unsigned d = 0; d < files.size(); d ++) {
+	       ReaderType3F::Pointer featureReader = ReaderType3F::New();
+	       featureReader->SetFileName(files[d]);
+	       featureReader->Update();
+	       featurePtrs.push_back(featureReader->GetOutput());
+	       if (featurePtrs[d]->GetLargestPossibleRegion() != featurePtrs[0]->GetLargestPossibleRegion()) {
+		    std::cout << "classify_with_model(): feature volume " << files[d] << " has different size with input.\n";
+		    return 1;
+	       }
+	       full_set.buffers.push_back(featurePtrs[d]->GetBufferPointer());
+	  }
+	  RLEMask mask;
+	  rle_read(mask_file, mask);
+	  ImageType3F::SizeType size = featurePtrs[0]->GetLargestPossibleRegion().GetSize();
+	  if (mask.size[0] != size[0] || mask.size[1] != size[1] || mask.size[2] != size[2]) {
+	       std::cout << "classify_with_model(): mask " << mask_file << " has different size with input.\n";
+	       return 1;
+	  }
+	  rle_offsets(mask, full_set.offsets);
+	  for (size_t n = 0; warmit > 0 && n < full_set.offsets.size(); n += subsample) {
+	       fit_set.offsets.push_back(full_set.offsets[n]);
+	  }
+     }
+     catch( itk::ExceptionObject & err ) {
+	  std::cerr << "classify_with_model(): ExceptionObject caught !" << std::endl;
+	  std::cerr << err << std::endl;
+	  return 1;
+     }
+
+     // a few EM iterations started from the stored model adapt it to this
+     // volume.
+     GMMModel this_model = model;
+     if (warmit > 0) {
+	  fit_set.buffers = full_set.buffers;
+	  if (gmm_em(this_model, fit_set, warmit, 1e-6, verbose)) {
+	       return 1;
+	  }
+	  if (verbose >= 1) {
+	       gmm_print_model(this_model);
+	  }
+     }
+
+     ImageType3U::Pointer labelPtr = ImageType3U::New();
+     labelPtr->SetRegions(featurePtrs[0]->GetLargestPossibleRegion());
+     labelPtr->Allocate();
+     labelPtr->FillBuffer(0);
+     labelPtr->SetOrigin(featurePtrs[0]->GetOrigin());
+     labelPtr->SetDirection(featurePtrs[0]->GetDirection());
+     labelPtr->SetSpacing(featurePtrs[0]->GetSpacing());
+
+     if (gmm_classify(this_model, full_set, labelPtr->GetBufferPointer(), map)) {
+	  printf("classify_with_model(): %s: classification failed.\n", input_file.c_str());
+	  return 1;
+     }
+     if (beta > 0 && mrf_smooth(this_model, full_set, labelPtr, map, beta, mrfit, verbose)) {
+	  printf("classify_with_model(): %s: MRF smoothing failed.\n", input_file.c_str());
+	  return 1;
+     }
+     return save_volume(labelPtr, seg_file);
+}
+
+int model_batch(std::string model_file,
+		std::string batch_file,
+		std::string input_file,
+		std::string mask_file,
+		const std::vector<std::string> & feature_files,
+		std::string seg_file,
+		unsigned warmit,
+		unsigned subsample,
+		bool map,
+		double beta,
+		unsigned mrfit,
+		unsigned short verbose)
+{
+     GMMModel model;
+     if (gmm_load_model(model, model_file)) {
+	  return 1;
+     }
+     if (verbose >= 1) {
+	  gmm_print_model(model);
+     }
+     if (subsample == 0) subsample = 1;
+
+     // without a batch file, classify the single volume given by --input.
+     std::vector<std::string> inputs(1, input_file), masks(1, mask_file), segs(1, seg_file);
+     std::vector<std::vector<std::string> > features(1, feature_files);
+     if (!batch_file.empty()) {
+	  inputs.clear(); masks.clear(); segs.clear(); features.clear();
+	  std::ifstream batch(batch_file.c_str());
+	  std::string line;
+	  while (std::getline(batch, line)) {
+	       std::istringstream fields(line);
+	       std::string input, mask, seg, feature;
+	       if (!(fields >> input >> mask >> seg)) continue;
+	       inputs.push_back(input);
+	       masks.push_back(mask);
+	       segs.push_back(seg);
+	       features.push_back(std::vector<std::string>());
+	       while (fields >> feature) {
+		    features.back().push_back(feature);
+	       }
+	  }
+	  printf("model_batch(): %i volumes in %s.\n", (int)inputs.size(), batch_file.c_str());
+     }
+
+     // The IO factories are registered on first use, which is not thread
+     // safe. Trigger it before the parallel loop.
+     if (!inputs.empty()) {
+	  itk::ImageIOFactory::CreateImageIO(inputs[0].c_str(), itk::ImageIOFactory::ReadMode);
+     }
+
+     // each volume is processed by one thread. EM and classification inside
+     // run serially unless nested parallelism is enabled.
+     int n_failed = 0;
+     int n_volumes = inputs.size();
+#pragma omp parallel for schedule(dynamic) reduction(+:n_failed)
+     for (int v = 0; v < n_volumes; v ++) {
+	  if (classify_with_model(model, inputs[v], masks[v], features[v], segs[v], warmit, subsample, map, beta, mrfit, verbose)) {
+	       n_failed ++;
+	  }
+     }
+
+     if (n_failed > 0) {
+	  printf("model_batch(): %i of %i volumes failed.\n", n_failed, n_volumes);
+	  return 1;
+     }
+     return 0;
+}
+
+int mrf_smooth(const GMMModel & model,
+	       const FeatureSet & fs,
+	       ImageType3U::Pointer labelPtr,
+	       bool map,
+	       double beta,
+	       unsigned mrfit,
+	       unsigned short verbose)
+{
+     // the per-voxel log densities (n_comp floats per voxel in the mask) are
+     // computed once and reused by all sweeps.
+     std::vector<float> logp;
+     if (gmm_log_density(model, fs, logp, map)) {
+	  return 1;
+     }
+     ImageType3U::SizeType labelSize = labelPtr->GetLargestPossibleRegion().GetSize();
+     unsigned size[3] = {(unsigned)labelSize[0], (unsigned)labelSize[1], (unsigned)labelSize[2]};
+     return mrf_icm(fs, logp, model.n_comp, size, beta, mrfit, labelPtr->GetBufferPointer(), verbose);
+}
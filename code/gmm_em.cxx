@@ -0,0 +1,461 @@
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include "gmm_em.h"
+
+// number of samples processed together. The features and per-component terms
+// of a block are saved feature by feature (structure of arrays), so the inner
+// loops run over contiguous samples and are vectorized by the compiler.
+#define GMM_BLOCK 256
+
+// regularization added to the diagonal of the covariance matrices, relative
+// and absolute.
+#define GMM_COV_REG 1e-6
+#define GMM_COV_EPS 1e-10
+
+// per-component terms of the E-step.
+struct GMMCompCache
+{
+     std::vector<float> mean;     // n_dim
+     std::vector<float> chol;     // n_dim x n_dim, lower triangle of the Cholesky factor.
+     std::vector<float> inv_diag; // n_dim, reciprocal of the Cholesky diagonal.
+     float log_const;             // log of the Gaussian normalization, plus log(prop) if weighted.
+};
+
+static int cholesky(const double * A, double * L, unsigned D)
+{
+     std::fill(L, L + D * D, 0.0);
+     for (unsigned i = 0; i < D; i ++) {
+	  for (unsigned j = 0; j <= i; j ++) {
+	       double s = A[i * D + j];
+	       for (unsigned k = 0; k < j; k ++) {
+		    s -= L[i * D + k] * L[j * D + k];
+	       }
+	       if (i == j) {
+		    if (s <= 0) return 1;
+		    L[i * D + i] = sqrt(s);
+	       }
+	       else {
+		    L[i * D + j] = s / L[j * D + j];
+	       }
+	  }
+     }
+     return 0;
+}
+
+// with weighted false, the proportions are left out and the log densities
+// are those of the components alone.
+static int build_cache(const GMMModel & model, std::vector<GMMCompCache> & cache, bool weighted)
+{
+     const unsigned K = model.n_comp, D = model.n_dim;
+     std::vector<double> L(D * D);
+     cache.resize(K);
+     for (unsigned k = 0; k < K; k ++) {
+	  if (cholesky(&model.cov[k * D * D], &L[0], D)) {
+	       return 1;
+	  }
+	  GMMCompCache & c = cache[k];
+	  c.mean.resize(D);
+	  c.chol.resize(D * D);
+	  c.inv_diag.resize(D);
+	  double log_det = 0;
+	  for (unsigned d = 0; d < D; d ++) {
+	       c.mean[d] = model.mean[k * D + d];
+	       for (unsigned e = 0; e < D; e ++) {
+		    c.chol[d * D + e] = L[d * D + e];
+	       }
+	       c.inv_diag[d] = 1.0 / L[d * D + d];
+	       log_det += 2 * log(L[d * D + d]);
+	  }
+	  if (!weighted) {
+	       c.log_const = - 0.5 * (D * log(2 * M_PI) + log_det);
+	  }
+	  else if (model.prop[k] > 0) {
+	       c.log_const = log(model.prop[k]) - 0.5 * (D * log(2 * M_PI) + log_det);
+	  }
+	  else {
+	       c.log_const = -HUGE_VALF;
+	  }
+     }
+     return 0;
+}
+
+// copy the features of samples [start, start+n) into x (n_dim x GMM_BLOCK).
+static void gather_block(const FeatureSet & fs, long start, unsigned n, float * x)
+{
+     const unsigned * offsets = &fs.offsets[start];
+     for (unsigned d = 0; d < fs.buffers.size(); d ++) {
+	  const float * buffer = fs.buffers[d];
+	  float * xd = x + d * GMM_BLOCK;
+	  for (unsigned i = 0; i < n; i ++) {
+	       xd[i] = buffer[offsets[i]];
+	  }
+     }
+}
+
+// log(prop_k * N(x | mean_k, cov_k)) of a block of n samples. The Mahalanobis
+// distance is computed by forward substitution with the Cholesky factor. x is
+// n_dim x GMM_BLOCK, y is a scratch buffer of the same size, and logp is
+// n_comp x GMM_BLOCK.
+static void block_log_density(const std::vector<GMMCompCache> & cache,
+			      unsigned D,
+			      const float * x,
+			      unsigned n,
+			      float * y,
+			      float * logp)
+{
+     for (unsigned k = 0; k < cache.size(); k ++) {
+	  const GMMCompCache & c = cache[k];
+	  float * lp = logp + k * GMM_BLOCK;
+	  for (unsigned i = 0; i < n; i ++) {
+	       lp[i] = 0;
+	  }
+	  for (unsigned d = 0; d < D; d ++) {
+	       const float * xd = x + d * GMM_BLOCK;
+	       float * yd = y + d * GMM_BLOCK;
+	       const float mu = c.mean[d];
+	       const float inv = c.inv_diag[d];
+	       for (unsigned i = 0; i < n; i ++) {
+		    yd[i] = xd[i] - mu;
+	       }
+	       for (unsigned e = 0; e < d; e ++) {
+		    const float l = c.chol[d * D + e];
+		    const float * ye = y + e * GMM_BLOCK;
+		    for (unsigned i = 0; i < n; i ++) {
+			 yd[i] -= l * ye[i];
+		    }
+	       }
+	       for (unsigned i = 0; i < n; i ++) {
+		    yd[i] *= inv;
+		    lp[i] += yd[i] * yd[i];
+	       }
+	  }
+	  const float log_const = c.log_const;
+	  for (unsigned i = 0; i < n; i ++) {
+	       lp[i] = log_const - 0.5f * lp[i];
+	  }
+     }
+}
+
+void gmm_init_model(GMMModel & model, unsigned n_comp, unsigned n_dim)
+{
+     model.n_comp = n_comp;
+     model.n_dim = n_dim;
+     model.prop.assign(n_comp, 1.0 / n_comp);
+     model.mean.assign(n_comp * n_dim, 0);
+     model.cov.assign(n_comp * n_dim * n_dim, 0);
+     for (unsigned k = 0; k < n_comp; k ++) {
+	  for (unsigned d = 0; d < n_dim; d ++) {
+	       model.cov[k * n_dim * n_dim + d * n_dim + d] = 1;
+	  }
+     }
+}
+
+int gmm_em(GMMModel & model,
+	   const FeatureSet & fs,
+	   unsigned maxit,
+	   double tol,
+	   unsigned short verbose)
+{
+     const unsigned K = model.n_comp, D = model.n_dim;
+     const long n_samples = fs.offsets.size();
+     const long n_blocks = (n_samples + GMM_BLOCK - 1) / GMM_BLOCK;
+
+     if (fs.buffers.size() != D) {
+	  printf("gmm_em(): number of feature volumes (%i) does not match model dimension (%i).\n", (int)fs.buffers.size(), D);
+	  return 1;
+     }
+     if (n_samples == 0) {
+	  printf("gmm_em(): no samples.\n");
+	  return 1;
+     }
+
+     // sufficient statistics of each component: sum of responsibilities, sum
+     // of r * x (n_dim), and sum of r * x * x' (n_dim x n_dim, lower triangle).
+     const unsigned stat_size = 1 + D + D * D;
+     std::vector<double> stats(K * stat_size);
+     std::vector<GMMCompCache> cache;
+     double loglik = 0, old_loglik = 0;
+
+     for (unsigned it = 0; it < maxit; it ++) {
+	  if (build_cache(model, cache, true)) {
+	       printf("gmm_em(): covariance matrix is not positive definite at iteration %i.\n", it);
+	       return 1;
+	  }
+	  std::fill(stats.begin(), stats.end(), 0.0);
+	  loglik = 0;
+
+#pragma omp parallel
+	  {
+	       std::vector<double> my_stats(K * stat_size, 0.0);
+	       std::vector<float> x(D * GMM_BLOCK), y(D * GMM_BLOCK), r(K * GMM_BLOCK);
+	       std::vector<float> max_lp(GMM_BLOCK), sum_p(GMM_BLOCK);
+	       double my_loglik = 0;
+
+#pragma omp for schedule(static)
+	       for (long b = 0; b < n_blocks; b ++) {
+		    long start = b * GMM_BLOCK;
+		    unsigned n = std::min((long)GMM_BLOCK, n_samples - start);
+		    gather_block(fs, start, n, &x[0]);
+		    block_log_density(cache, D, &x[0], n, &y[0], &r[0]);
+
+		    // convert log densities to responsibilities in place.
+		    for (unsigned i = 0; i < n; i ++) {
+			 max_lp[i] = r[i];
+			 sum_p[i] = 0;
+		    }
+		    for (unsigned k = 1; k < K; k ++) {
+			 const float * lp = &r[k * GMM_BLOCK];
+			 for (unsigned i = 0; i < n; i ++) {
+			      max_lp[i] = std::max(max_lp[i], lp[i]);
+			 }
+		    }
+		    for (unsigned k = 0; k < K; k ++) {
+			 float * rk = &r[k * GMM_BLOCK];
+			 for (unsigned i = 0; i < n; i ++) {
+			      rk[i] = exp(rk[i] - max_lp[i]);
+			      sum_p[i] += rk[i];
+			 }
+		    }
+		    for (unsigned i = 0; i < n; i ++) {
+			 my_loglik += max_lp[i] + log(sum_p[i]);
+			 sum_p[i] = 1 / sum_p[i];
+		    }
+		    for (unsigned k = 0; k < K; k ++) {
+			 float * rk = &r[k * GMM_BLOCK];
+			 for (unsigned i = 0; i < n; i ++) {
+			      rk[i] *= sum_p[i];
+			 }
+		    }
+
+		    // accumulate sufficient statistics.
+		    for (unsigned k = 0; k < K; k ++) {
+			 const float * rk = &r[k * GMM_BLOCK];
+			 double * s = &my_stats[k * stat_size];
+			 double sum = 0;
+			 for (unsigned i = 0; i < n; i ++) {
+			      sum += rk[i];
+			 }
+			 s[0] += sum;
+			 for (unsigned d = 0; d < D; d ++) {
+			      const float * xd = &x[d * GMM_BLOCK];
+			      sum = 0;
+			      for (unsigned i = 0; i < n; i ++) {
+				   sum += rk[i] * xd[i];
+			      }
+			      s[1 + d] += sum;
+			      for (unsigned e = 0; e <= d; e ++) {
+				   const float * xe = &x[e * GMM_BLOCK];
+				   sum = 0;
+				   for (unsigned i = 0; i < n; i ++) {
+					sum += (double)rk[i] * xd[i] * xe[i];
+				   }
+				   s[1 + D + d * D + e] += sum;
+			      }
+			 }
+		    }
+	       } // b
+
+#pragma omp critical
+	       {
+		    for (unsigned s = 0; s < stats.size(); s ++) {
+			 stats[s] += my_stats[s];
+		    }
+		    loglik += my_loglik;
+	       }
+	  } // omp parallel
+
+	  // M step.
+	  for (unsigned k = 0; k < K; k ++) {
+	       const double * s = &stats[k * stat_size];
+	       double * mean = &model.mean[k * D];
+	       double * cov = &model.cov[k * D * D];
+	       model.prop[k] = s[0] / n_samples;
+	       if (s[0] < 1) {
+		    // empty component. keep mean and covariance.
+		    continue;
+	       }
+	       for (unsigned d = 0; d < D; d ++) {
+		    mean[d] = s[1 + d] / s[0];
+	       }
+	       for (unsigned d = 0; d < D; d ++) {
+		    for (unsigned e = 0; e <= d; e ++) {
+			 cov[d * D + e] = s[1 + D + d * D + e] / s[0] - mean[d] * mean[e];
+			 cov[e * D + d] = cov[d * D + e];
+		    }
+		    cov[d * D + d] += GMM_COV_REG * cov[d * D + d] + GMM_COV_EPS;
+	       }
+	  }
+
+	  if (verbose >= 1) {
+	       printf("gmm_em(), iteration %i, log-likelihood %f.\n", it, loglik);
+	  }
+	  if (it > 0 && fabs(loglik - old_loglik) < tol * fabs(loglik)) {
+	       break;
+	  }
+	  old_loglik = loglik;
+     } // it
+
+     return 0;
+}
+
+int gmm_classify(const GMMModel & model,
+		 const FeatureSet & fs,
+		 unsigned * labelBuffer,
+		 bool map)
+{
+     const unsigned K = model.n_comp, D = model.n_dim;
+     const long n_samples = fs.offsets.size();
+     const long n_blocks = (n_samples + GMM_BLOCK - 1) / GMM_BLOCK;
+     std::vector<GMMCompCache> cache;
+     if (build_cache(model, cache, map)) {
+	  printf("gmm_classify(): covariance matrix is not positive definite.\n");
+	  return 1;
+     }
+
+#pragma omp parallel
+     {
+	  std::vector<float> x(D * GMM_BLOCK), y(D * GMM_BLOCK), logp(K * GMM_BLOCK);
+	  std::vector<float> best_lp(GMM_BLOCK);
+	  std::vector<unsigned> best_k(GMM_BLOCK);
+
+#pragma omp for schedule(static)
+	  for (long b = 0; b < n_blocks; b ++) {
+	       long start = b * GMM_BLOCK;
+	       unsigned n = std::min((long)GMM_BLOCK, n_samples - start);
+	       gather_block(fs, start, n, &x[0]);
+	       block_log_density(cache, D, &x[0], n, &y[0], &logp[0]);
+	       for (unsigned i = 0; i < n; i ++) {
+		    best_lp[i] = logp[i];
+		    best_k[i] = 0;
+	       }
+	       for (unsigned k = 1; k < K; k ++) {
+		    const float * lp = &logp[k * GMM_BLOCK];
+		    for (unsigned i = 0; i < n; i ++) {
+			 if (lp[i] > best_lp[i]) {
+			      best_lp[i] = lp[i];
+			      best_k[i] = k;
+			 }
+		    }
+	       }
+	       const unsigned * offsets = &fs.offsets[start];
+	       for (unsigned i = 0; i < n; i ++) {
+		    labelBuffer[offsets[i]] = best_k[i] + 1;
+	       }
+	  }
+     }
+     return 0;
+}
+
+int gmm_log_density(const GMMModel & model,
+		    const FeatureSet & fs,
+		    std::vector<float> & logp,
+		    bool map)
+{
+     const unsigned K = model.n_comp, D = model.n_dim;
+     const long n_samples = fs.offsets.size();
+     const long n_blocks = (n_samples + GMM_BLOCK - 1) / GMM_BLOCK;
+     std::vector<GMMCompCache> cache;
+     if (build_cache(model, cache, map)) {
+	  printf("gmm_log_density(): covariance matrix is not positive definite.\n");
+	  return 1;
+     }
+     logp.resize(n_samples * K);
+
+#pragma omp parallel
+     {
+	  std::vector<float> x(D * GMM_BLOCK), y(D * GMM_BLOCK), lp(K * GMM_BLOCK);
+
+#pragma omp for schedule(static)
+	  for (long b = 0; b < n_blocks; b ++) {
+	       long start = b * GMM_BLOCK;
+	       unsigned n = std::min((long)GMM_BLOCK, n_samples - start);
+	       gather_block(fs, start, n, &x[0]);
+	       block_log_density(cache, D, &x[0], n, &y[0], &lp[0]);
+	       float * out = &logp[start * K];
+	       for (unsigned i = 0; i < n; i ++) {
+		    for (unsigned k = 0; k < K; k ++) {
+			 out[i * K + k] = lp[k * GMM_BLOCK + i];
+		    }
+	       }
+	  }
+     }
+     return 0;
+}
+
+void gmm_print_model(const GMMModel & model)
+{
+     const unsigned D = model.n_dim;
+     for (unsigned k = 0; k < model.n_comp; k ++) {
+	  printf("Cluster[%i]\n", k);
+	  printf("    Proportion: %.4f\n", model.prop[k]);
+	  printf("    Mean:");
+	  for (unsigned d = 0; d < D; d ++) {
+	       printf(" %g", model.mean[k * D + d]);
+	  }
+	  printf("\n    Covariance:\n");
+	  for (unsigned d = 0; d < D; d ++) {
+	       printf("        ");
+	       for (unsigned e = 0; e < D; e ++) {
+		    printf(" %g", model.cov[k * D * D + d * D + e]);
+	       }
+	       printf("\n");
+	  }
+     }
+}
+
+int gmm_save_model(const GMMModel & model, std::string filename)
+{
+     std::ofstream out(filename.c_str());
+     if (!out) {
+	  printf("gmm_save_model(): can not open %s.\n", filename.c_str());
+	  return 1;
+     }
+     out.precision(17);
+     out << "n_comp " << model.n_comp << "\n";
+     out << "n_dim " << model.n_dim << "\n";
+     out << "prop";
+     for (unsigned i = 0; i < model.prop.size(); i ++) out << " " << model.prop[i];
+     out << "\nmean";
+     for (unsigned i = 0; i < model.mean.size(); i ++) out << " " << model.mean[i];
+     out << "\ncov";
+     for (unsigned i = 0; i < model.cov.size(); i ++) out << " " << model.cov[i];
+     out << "\n";
+     if (!out) {
+	  printf("gmm_save_model(): failed writing %s.\n", filename.c_str());
+	  return 1;
+     }
+     printf("gmm_save_model(): File %s saved.\n", filename.c_str());
+     return 0;
+}
+
+static bool read_model_field(std::istream & in, std::string name, std::vector<double> & values)
+{
+     std::string key;
+     if (!(in >> key) || key != name) return false;
+     for (unsigned i = 0; i < values.size(); i ++) {
+	  if (!(in >> values[i])) return false;
+     }
+     return true;
+}
+
+int gmm_load_model(GMMModel & model, std::string filename)
+{
+     std::ifstream in(filename.c_str());
+     std::string key;
+     unsigned n_comp = 0, n_dim = 0;
+     if (!(in >> key >> n_comp) || key != "n_comp" || !(in >> key >> n_dim) || key != "n_dim" || n_comp == 0 || n_dim == 0) {
+	  printf("gmm_load_model(): %s is not a GMM model file.\n", filename.c_str());
+	  return 1;
+     }
+     gmm_init_model(model, n_comp, n_dim);
+     bool ok = read_model_field(in, "prop", model.prop)
+	  && read_model_field(in, "mean", model.mean)
+	  && read_model_field(in, "cov", model.cov);
+     if (!ok) {
+	  printf("gmm_load_model(): %s is truncated or corrupted.\n", filename.c_str());
+	  return 1;
+     }
+     return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef __GMM_EM_H__
+#define __GMM_EM_H__
+
+#include <vector>
+#include <string>
+
+// Gaussian mixture model with full covariance matrices. Matrices are saved in
+// row-major order.
+struct GMMModel
+{
+     unsigned n_comp;
+     unsigned n_dim;
+     std::vector<double> prop; // n_comp
+     std::vector<double> mean; // n_comp x n_dim
+     std::vector<double> cov;  // n_comp x n_dim x n_dim
+};
+
+// The masked voxels of n_dim co-registered feature volumes. Each sample is
+// given by its buffer offset, and the features are gathered from the volume
+// buffers block by block, so the samples are never copied as a whole.
+struct FeatureSet
+{
+     std::vector<const float *> buffers; // one buffer per feature dimension.
+     std::vector<unsigned> offsets;      // buffer offsets of the samples.
+};
+
+// allocate the parameters of a model with n_comp components of dimension
+// n_dim. Proportions are uniform, means are zero and covariances identity.
+void gmm_init_model(GMMModel & model, unsigned n_comp, unsigned n_dim);
+
+// EM estimation of the model. The input model is the initial value. Stops
+// after maxit iterations, or when the relative change of the log-likelihood is
+// below tol.
+int gmm_em(GMMModel & model,
+	   const FeatureSet & fs,
+	   unsigned maxit,
+	   double tol,
+	   unsigned short verbose);
+
+// label of each sample. With map false, the label is the maximum likelihood
+// component, max N(x | mean_k, cov_k), the rule of ITK's MaximumDecisionRule
+// without class weights. With map true, it is the maximum a posteriori
+// component, max prop_k * N(x | mean_k, cov_k). Label k+1 is written at the
+// sample's offset of labelBuffer. Voxels not in fs are not touched.
+int gmm_classify(const GMMModel & model,
+		 const FeatureSet & fs,
+		 unsigned * labelBuffer,
+		 bool map);
+
+// log N(x_i | mean_k, cov_k) of each sample, plus log(prop_k) if map is true,
+// saved sample by sample in logp (n_samples x n_comp).
+int gmm_log_density(const GMMModel & model,
+		    const FeatureSet & fs,
+		    std::vector<float> & logp,
+		    bool map);
+
+void gmm_print_model(const GMMModel & model);
+
+// save and load a model in a small text file.
+int gmm_save_model(const GMMModel & model, std::string filename);
+int gmm_load_model(GMMModel & model, std::string filename);
+
+#endif
@@ -3,7 +3,10 @@
 #include "itkSymmetricSecondRankTensor.h"
 #include "itkSymmetricEigenAnalysis.h"
 #include <itkHessianRecursiveGaussianImageFilter.h>
+#include "itkHessianToObjectnessMeasureImageFilter.h"
+#include "itkMultiScaleHessianBasedMeasureImageFilter.h"
 #include "itkFixedArray.h"
+#include "hessian_eigenvector.h"
 
 typedef float EigenValueType;
 typedef itk::FixedArray< EigenValueType, 3 > EigenValueArrayType;
@@ -259,3 +262,38 @@ int multiscale_hessian(ImageType3F::Pointer intensityPtr,
 
 }
 
+void multiscale_objectness(ImageType3D::Pointer intensityPtr,
+			   const HessianPar & par,
+			   ImageType3D::Pointer & vesselnessPtr,
+			   ImageType3DF::Pointer & scalePtr)
+{
+     typedef itk::SymmetricSecondRankTensor< double, 3 > DoubleHessianPixelType;
+     typedef itk::Image< DoubleHessianPixelType, 3 > DoubleHessianImageType;
+     typedef itk::HessianToObjectnessMeasureImageFilter< DoubleHessianImageType, ImageType3D > ObjectnessFilterType;
+     ObjectnessFilterType::Pointer objectnessFilter = ObjectnessFilterType::New();
+     objectnessFilter->SetBrightObject( par.bright_object );
+     objectnessFilter->SetScaleObjectnessMeasure( par.scale_objectness );
+     objectnessFilter->SetAlpha( par.alpha );
+     objectnessFilter->SetBeta( par.beta );
+     objectnessFilter->SetGamma( par.gamma );
+     if (par.verbose >= 1) {
+	  std::cout << "objectnessFilter's object dimension: " << objectnessFilter->GetObjectDimension() << std::endl;
+     }
+
+     typedef itk::MultiScaleHessianBasedMeasureImageFilter< ImageType3D, DoubleHessianImageType, ImageType3D > MultiScaleEnhancementFilterType;
+     MultiScaleEnhancementFilterType::Pointer multiScaleEnhancementFilter = MultiScaleEnhancementFilterType::New();
+     multiScaleEnhancementFilter->SetInput( intensityPtr );
+     multiScaleEnhancementFilter->SetHessianToMeasureFilter( objectnessFilter );
+     multiScaleEnhancementFilter->SetSigmaStepMethodToLogarithmic();
+     multiScaleEnhancementFilter->SetSigmaMinimum( par.sigma_min );
+     multiScaleEnhancementFilter->SetSigmaMaximum( par.sigma_max );
+     multiScaleEnhancementFilter->SetNumberOfSigmaSteps( par.steps );
+     multiScaleEnhancementFilter->SetNonNegativeHessianBasedMeasure(true);
+     multiScaleEnhancementFilter->SetGenerateScalesOutput(true);
+     multiScaleEnhancementFilter->Update();
+
+     vesselnessPtr = multiScaleEnhancementFilter->GetOutput();
+     vesselnessPtr->DisconnectPipeline();
+     scalePtr = const_cast<ImageType3DF *>(multiScaleEnhancementFilter->GetScalesOutput());
+     scalePtr->DisconnectPipeline();
+}
@@ -11,6 +11,16 @@ int multiscale_hessian(ImageType3F::Pointer intensityPtr,
 		       ImageType3UC::Pointer maskPtr,
 		       HessianPar par);
 
+// ITK's multiscale Hessian objectness measure (Frangi) of the intensity
+// volume, with par.alpha, par.beta, par.gamma, par.bright_object and
+// par.scale_objectness, at par.steps scales from par.sigma_min to
+// par.sigma_max (logarithmic). vesselnessPtr gets the largest measure over the
+// scales, and scalePtr the scale of it. Throws the exceptions of the filter.
+void multiscale_objectness(ImageType3D::Pointer intensityPtr,
+			   const HessianPar & par,
+			   ImageType3D::Pointer & vesselnessPtr,
+			   ImageType3DF::Pointer & scalePtr);
+
 int mytest(HessianImageType::Pointer hessianPtr);
 
 
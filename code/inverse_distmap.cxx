@@ -1,5 +1,9 @@
 #include <common.h>
 #include <utility.h>
+#include "result_cache.h"
+#include "rle_mask.h"
+#include "mapped_volume.h"
+#include "stages.h"
 
 namespace po = boost::program_options;
 int main(int argc, char* argv[])
@@ -41,36 +45,29 @@ int main(int argc, char* argv[])
 	  return 1;
      }    
 
+     // reuse the outputs of an earlier run with the same inputs and options.
+     const char * cache_inputs[] = {"input", "mask"};
+     const char * cache_outputs[] = {"output"};
+     ResultCache rc;
+     if (result_cache_restore(rc, "inverse_distmap", vm, std::vector<std::string>(cache_inputs, cache_inputs + 2), std::vector<std::string>(cache_outputs, cache_outputs + 1), std::vector<std::string>(), verbose)) {
+	  return 0;
+     }
+
      // read in distance file
-     ReaderType3D::Pointer inReader = ReaderType3D::New();
-     inReader->SetFileName(in_file);
-     inReader->Update();
-     ImageType3D::Pointer inPtr = inReader->GetOutput();
-     itk::ImageRegionIterator<ImageType3D> inIt(inPtr, inPtr->GetLargestPossibleRegion());
+     ImageType3D::Pointer inPtr = read_volume_mapped<ImageType3D>(in_file, verbose);
 
      // read in mask file.
-     ReaderType3UC::Pointer maskReader = ReaderType3UC::New();
-     maskReader->SetFileName(mask_file);
-     maskReader->Update();
-     ImageType3UC::Pointer maskPtr = maskReader->GetOutput();
-     itk::ImageRegionIterator<ImageType3UC> maskIt(maskPtr, maskPtr->GetLargestPossibleRegion() );
+     RLEMask mask;
+     rle_read(mask_file, mask);
 
-     for (inIt.GoToBegin(), maskIt.GoToBegin(); !maskIt.IsAtEnd(); ++ inIt, ++ maskIt) {
-	  if (maskIt.Get() > 0) {
-	       if (inIt.Get() < max) {
-		    inIt.Set(max - inIt.Get());
-	       }
-	       else {
-		    inIt.Set(0);
-	       }
-	  }
-	  else {
-	       inIt.Set(0);
-	  }
-     } // inIt
+     inverse_distance(inPtr.GetPointer(), mask, max);
 
      save_volume(inPtr, out_file);
 
+     if (save_volume_flush() > 0) {
+	  return 1;
+     }
+     result_cache_store(rc, verbose);
      return 0;
 }
 
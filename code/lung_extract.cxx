@@ -0,0 +1,78 @@
+#include <common.h>
+#include <utility.h>
+#include "result_cache.h"
+#include "stages.h"
+
+namespace po = boost::program_options;
+int main(int argc, char* argv[])
+{
+     std::string in_file, out_file;
+     int low_th = -900, high_th = -360;
+     unsigned short radius = 5, verbose = 0;
+     bool edt = false;
+
+     po::options_description mydesc("Because of the need of negative number as arguments, there is no short form of argument in this code.");
+     mydesc.add_options()
+	  ("help,h", "Extract the lung mask from a CT volume: threshold, closing, opening and the largest connected component, all in memory. Same as extract_lung() in processing.py.")
+	  ("input", po::value<std::string>(&in_file)->default_value("input.nii.gz"),
+	   "Input CT volume.")
+	  ("output", po::value<std::string>(&out_file)->default_value("lung.nii.gz"),
+	   "Output lung mask. Lung is 1, others 0.")
+	  ("low", po::value<int>(&low_th)->default_value(-900),
+	   "Lower threshold. Voxels below this value are believed not in the lung. Choose -900 for CTA image.")
+	  ("high", po::value<int>(&high_th)->default_value(-360),
+	   "Higher threshold. Voxels above this value are believed not in the lung. Choose -360 for CTA image.")
+	  ("radius", po::value<unsigned short>(&radius)->default_value(5),
+	   "Radius of the structure element of closing and opening.")
+	  ("edt", po::bool_switch(&edt),
+	   "Use the distance transform for closing and opening. Same output, faster for large radius.")
+	  ("verbose", po::value<unsigned short>(&verbose)->default_value(0),
+	   "verbose level. 0 for minimal output. 3 for most output.");
+
+     po::variables_map vm;
+     po::store(po::parse_command_line(argc, argv, mydesc, po::command_line_style::unix_style ^ po::command_line_style::allow_short), vm);
+     po::notify(vm);
+
+     try {
+	  if ( (vm.count("help")) | (argc == 1) ) {
+	       std::cout << "Usage: lung_extract [options]\n";
+	       std::cout << mydesc << "\n";
+	       return 0;
+	  }
+     }
+     catch(std::exception& e) {
+	  std::cout << e.what() << "\n";
+	  return 1;
+     }
+
+     // reuse the outputs of an earlier run with the same inputs and options.
+     const char * cache_inputs[] = {"input"};
+     const char * cache_outputs[] = {"output"};
+     ResultCache rc;
+     if (result_cache_restore(rc, "lung_extract", vm, std::vector<std::string>(cache_inputs, cache_inputs + 1), std::vector<std::string>(cache_outputs, cache_outputs + 1), std::vector<std::string>(), verbose)) {
+	  return 0;
+     }
+
+     ReaderType3F::Pointer inReader = ReaderType3F::New();
+     inReader->SetFileName(in_file);
+     inReader->Update();
+     ImageType3F::Pointer inPtr = inReader->GetOutput();
+
+     BitMask lung;
+     lung_mask(inPtr, low_th, high_th, radius, edt, lung, verbose);
+
+     ImageType3UC::Pointer outPtr = ImageType3UC::New();
+     outPtr->SetRegions(inPtr->GetLargestPossibleRegion());
+     outPtr->Allocate();
+     outPtr->SetOrigin(inPtr->GetOrigin());
+     outPtr->SetSpacing(inPtr->GetSpacing());
+     outPtr->SetDirection(inPtr->GetDirection());
+     bm_to_image(lung, outPtr, 1, 0);
+     save_volume(outPtr, out_file);
+
+     if (save_volume_flush() > 0) {
+	  return 1;
+     }
+     result_cache_store(rc, verbose);
+     return 0;
+}
@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "mapped_volume.h"
+
+static bool little_endian()
+{
+     const unsigned short one = 1;
+     return *(const unsigned char *)&one == 1;
+}
+
+// offset of the voxels of a single-file NIfTI-1, if stored without scaling in
+// native byte order.
+static bool nifti_data_offset(FILE * fp, size_t & offset)
+{
+     unsigned char hdr[348];
+     if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) return false;
+     int sizeof_hdr;
+     float vox_offset, scl_slope, scl_inter;
+     memcpy(&sizeof_hdr, hdr, 4);
+     memcpy(&vox_offset, hdr + 108, 4);
+     memcpy(&scl_slope, hdr + 112, 4);
+     memcpy(&scl_inter, hdr + 116, 4);
+     // a swapped header has sizeof_hdr in the other byte order.
+     if (sizeof_hdr != 348 || memcmp(hdr + 344, "n+1", 4) != 0) return false;
+     if ((scl_slope != 0 && scl_slope != 1) || scl_inter != 0) return false;
+     if (vox_offset < 348) return false;
+     offset = (size_t)vox_offset;
+     return true;
+}
+
+// offset of the voxels of a MetaImage with the data in the same file, if not
+// compressed and in native byte order.
+static bool mha_data_offset(FILE * fp, size_t & offset)
+{
+     char line[1024];
+     while (fgets(line, sizeof(line), fp)) {
+	  char key[256], value[768];
+	  if (sscanf(line, " %255[^= ] = %767[^\r\n]", key, value) != 2) continue;
+	  std::string k = key, v = value;
+	  while (!v.empty() && v[v.size() - 1] == ' ') v.erase(v.size() - 1);
+	  if (k == "CompressedData" && v != "False") return false;
+	  if ((k == "BinaryDataByteOrderMSB" || k == "ElementByteOrderMSB") && (v == "True") == little_endian()) return false;
+	  if (k == "HeaderSize" && v != "0") return false;
+	  if (k == "ElementDataFile") {
+	       if (v != "LOCAL") return false;
+	       long pos = ftell(fp);
+	       if (pos < 0) return false;
+	       offset = pos;
+	       return true;
+	  }
+     }
+     return false;
+}
+
+int map_volume_file(const std::string & filename, size_t n_bytes, size_t alignment, VolumeMapping & m)
+{
+     FILE * fp = fopen(filename.c_str(), "rb");
+     if (!fp) return 1;
+     size_t offset = 0;
+     bool raw = false;
+     if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".nii") == 0) {
+	  raw = nifti_data_offset(fp, offset);
+     }
+     else if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".mha") == 0) {
+	  raw = mha_data_offset(fp, offset);
+     }
+     fclose(fp);
+     if (!raw || (alignment > 0 && offset % alignment != 0)) return 1;
+
+     int fd = open(filename.c_str(), O_RDONLY);
+     if (fd < 0) return 1;
+     struct stat st;
+     if (fstat(fd, &st) != 0 || (size_t)st.st_size < offset + n_bytes || n_bytes == 0) {
+	  close(fd);
+	  return 1;
+     }
+     void * base = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+     close(fd);
+     if (base == MAP_FAILED) return 1;
+     m.base = base;
+     m.length = st.st_size;
+     m.data_offset = offset;
+     return 0;
+}
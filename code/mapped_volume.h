@@ -0,0 +1,154 @@
+#ifndef __MAPPED_VOLUME_H__
+#define __MAPPED_VOLUME_H__
+
+#include <cstdio>
+#include <string>
+#include <sys/mman.h>
+#include <common.h>
+#include <itkImportImageContainer.h>
+#include "volume_cache.h"
+
+// Zero-copy reads of uncompressed volumes. An uncompressed .nii or .mha whose
+// voxels are stored as the pixel type of the image, in native byte order and
+// without scaling, is mapped with mmap() and the image uses the mapped pages
+// as its buffer. Reading takes no time, pages are loaded when first used, and
+// jobs reading the same file share one copy in the page cache. The mapping is
+// private, so writing to the buffer copies the written pages and never
+// changes the file. A .nii.gz is mapped from its .nii in the volume cache
+// (volume_cache.h) when the cache is on. The voxels must be aligned to the component size, which
+// they are in a .nii, and in a .mha if the header length is a multiple of it.
+// Other files are read by ImageFileReader.
+
+// the mapping of a whole file, and the offset of its voxels.
+struct VolumeMapping
+{
+     void * base;
+     size_t length;
+     size_t data_offset;
+};
+
+// map the file if its header says the voxels are stored raw, and the file
+// holds n_bytes of voxels aligned to alignment bytes. Returns 0 on success.
+int map_volume_file(const std::string & filename, size_t n_bytes, size_t alignment, VolumeMapping & m);
+
+// pixel container that unmaps the file when the image is released.
+template <typename TElementIdentifier, typename TElement>
+class MappedImageContainer : public itk::ImportImageContainer<TElementIdentifier, TElement>
+{
+public:
+     typedef MappedImageContainer Self;
+     typedef itk::ImportImageContainer<TElementIdentifier, TElement> Superclass;
+     typedef itk::SmartPointer<Self> Pointer;
+
+     itkNewMacro(Self);
+     itkTypeMacro(MappedImageContainer, ImportImageContainer);
+
+     void SetMapping(const VolumeMapping & m, TElementIdentifier n_elements)
+     {
+	  m_Mapping = m;
+	  this->SetImportPointer((TElement *)((char *)m.base + m.data_offset), n_elements, false);
+     }
+
+protected:
+     MappedImageContainer() { m_Mapping.base = 0; }
+     ~MappedImageContainer()
+     {
+	  if (m_Mapping.base) munmap(m_Mapping.base, m_Mapping.length);
+     }
+
+private:
+     MappedImageContainer(const Self &);
+     void operator=(const Self &);
+
+     VolumeMapping m_Mapping;
+};
+
+// read a volume, mapped if possible. Throws the exceptions of
+// ImageFileReader.
+template <class TImage>
+typename TImage::Pointer read_volume_mapped(const std::string & in_file, unsigned short verbose = 0)
+{
+     typedef typename TImage::PixelType PixelType;
+     const unsigned dim = TImage::ImageDimension;
+     std::string filename = in_file;
+     bool owned = false;
+     if (in_file.size() > 7 && in_file.compare(in_file.size() - 7, 7, ".nii.gz") == 0) {
+	  std::string cached = volume_cache_get(in_file, owned, verbose);
+	  if (!cached.empty()) filename = cached;
+     }
+     const bool is_mha = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".mha") == 0;
+     const bool is_nii = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".nii") == 0;
+
+     itk::ImageIOBase::Pointer io;
+     if (is_mha || is_nii) {
+	  io = itk::ImageIOFactory::CreateImageIO(filename.c_str(), itk::ImageIOFactory::ReadMode);
+     }
+     bool mapped = false;
+     VolumeMapping m;
+     size_t n_pixels = 1;
+     if (!io.IsNull()) {
+	  io->SetFileName(filename);
+	  io->ReadImageInformation();
+	  // the component type of the pixel type.
+	  itk::ImageIOBase::Pointer want = itk::MetaImageIO::New();
+	  want->SetPixelTypeInfo(static_cast<const PixelType *>(0));
+	  // NIfTI stores the components of a vector as separate volumes.
+	  mapped = io->GetNumberOfDimensions() == dim
+	       && io->GetComponentType() == want->GetComponentType()
+	       && io->GetNumberOfComponents() == want->GetNumberOfComponents()
+	       && io->GetComponentSize() * io->GetNumberOfComponents() == sizeof(PixelType)
+	       && (is_mha || io->GetNumberOfComponents() == 1);
+	  if (mapped) {
+	       for (unsigned d = 0; d < dim; d ++) n_pixels *= io->GetDimensions(d);
+	       mapped = map_volume_file(filename, n_pixels * sizeof(PixelType), io->GetComponentSize(), m) == 0;
+	  }
+     }
+     if (!mapped) {
+	  typedef itk::ImageFileReader<TImage> ReaderType;
+	  typename ReaderType::Pointer reader = ReaderType::New();
+	  reader->SetFileName(filename);
+	  try
+	  {
+	       reader->Update();
+	  }
+	  catch( ... )
+	  {
+	       if (owned) remove(filename.c_str());
+	       throw;
+	  }
+	  if (owned) remove(filename.c_str());
+	  typename TImage::Pointer ptr = reader->GetOutput();
+	  ptr->DisconnectPipeline();
+	  return ptr;
+     }
+
+     typename TImage::Pointer ptr = TImage::New();
+     typename TImage::RegionType region;
+     typename TImage::SpacingType spacing;
+     typename TImage::PointType origin;
+     typename TImage::DirectionType direction;
+     for (unsigned d = 0; d < dim; d ++) {
+	  region.SetSize(d, io->GetDimensions(d));
+	  spacing[d] = io->GetSpacing(d);
+	  origin[d] = io->GetOrigin(d);
+	  std::vector<double> axis = io->GetDirection(d);
+	  for (unsigned r = 0; r < dim; r ++) direction[r][d] = axis[r];
+     }
+     ptr->SetRegions(region);
+     ptr->SetSpacing(spacing);
+     ptr->SetOrigin(origin);
+     ptr->SetDirection(direction);
+
+     typedef MappedImageContainer<typename TImage::PixelContainer::ElementIdentifier, PixelType> ContainerType;
+     typename ContainerType::Pointer container = ContainerType::New();
+     container->SetMapping(m, n_pixels);
+     ptr->SetPixelContainer(container);
+     // the mapping stays valid after the file is removed.
+     if (owned) remove(filename.c_str());
+     if (verbose >= 1) {
+	  printf("read_volume_mapped(): %s mapped.\n", filename.c_str());
+     }
+     return ptr;
+}
+
+#endif
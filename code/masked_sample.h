@@ -0,0 +1,200 @@
+#ifndef __MASKED_SAMPLE_H__
+#define __MASKED_SAMPLE_H__
+
+#include <vector>
+#include "itkSample.h"
+#include "itkImageRegionConstIterator.h"
+#include "rle_mask.h"
+
+// A read-only view of the voxels of a scalar image that fall inside a binary
+// mask, exposed as an itk::Statistics::Sample so the ITK statistics
+// components (EM estimator, mixture model components, mean/covariance
+// filters) can consume it in place. Only the buffer offset of each masked
+// voxel is stored (4 bytes per masked voxel). The measurement vectors are read
+// from the image buffer on the fly, so neither a ListSample copy nor a
+// full-size voxel-to-sample map is needed. The offsets are also used to write
+// the labels straight back into an output image with the same buffer layout.
+template <class TImage, class TMeasurementVector>
+class MaskedImageSample : public itk::Statistics::Sample<TMeasurementVector>
+{
+public:
+     typedef MaskedImageSample Self;
+     typedef itk::Statistics::Sample<TMeasurementVector> Superclass;
+     typedef itk::SmartPointer<Self> Pointer;
+     typedef itk::SmartPointer<const Self> ConstPointer;
+
+     itkTypeMacro(MaskedImageSample, Sample);
+     itkNewMacro(Self);
+
+     typedef TImage ImageType;
+     typedef typename ImageType::PixelType PixelType;
+     typedef typename Superclass::MeasurementVectorType MeasurementVectorType;
+     typedef typename Superclass::MeasurementType MeasurementType;
+     typedef typename Superclass::AbsoluteFrequencyType AbsoluteFrequencyType;
+     typedef typename Superclass::TotalAbsoluteFrequencyType TotalAbsoluteFrequencyType;
+     typedef typename Superclass::InstanceIdentifier InstanceIdentifier;
+     typedef typename Superclass::MeasurementVectorSizeType MeasurementVectorSizeType;
+
+     // buffer offsets of the masked voxels, in buffer order.
+     typedef std::vector<unsigned> OffsetContainerType;
+
+     // set the intensity image. Must be called before SetMask().
+     void SetImage(const ImageType * image)
+     {
+	  m_Image = image;
+	  m_Buffer = image->GetBufferPointer();
+	  this->Modified();
+     }
+
+     const ImageType * GetImage() const { return m_Image.GetPointer(); }
+
+     // collect the buffer offsets of the voxels with mask value > 0. The mask
+     // must have the same buffer layout as the image.
+     template <class TMaskImage>
+     void SetMask(const TMaskImage * mask)
+     {
+	  m_Offsets.clear();
+	  itk::ImageRegionConstIterator<TMaskImage> maskIt(mask, mask->GetLargestPossibleRegion());
+	  unsigned offset = 0;
+	  for (maskIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ offset) {
+	       if (maskIt.Get() > 0) {
+		    m_Offsets.push_back(offset);
+	       }
+	  }
+	  // release the slack from push_back.
+	  OffsetContainerType(m_Offsets).swap(m_Offsets);
+	  this->Modified();
+     }
+
+     // same as above, from the runs of a run-length mask, without visiting the
+     // background.
+     void SetMask(const RLEMask & mask)
+     {
+	  rle_offsets(mask, m_Offsets);
+	  this->Modified();
+     }
+
+     const OffsetContainerType & GetOffsets() const { return m_Offsets; }
+
+     InstanceIdentifier Size() const
+     {
+	  return m_Offsets.size();
+     }
+
+     const MeasurementVectorType & GetMeasurementVector(InstanceIdentifier id) const
+     {
+	  m_MeasurementVectorInternal[0] = static_cast<MeasurementType>(m_Buffer[m_Offsets[id]]);
+	  return m_MeasurementVectorInternal;
+     }
+
+     AbsoluteFrequencyType GetFrequency(InstanceIdentifier) const
+     {
+	  return 1;
+     }
+
+     TotalAbsoluteFrequencyType GetTotalFrequency() const
+     {
+	  return m_Offsets.size();
+     }
+
+     class ConstIterator
+     {
+	  friend class MaskedImageSample;
+     public:
+	  ConstIterator(const MaskedImageSample * sample)
+	  {
+	       *this = sample->Begin();
+	  }
+
+	  ConstIterator(const ConstIterator & iter)
+	  {
+	       m_Buffer = iter.m_Buffer;
+	       m_Offset = iter.m_Offset;
+	       m_InstanceIdentifier = iter.m_InstanceIdentifier;
+	  }
+
+	  ConstIterator & operator=(const ConstIterator & iter)
+	  {
+	       m_Buffer = iter.m_Buffer;
+	       m_Offset = iter.m_Offset;
+	       m_InstanceIdentifier = iter.m_InstanceIdentifier;
+	       return *this;
+	  }
+
+	  AbsoluteFrequencyType GetFrequency() const
+	  {
+	       return 1;
+	  }
+
+	  const MeasurementVectorType & GetMeasurementVector() const
+	  {
+	       m_MeasurementVectorCache[0] = static_cast<MeasurementType>(m_Buffer[*m_Offset]);
+	       return m_MeasurementVectorCache;
+	  }
+
+	  InstanceIdentifier GetInstanceIdentifier() const
+	  {
+	       return m_InstanceIdentifier;
+	  }
+
+	  ConstIterator & operator++()
+	  {
+	       ++ m_Offset;
+	       ++ m_InstanceIdentifier;
+	       return *this;
+	  }
+
+	  bool operator!=(const ConstIterator & it)
+	  {
+	       return m_Offset != it.m_Offset;
+	  }
+
+	  bool operator==(const ConstIterator & it)
+	  {
+	       return m_Offset == it.m_Offset;
+	  }
+
+     protected:
+	  ConstIterator(const PixelType * buffer, const unsigned * offset, InstanceIdentifier id)
+	       : m_Buffer(buffer), m_Offset(offset), m_InstanceIdentifier(id)
+	  {
+	  }
+
+     private:
+	  ConstIterator();
+	  const PixelType * m_Buffer;
+	  const unsigned * m_Offset;
+	  InstanceIdentifier m_InstanceIdentifier;
+	  mutable MeasurementVectorType m_MeasurementVectorCache;
+     };
+
+     ConstIterator Begin() const
+     {
+	  ConstIterator iter(m_Buffer, m_Offsets.empty()? 0 : &m_Offsets[0], 0);
+	  return iter;
+     }
+
+     ConstIterator End() const
+     {
+	  ConstIterator iter(m_Buffer, m_Offsets.empty()? 0 : &m_Offsets[0] + m_Offsets.size(), m_Offsets.size());
+	  return iter;
+     }
+
+protected:
+     MaskedImageSample() : m_Buffer(0)
+     {
+	  this->SetMeasurementVectorSize(1);
+     }
+     virtual ~MaskedImageSample() {}
+
+private:
+     MaskedImageSample(const Self &); // purposely not implemented
+     void operator=(const Self &);    // purposely not implemented
+
+     typename ImageType::ConstPointer m_Image;
+     const PixelType * m_Buffer;
+     OffsetContainerType m_Offsets;
+     mutable MeasurementVectorType m_MeasurementVectorInternal;
+};
+
+#endif
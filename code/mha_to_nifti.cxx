@@ -1,10 +1,63 @@
 #include <common.h>
 #include <utility.h>
+#include <algorithm>
+#include "mapped_volume.h"
+
+// voxels per block of the transpose. The input of a block stays in the L1
+// cache while each of its three components is written.
+#define TRANSPOSE_BLOCK 1024
+
+// write the vector volume as a 4D volume with one 3D plane per component. The
+// input is read mapped when it is uncompressed, so it is loaded slab by slab
+// as the threads go through it, and each thread transposes blocks of voxels
+// straight into the output buffer.
+template <class TInImage, class TOutImage>
+static int convert(const std::string & input_file, const std::string & output_file, unsigned short verbose)
+{
+     typedef typename TOutImage::PixelType OutPixelType;
+     typename TInImage::Pointer inPtr = read_volume_mapped<TInImage>(input_file, verbose);
+
+     typename TOutImage::Pointer outPtr = TOutImage::New();
+     typename TOutImage::IndexType outIdx;
+     outIdx.Fill(0);
+     typename TOutImage::SizeType outSize;
+     typename TInImage::SizeType inSize = inPtr->GetLargestPossibleRegion().GetSize();
+     
+     outSize[0] = inSize[0];
+     outSize[1] = inSize[1];
+     outSize[2] = inSize[2];
+     outSize[3] = 3;
+     typename TOutImage::RegionType outRegion;
+     outRegion.SetIndex(outIdx);
+     outRegion.SetSize(outSize);
+     outPtr->SetRegions(outRegion);
+     outPtr->Allocate();
+
+     const typename TInImage::PixelType * in = inPtr->GetBufferPointer();
+     OutPixelType * out = outPtr->GetBufferPointer();
+     const long slab = (long)inSize[0] * inSize[1];
+     const long n_voxels = slab * inSize[2];
+#pragma omp parallel for schedule(static)
+     for (long z = 0; z < (long)inSize[2]; z ++) {
+	  for (long b = z * slab; b < (z + 1) * slab; b += TRANSPOSE_BLOCK) {
+	       const long e = std::min(b + TRANSPOSE_BLOCK, (z + 1) * slab);
+	       for (unsigned c = 0; c < 3; c ++) {
+		    OutPixelType * plane = out + c * n_voxels;
+		    for (long i = b; i < e; i ++) {
+			 plane[i] = in[i][c];
+		    }
+	       }
+	  }
+     }
+
+     return save_volume(outPtr, output_file);
+}
+
 namespace po = boost::program_options;
 
 int main( int argc, char* argv[] )
 {
-     std::string input_file, output_file;
+     std::string input_file, output_file, precision;
      unsigned short verbose = 0;
      po::options_description mydesc("Options can only used at commandline");
      mydesc.add_options()
@@ -13,6 +66,8 @@ int main( int argc, char* argv[] )
 	   "Input file name. Must be mha format.")
 	  ("output,o", po::value<std::string>(&output_file)->default_value("output.nii.gz"), 
 	   "output file. Usually be nii.gz format.")
+	  ("precision,p", po::value<std::string>(&precision)->default_value("double"), 
+	   "precision of the output, double or float.")
 	  ("verbose,v", po::value<unsigned short>(&verbose)->default_value(0), 
 	   "verbose level. 0 for minimal output. 3 for most output.");
 
@@ -32,42 +87,12 @@ int main( int argc, char* argv[] )
 	  return 1;
      }    
 
-     // read original gray intensity image.
-     ReaderTypeArray3D::Pointer inReader = ReaderTypeArray3D::New();
-     inReader->SetFileName(input_file);
-     inReader->Update();
-     ImageTypeArray3D::Pointer inPtr = inReader->GetOutput();
-
-     ImageType4D::Pointer outPtr = ImageType4D::New();
-     ImageType4D::IndexType outIdx;
-     outIdx.Fill(0);
-     ImageType4D::SizeType outSize;
-     ImageTypeArray3D::SizeType inSize = inPtr->GetLargestPossibleRegion().GetSize();
-     
-     outSize[0] = inSize[0];
-     outSize[1] = inSize[1];
-     outSize[2] = inSize[2];
-     outSize[3] = 3;
-     ImageType4D::RegionType outRegion;
-     outRegion.SetIndex(outIdx);
-     outRegion.SetSize(outSize);
-     outPtr->SetRegions(outRegion);
-     outPtr->Allocate();
-     outPtr->FillBuffer(0);
-
-     itk::ImageRegionIterator<ImageTypeArray3D> inIt(inPtr, inPtr->GetLargestPossibleRegion());
-
-     ImageTypeArray3D::IndexType inIdx;
-     for (inIt.GoToBegin(); !inIt.IsAtEnd(); ++ inIt) {     
-	  inIdx = inIt.GetIndex();
-	  outIdx[0] = inIdx[0];
-	  outIdx[1] = inIdx[1];
-	  outIdx[2] = inIdx[2];
-	  for (outIdx[3] = 0; outIdx[3] < 3; outIdx[3] ++) {
-	       outPtr->SetPixel(outIdx, inIt.Get()[outIdx[3]]);
-	  }
+     if (precision == "double") {
+	  return convert<ImageTypeArray3D, ImageType4D>(input_file, output_file, verbose);
      }
-
-     save_volume(outPtr, output_file);
-
+     else if (precision == "float") {
+	  return convert<ImageTypeArray3F, ImageType4F>(input_file, output_file, verbose);
+     }
+     std::cout << "mha_to_nifti(): precision must be double or float.\n";
+     return 1;
 }
@@ -0,0 +1,72 @@
+#include <cstdio>
+#include "mrf.h"
+
+int mrf_icm(const FeatureSet & fs,
+	    const std::vector<float> & logp,
+	    unsigned n_comp,
+	    const unsigned size[3],
+	    double beta,
+	    unsigned maxit,
+	    unsigned * labelBuffer,
+	    unsigned short verbose)
+{
+     const long n_samples = fs.offsets.size();
+     const unsigned K = n_comp;
+     const long nx = size[0], nxy = (long)size[0] * size[1];
+
+     if ((long)logp.size() != n_samples * K) {
+	  printf("mrf_icm(): size of logp does not match number of samples.\n");
+	  return 1;
+     }
+     if (K > 255) {
+	  printf("mrf_icm(): too many components.\n");
+	  return 1;
+     }
+
+     for (unsigned it = 0; it < maxit; it ++) {
+	  long n_changed = 0;
+	  for (unsigned color = 0; color < 2; color ++) {
+#pragma omp parallel for schedule(static) reduction(+:n_changed)
+	       for (long i = 0; i < n_samples; i ++) {
+		    const long o = fs.offsets[i];
+		    const long x = o % nx, y = (o / nx) % size[1], z = o / nxy;
+		    if (((x + y + z) & 1) != (long)color) continue;
+
+		    // count the neighbors of each label. Label 0 is outside
+		    // the mask and does not contribute.
+		    unsigned n_nbrs[256] = {0};
+		    unsigned n_in_mask = 0;
+		    if (x > 0) n_nbrs[labelBuffer[o - 1]] ++;
+		    if (x < nx - 1) n_nbrs[labelBuffer[o + 1]] ++;
+		    if (y > 0) n_nbrs[labelBuffer[o - nx]] ++;
+		    if (y < (long)size[1] - 1) n_nbrs[labelBuffer[o + nx]] ++;
+		    if (z > 0) n_nbrs[labelBuffer[o - nxy]] ++;
+		    if (z < (long)size[2] - 1) n_nbrs[labelBuffer[o + nxy]] ++;
+		    for (unsigned k = 1; k <= K; k ++) {
+			 n_in_mask += n_nbrs[k];
+		    }
+
+		    const float * lp = &logp[i * K];
+		    unsigned best_k = 0;
+		    double best_energy = 0, energy = 0;
+		    for (unsigned k = 0; k < K; k ++) {
+			 energy = - lp[k] + beta * (n_in_mask - n_nbrs[k + 1]);
+			 if (k == 0 || energy < best_energy) {
+			      best_energy = energy;
+			      best_k = k;
+			 }
+		    }
+		    if (labelBuffer[o] != best_k + 1) {
+			 labelBuffer[o] = best_k + 1;
+			 n_changed ++;
+		    }
+	       }
+	  } // color
+
+	  if (verbose >= 1) {
+	       printf("mrf_icm(), sweep %i, %li labels changed.\n", it, n_changed);
+	  }
+	  if (n_changed == 0) break;
+     }
+     return 0;
+}
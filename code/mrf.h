@@ -0,0 +1,25 @@
+#ifndef __MRF_H__
+#define __MRF_H__
+
+#include "gmm_em.h"
+
+// Smooth a GMM label map with a Potts MRF prior by iterated conditional modes
+// (ICM). The energy of label k at a voxel is -logp(k) + beta * (number of
+// 6-neighbors in the mask with a label other than k). Voxels are updated in a
+// red-black checkerboard order: voxels of the same color are not neighbors,
+// so all voxels of one color are updated in parallel.
+//
+// fs gives the buffer offsets of the voxels in the mask, logp is the output of
+// gmm_log_density(), size is the volume size, and labelBuffer holds the labels
+// (k+1 in the mask, 0 outside) and is updated in place. Stops after maxit
+// sweeps, or when no label changes.
+int mrf_icm(const FeatureSet & fs,
+	    const std::vector<float> & logp,
+	    unsigned n_comp,
+	    const unsigned size[3],
+	    double beta,
+	    unsigned maxit,
+	    unsigned * labelBuffer,
+	    unsigned short verbose);
+
+#endif
@@ -1,16 +1,12 @@
 #include <common.h>
 #include <utility.h>
-#include "itkImageFileReader.h"
-#include "itkImageFileWriter.h"
-#include "itkHessianToObjectnessMeasureImageFilter.h"
-#include "itkMultiScaleHessianBasedMeasureImageFilter.h"
-#include "itkRescaleIntensityImageFilter.h"
+#include "result_cache.h"
+#include "hessian_eigenvector.h"
 
 namespace po = boost::program_options;
 
 int main( int argc, char* argv[] )
 {
-     const unsigned int Dimension = 3;
      std::string inputFileName, outputFileName, scalemapFileName;
      double sigmaMinimum = 1.0;
      double sigmaMaximum = 10.0;
@@ -60,67 +56,45 @@ int main( int argc, char* argv[] )
 	  return 1;
      }    
 
-  typedef double                              PixelType;
-  typedef itk::Image< PixelType, Dimension > ImageType;
-
-  typedef itk::ImageFileReader< ImageType >  ReaderType;
-  ReaderType::Pointer reader = ReaderType::New();
-  reader->SetFileName( inputFileName );
-
-  typedef itk::SymmetricSecondRankTensor< double, Dimension > HessianPixelType;
-  typedef itk::Image< HessianPixelType, Dimension >           HessianImageType;
-  typedef itk::HessianToObjectnessMeasureImageFilter< HessianImageType, ImageType >
-    ObjectnessFilterType;
-  ObjectnessFilterType::Pointer objectnessFilter = ObjectnessFilterType::New();
-  objectnessFilter->SetBrightObject( true );
-  objectnessFilter->SetScaleObjectnessMeasure( true );
-  objectnessFilter->SetAlpha( alpha );
-  objectnessFilter->SetBeta( beta );
-  objectnessFilter->SetGamma( gamma );
-
-  // debug.
-  std::cout << "objectnessFilter's object dimension: " << objectnessFilter->GetObjectDimension() << std::endl;
-
-  typedef itk::MultiScaleHessianBasedMeasureImageFilter< ImageType, HessianImageType, ImageType >
-    MultiScaleEnhancementFilterType;
-  MultiScaleEnhancementFilterType::Pointer multiScaleEnhancementFilter =
-    MultiScaleEnhancementFilterType::New();
-  multiScaleEnhancementFilter->SetInput( reader->GetOutput() );
-  multiScaleEnhancementFilter->SetHessianToMeasureFilter( objectnessFilter );
-  multiScaleEnhancementFilter->SetSigmaStepMethodToLogarithmic();
-  multiScaleEnhancementFilter->SetSigmaMinimum( sigmaMinimum );
-  multiScaleEnhancementFilter->SetSigmaMaximum( sigmaMaximum );
-  multiScaleEnhancementFilter->SetNumberOfSigmaSteps( numberOfSigmaSteps );
-  multiScaleEnhancementFilter->SetNonNegativeHessianBasedMeasure(true);
-
-  multiScaleEnhancementFilter->SetGenerateScalesOutput(true);
-  multiScaleEnhancementFilter->SetGenerateHessianOutput(true);
-  
-  typedef itk::RescaleIntensityImageFilter< ImageType, ImageType3DUC >  RescaleFilterType;
-  RescaleFilterType::Pointer rescaleFilter = RescaleFilterType::New();
-  rescaleFilter->SetInput( multiScaleEnhancementFilter->GetOutput() );
-  
-  // save_volume(rescaleFilter->GetOutput(), outputFileName);
-
-  multiScaleEnhancementFilter->Update();
-  save_volume(multiScaleEnhancementFilter->GetOutput(), outputFileName);
-
-  // also save the scale map. 
-  WriterType3DF::Pointer scale_writer = WriterType3DF::New();
-  scale_writer->SetInput( multiScaleEnhancementFilter->GetScalesOutput() );
-  scale_writer->SetFileName( scalemapFileName);
-
-  try
-  {
-       scale_writer->Update();
-  }
-  catch( itk::ExceptionObject & error )
-  {
-       std::cerr << "Error: " << error << std::endl;
-       return EXIT_FAILURE;
-  }
-  std::cout << "multilescae_hessian(): file " << scalemapFileName << " saved. " << std::endl; 
+     // reuse the outputs of an earlier run with the same inputs and options.
+     const char * cache_inputs[] = {"input"};
+     const char * cache_outputs[] = {"output", "scalemap"};
+     ResultCache rc;
+     if (result_cache_restore(rc, "multiscale_hessian", vm, std::vector<std::string>(cache_inputs, cache_inputs + 1), std::vector<std::string>(cache_outputs, cache_outputs + 2), std::vector<std::string>(), verbose)) {
+	  return 0;
+     }
 
+     ReaderType3D::Pointer reader = ReaderType3D::New();
+     reader->SetFileName(inputFileName);
+     reader->Update();
+
+     HessianPar par;
+     par.alpha = alpha;
+     par.beta = beta;
+     par.gamma = gamma;
+     par.bright_object = true;
+     par.scale_objectness = true;
+     par.sigma_min = sigmaMinimum;
+     par.sigma_max = sigmaMaximum;
+     par.steps = numberOfSigmaSteps;
+     par.verbose = verbose;
+     ImageType3D::Pointer vesselnessPtr;
+     ImageType3DF::Pointer scalePtr;
+     try
+     {
+	  multiscale_objectness(reader->GetOutput(), par, vesselnessPtr, scalePtr);
+     }
+     catch( itk::ExceptionObject & error )
+     {
+	  std::cerr << "Error: " << error << std::endl;
+	  return EXIT_FAILURE;
+     }
+     save_volume(vesselnessPtr, outputFileName);
+     save_volume(scalePtr, scalemapFileName);
 
-  // return EXIT_SUCCESS;
+     if (save_volume_flush() > 0) {
+	  return 1;
+     }
+     result_cache_store(rc, verbose);
+     return 0;
 }
@@ -7,12 +7,14 @@
 #include "hessian_eigenvector.h"
 #include "itkHessianToObjectnessMeasureImageFilter.h"
 #include "itkJoinSeriesImageFilter.h"
+#include "roi.h"
 
 namespace po = boost::program_options;
 
 int main( int argc, char* argv[] )
 {
-     std::string input_file, vesselness_file, eigenvector_file, mask_file, scalemapFileName;
+     std::string input_file, vesselness_file, eigenvector_file, mask_file, scalemapFileName, roi_mode;
+     unsigned margin = 10;
      HessianPar par;
      po::options_description mydesc("Options can only used at commandline");
      mydesc.add_options()
@@ -28,6 +30,11 @@ int main( int argc, char* argv[] )
 	  ("scalemap,c", po::value<std::string>(&scalemapFileName)->default_value("scale_map.nii.gz"), 
 	   "scale map file name.")
 
+	  ("roi", po::value<std::string>(&roi_mode)->default_value("full"),
+	   "full: filter the full volume. auto: filter the bounding box of the mask grown by the margin, and write 0 outside it. The margin is at least 3 times the max sigma, so the Hessian inside the mask does not see the crop.")
+	  ("margin", po::value<unsigned>(&margin)->default_value(10),
+	   "Margin of the ROI in voxels, with --roi auto.")
+
 	  ("min,n", po::value<double>(&par.sigma_min)->default_value(1), 
 	   "Minimal sigma")
 	  ("max,x", po::value<double>(&par.sigma_max)->default_value(10), 
@@ -78,6 +85,20 @@ int main( int argc, char* argv[] )
      maskReader->Update();
      ImageType3UC::Pointer maskPtr = maskReader->GetOutput();
 
+     // the recursive Gaussian of the largest scale reaches about 3 sigma
+     // (in physical units) into the volume.
+     ImageType3F::SpacingType spacing = inPtr->GetSpacing();
+     double min_spacing = std::min(spacing[0], std::min(spacing[1], spacing[2]));
+     margin = std::max(margin, (unsigned)ceil(3 * par.sigma_max / min_spacing));
+     RLEMask mask;
+     rle_from_image(maskPtr.GetPointer(), mask);
+     VolumeROI roi;
+     if (roi_init(roi, roi_mode, inPtr.GetPointer(), mask, margin, par.verbose)) {
+	  return 1;
+     }
+     inPtr = roi_crop(roi, inPtr);
+     maskPtr = roi_crop(roi, maskPtr);
+
      // Create vesselness image buffer.
      ImageType3F::Pointer vesselnessPtr = ImageType3F::New();
      vesselnessPtr->SetRegions(inPtr->GetLargestPossibleRegion() );
@@ -114,9 +135,9 @@ int main( int argc, char* argv[] )
 			eigenvectorPtr,
 			maskPtr,
 			par);
-     save_volume(vesselnessPtr, vesselness_file);
-     save_volume(scalePtr, scalemapFileName);
-     save_volume(eigenvectorPtr, eigenvector_file);
+     save_volume(roi_paste(roi, vesselnessPtr, 0), vesselness_file);
+     save_volume(roi_paste(roi, scalePtr, 0), scalemapFileName);
+     save_volume(roi_paste(roi, eigenvectorPtr, itk::NumericTraits< ImageTypeArray3F::PixelType >::Zero), eigenvector_file);
      return 0;
 }
 
@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+#include <itkVersion.h>
+#include "pgzip.h"
+#include "volume_cache.h"
+#include "nifti_gz_io.h"
+
+static bool ends_with(const std::string & s, const std::string & suffix)
+{
+     return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+NiftiGzImageIO::~NiftiGzImageIO()
+{
+     remove_tmp();
+}
+
+bool NiftiGzImageIO::CanReadFile(const char * filename)
+{
+     return filename && ends_with(filename, ".nii.gz") && Superclass::CanReadFile(filename);
+}
+
+void NiftiGzImageIO::remove_tmp()
+{
+     if (!m_TmpFile.empty() && m_Owned) remove(m_TmpFile.c_str());
+     m_TmpFile.clear();
+     m_GzFile.clear();
+}
+
+// the file of ReadImageInformation() is reused by Read(), unless it is gone
+// meanwhile.
+void NiftiGzImageIO::inflate(const std::string & gz_file)
+{
+     if (!m_TmpFile.empty() && gz_file == m_GzFile && access(m_TmpFile.c_str(), R_OK) == 0) return;
+     remove_tmp();
+     m_GzFile = gz_file;
+     m_TmpFile = volume_cache_get(gz_file, m_Owned);
+     if (!m_TmpFile.empty()) return;
+
+     const char * dir = getenv("TMPDIR");
+     std::string name = std::string(dir && *dir? dir : "/tmp") + "/nifti_gz_XXXXXX.nii";
+     std::vector<char> tmp(name.begin(), name.end());
+     tmp.push_back(0);
+     int fd = mkstemps(&tmp[0], 4);
+     if (fd < 0) {
+	  itkExceptionMacro(<< "Cannot create a temporary file for " << gz_file);
+     }
+     m_TmpFile = &tmp[0];
+     m_Owned = true;
+     int err = pgzip_decompress_file(gz_file, fd);
+     if (close(fd) != 0) err = 1;
+     if (err) {
+	  remove_tmp();
+	  itkExceptionMacro(<< "Cannot decompress " << gz_file);
+     }
+}
+
+void NiftiGzImageIO::ReadImageInformation()
+{
+     const std::string gz_file = this->GetFileName();
+     inflate(gz_file);
+     this->SetFileName(m_TmpFile);
+     try
+     {
+	  Superclass::ReadImageInformation();
+     }
+     catch( ... )
+     {
+	  this->SetFileName(gz_file);
+	  remove_tmp();
+	  throw;
+     }
+     this->SetFileName(gz_file);
+}
+
+// the temporary file is removed after the data is read.
+void NiftiGzImageIO::Read(void * buffer)
+{
+     const std::string gz_file = this->GetFileName();
+     inflate(gz_file);
+     this->SetFileName(m_TmpFile);
+     try
+     {
+	  Superclass::Read(buffer);
+     }
+     catch( ... )
+     {
+	  this->SetFileName(gz_file);
+	  remove_tmp();
+	  throw;
+     }
+     this->SetFileName(gz_file);
+     remove_tmp();
+}
+
+NiftiGzImageIOFactory::NiftiGzImageIOFactory()
+{
+     this->RegisterOverride("itkImageIOBase", "NiftiGzImageIO", "Parallel .nii.gz reader", 1, itk::CreateObjectFunction<NiftiGzImageIO>::New());
+}
+
+const char * NiftiGzImageIOFactory::GetITKSourceVersion() const
+{
+     return ITK_SOURCE_VERSION;
+}
+
+const char * NiftiGzImageIOFactory::GetDescription() const
+{
+     return "Parallel .nii.gz reader";
+}
+
+void nifti_gz_io_register()
+{
+     static bool registered = false;
+     if (registered) return;
+     registered = true;
+     itk::ObjectFactoryBase::RegisterFactory(NiftiGzImageIOFactory::New(), itk::ObjectFactoryBase::INSERT_AT_FRONT);
+}
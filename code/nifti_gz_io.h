@@ -0,0 +1,72 @@
+#ifndef __NIFTI_GZ_IO_H__
+#define __NIFTI_GZ_IO_H__
+
+#include <string>
+#include <itkNiftiImageIO.h>
+#include <itkObjectFactoryBase.h>
+
+// NIfTI reader of .nii.gz that inflates the file in parallel with
+// pgzip_decompress_file() into a temporary .nii, read by NiftiImageIO and
+// removed after the read. With the volume cache on (volume_cache.h), the
+// .nii of the cache is read instead, through a link that pins it until the
+// read is done. The factory is registered in front of the ITK
+// factories by common.h, so all the readers of common.h use it. Other files
+// and all writes go to the ITK image IOs.
+class NiftiGzImageIO : public itk::NiftiImageIO
+{
+public:
+     typedef NiftiGzImageIO Self;
+     typedef itk::NiftiImageIO Superclass;
+     typedef itk::SmartPointer<Self> Pointer;
+
+     itkNewMacro(Self);
+     itkTypeMacro(NiftiGzImageIO, NiftiImageIO);
+
+     virtual bool CanReadFile(const char * filename);
+     virtual bool CanWriteFile(const char *) { return false; }
+     virtual void ReadImageInformation();
+     virtual void Read(void * buffer);
+
+protected:
+     NiftiGzImageIO() : m_Owned(false) {}
+     ~NiftiGzImageIO();
+
+private:
+     NiftiGzImageIO(const Self &);
+     void operator=(const Self &);
+
+     // inflate the .nii.gz to m_TmpFile unless already done.
+     void inflate(const std::string & gz_file);
+     void remove_tmp();
+
+     std::string m_GzFile;
+     std::string m_TmpFile;
+     bool m_Owned; // m_TmpFile is removed after use.
+};
+
+class NiftiGzImageIOFactory : public itk::ObjectFactoryBase
+{
+public:
+     typedef NiftiGzImageIOFactory Self;
+     typedef itk::ObjectFactoryBase Superclass;
+     typedef itk::SmartPointer<Self> Pointer;
+
+     virtual const char * GetITKSourceVersion() const;
+     virtual const char * GetDescription() const;
+
+     itkFactorylessNewMacro(Self);
+     itkTypeMacro(NiftiGzImageIOFactory, ObjectFactoryBase);
+
+protected:
+     NiftiGzImageIOFactory();
+
+private:
+     NiftiGzImageIOFactory(const Self &);
+     void operator=(const Self &);
+};
+
+// register NiftiGzImageIOFactory in front of the other image IO factories.
+// Calls after the first do nothing.
+void nifti_gz_io_register();
+
+#endif
@@ -0,0 +1,88 @@
+#include <vector>
+#include "path_vote.h"
+
+unsigned vote_paths(FloatGradientImage::Pointer gradPtr,
+		    ImageType3UC::Pointer seedPtr,
+		    const RLEMask & end_points,
+		    ImageType3U::Pointer votemapPtr,
+		    unsigned short verbose)
+{
+     FloatGradientImage::PixelType grad;
+     ImageType3UC::IndexType curIdx;
+     const ImageType3UC::RegionType region = seedPtr->GetLargestPossibleRegion();
+
+     std::vector<itk::Offset<3> > neighbor_offsets(6);
+     neighbor_offsets[0].Fill(0);
+     neighbor_offsets[0][0] = -1; // {-1, 0, 0}
+
+     neighbor_offsets[1].Fill(0);
+     neighbor_offsets[1][0] = 1; // {1, 0, 0}
+
+     neighbor_offsets[2].Fill(0);
+     neighbor_offsets[2][1] = -1; // {0, -1, 0}
+
+     neighbor_offsets[3].Fill(0);
+     neighbor_offsets[3][1] = 1; // {0, 1, 0}
+
+     neighbor_offsets[4].Fill(0);
+     neighbor_offsets[4][2] = -1; // {0, 0, -1}
+
+     neighbor_offsets[5].Fill(0);
+     neighbor_offsets[5][2] = 1; // {0, 0, 1}
+
+     unsigned best_offset_id = 0, n_left = 0;
+     double best_cos_value = 1, cur_cos_value = 0; // cosine angle btw gradient and offset vector.x
+     std::vector<ImageType3UC::IndexType> points;
+     ImageType3UC::IndexType idx;
+     for (long r = 0; r < end_points.n_rows(); r ++) {
+	  idx[1] = r % end_points.size[1];
+	  idx[2] = r / end_points.size[1];
+	  for (size_t k = end_points.row_start[r]; k < end_points.row_start[r + 1]; k ++) {
+	       for (idx[0] = end_points.runs[k].x0; idx[0] < end_points.runs[k].x1; idx[0] ++) {
+		    points.push_back(idx);
+	       }
+	  }
+     }
+     for (unsigned n = 0; n < points.size(); n ++) {
+	  // working on this end point.
+	  curIdx = points[n];
+	  if (verbose >= 2) {
+	       std::cout << "working on: " << curIdx << std::endl;
+	  }
+
+	  // some end points are not reached by the FMM front end,
+	  // hence has zero gradient. Ignore them.
+	  grad = gradPtr->GetPixel(curIdx);
+	  while(seedPtr->GetPixel(curIdx) == 0 && grad.GetNorm() > 0) {
+	       grad = grad / grad.GetNorm(); // normalize to unit vector.
+
+	       // compute the offsets that match the gradient best.
+	       best_offset_id = 0;
+	       best_cos_value = 1; // a worse value so anyone can beat it.
+	       for (unsigned s = 0; s < neighbor_offsets.size(); s ++) {
+		    cur_cos_value = grad[0] * neighbor_offsets[s][0]
+			 + grad[1] * neighbor_offsets[s][1]
+			 + grad[2] * neighbor_offsets[s][2];
+		    if (cur_cos_value < best_cos_value) {
+			 best_cos_value = cur_cos_value;
+			 best_offset_id = s;
+		    }
+	       } // for
+
+	       // move to the new voxel.
+	       curIdx = curIdx + neighbor_offsets[best_offset_id];
+	       if (!region.IsInside(curIdx)) {
+		    n_left ++;
+		    break;
+	       }
+	       votemapPtr->SetPixel(curIdx, votemapPtr->GetPixel(curIdx) + 1);
+	       grad = gradPtr->GetPixel(curIdx);
+	  }
+
+	  if (grad.GetNorm() == 0 && verbose >= 3) {
+	       std::cout << curIdx << "norm is zero.\n";
+	  }
+
+     } // n
+     return n_left;
+}
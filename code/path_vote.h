@@ -0,0 +1,22 @@
+#ifndef __PATH_VOTE_H__
+#define __PATH_VOTE_H__
+
+#include <common.h>
+#include <itkFastMarchingUpwindGradientImageFilterBase.h>
+#include "rle_mask.h"
+
+typedef itk::FastMarchingUpwindGradientImageFilterBase< ImageType3F, ImageType3F >::GradientImageType FloatGradientImage;
+
+// minimal path voting of find_path. From each voxel of the end points (e.g.
+// the contour of the lung), walk down the gradient of the time of arrival of
+// fmm_upwind, one face neighbor at a time, until a seed voxel (nonzero) or a
+// voxel not reached by the front (zero gradient), and add one to votemap at
+// each voxel of the path. The volumes must have the same size; votemapPtr is
+// added to, not cleared. Returns the number of paths that left the volume.
+unsigned vote_paths(FloatGradientImage::Pointer gradPtr,
+		    ImageType3UC::Pointer seedPtr,
+		    const RLEMask & end_points,
+		    ImageType3U::Pointer votemapPtr,
+		    unsigned short verbose = 0);
+
+#endif
@@ -0,0 +1,462 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "itk_zlib.h"
+#include "pgzip.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define WINDOW 32768
+
+typedef unsigned long long uint64;
+
+// offset of the 4-byte member size in a member header written below: 10 bytes
+// of fixed header, 2 bytes XLEN, then the subfield id and length.
+#define SIZE_OFFSET 16
+
+static int n_threads()
+{
+#ifdef _OPENMP
+     return omp_get_max_threads();
+#else
+     return 1;
+#endif
+}
+
+static void put32(unsigned char * p, unsigned v)
+{
+     p[0] = v;
+     p[1] = v >> 8;
+     p[2] = v >> 16;
+     p[3] = v >> 24;
+}
+
+static unsigned get32(const unsigned char * p)
+{
+     return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+// compress len bytes into one gzip member with its size in the header.
+static int gzip_member(const unsigned char * src, size_t len, std::vector<unsigned char> & dst)
+{
+     z_stream zs;
+     memset(&zs, 0, sizeof(zs));
+     if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+	  return 1;
+     }
+     unsigned char extra[8] = {'V', 'B', 4, 0, 0, 0, 0, 0};
+     gz_header head;
+     memset(&head, 0, sizeof(head));
+     head.extra = extra;
+     head.extra_len = sizeof(extra);
+     head.os = 3;
+     deflateSetHeader(&zs, &head);
+     dst.resize(deflateBound(&zs, len) + sizeof(extra) + 2);
+     zs.next_in = (Bytef *)src;
+     zs.avail_in = len;
+     zs.next_out = &dst[0];
+     zs.avail_out = dst.size();
+     int ret = deflate(&zs, Z_FINISH);
+     dst.resize(zs.total_out);
+     deflateEnd(&zs);
+     if (ret != Z_STREAM_END) return 1;
+     put32(&dst[SIZE_OFFSET], dst.size());
+     return 0;
+}
+
+int pgzip_compress_file(const std::string & src, const std::string & dst)
+{
+     FILE * in = fopen(src.c_str(), "rb");
+     if (!in) return 1;
+     FILE * out = fopen(dst.c_str(), "wb");
+     if (!out) {
+	  fclose(in);
+	  return 1;
+     }
+     // a batch of blocks is read, compressed in parallel and written in
+     // order, so the memory does not depend on the file size.
+     const int batch = 4 * n_threads();
+     std::vector<unsigned char> data((size_t)batch * PGZ_BLOCK);
+     std::vector<std::vector<unsigned char> > packed(batch);
+     int err = 0;
+     size_t n_read = 0, total = 0;
+     while (err == 0 && (n_read = fread(&data[0], 1, data.size(), in)) > 0) {
+	  total += n_read;
+	  const long n_blocks = (n_read + PGZ_BLOCK - 1) / PGZ_BLOCK;
+#pragma omp parallel for schedule(dynamic) reduction(+:err)
+	  for (long b = 0; b < n_blocks; b ++) {
+	       size_t len = std::min((size_t)PGZ_BLOCK, n_read - (size_t)b * PGZ_BLOCK);
+	       err += gzip_member(&data[(size_t)b * PGZ_BLOCK], len, packed[b]);
+	  }
+	  for (long b = 0; b < n_blocks && err == 0; b ++) {
+	       if (fwrite(&packed[b][0], 1, packed[b].size(), out) != packed[b].size()) err = 1;
+	  }
+     }
+     if (ferror(in)) err = 1;
+     // an empty file is one empty member, as a 0-byte file is not gzip.
+     if (err == 0 && total == 0) {
+	  err = gzip_member(&data[0], 0, packed[0]);
+	  if (err == 0 && fwrite(&packed[0][0], 1, packed[0].size(), out) != packed[0].size()) err = 1;
+     }
+     fclose(in);
+     if (fclose(out) != 0) err = 1;
+     return err;
+}
+
+// a piece of the output inflated on its own: from the start of the file or a
+// member, or from an access point in the middle of a deflate stream.
+struct GzChunk
+{
+     uint64 in; // offset in the compressed data.
+     uint64 out; // offset in the output.
+     uint64 out_len;
+     int bits; // access point only: bits of the byte before in still to read.
+     bool raw; // access point: raw deflate, primed with bits and window.
+     const unsigned char * window;
+};
+
+// access points of the index.
+struct GzPoint
+{
+     uint64 in;
+     uint64 out;
+     int bits;
+     std::vector<unsigned char> window;
+};
+
+struct GzIndex
+{
+     uint64 gz_size;
+     uint64 gz_ino;
+     long long gz_mtime; // in nanoseconds.
+     uint64 out_size;
+     std::vector<GzPoint> points;
+};
+
+static bool write_all(int fd, const unsigned char * p, size_t n, uint64 offset)
+{
+     while (n > 0) {
+	  ssize_t w = pwrite(fd, p, n, offset);
+	  if (w <= 0) return false;
+	  p += w;
+	  n -= w;
+	  offset += w;
+     }
+     return true;
+}
+
+// the members of a file written by pgzip_compress_file(). Returns false if a
+// member does not carry its size.
+static bool find_members(const unsigned char * gz, uint64 n, std::vector<GzChunk> & chunks)
+{
+     uint64 pos = 0, out = 0;
+     while (pos < n) {
+	  const unsigned char * h = gz + pos;
+	  if (n - pos < 20 + 8 || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || !(h[3] & 4)) return false;
+	  if (h[12] != 'V' || h[13] != 'B' || h[14] != 4 || h[15] != 0) return false;
+	  uint64 size = get32(h + SIZE_OFFSET);
+	  if (size < 20 + 8 || size > n - pos) return false;
+	  GzChunk c;
+	  c.in = pos;
+	  c.out = out;
+	  c.out_len = get32(h + size - 4); // ISIZE. Members are smaller than 4 GB.
+	  c.bits = 0;
+	  c.raw = false;
+	  c.window = 0;
+	  chunks.push_back(c);
+	  out += c.out_len;
+	  pos += size;
+     }
+     return !chunks.empty();
+}
+
+// inflate out_len bytes of a chunk into dst. A chunk may run over the end of
+// a gzip member into the next one.
+static int inflate_chunk(const unsigned char * gz, uint64 n, const GzChunk & c, unsigned char * dst)
+{
+     z_stream s;
+     memset(&s, 0, sizeof(s));
+     bool raw = c.raw;
+     if (inflateInit2(&s, raw? -15 : 47) != Z_OK) return 1;
+     if (raw) {
+	  if (c.bits) inflatePrime(&s, c.bits, gz[c.in - 1] >> (8 - c.bits));
+	  inflateSetDictionary(&s, c.window, WINDOW);
+     }
+     const unsigned char * next = gz + c.in;
+     uint64 left = n - c.in;
+     s.next_out = dst;
+     uint64 out_left = c.out_len;
+     int err = 0;
+     while (out_left > 0 && err == 0) {
+	  s.next_in = (Bytef *)next;
+	  s.avail_in = (uInt)std::min(left, (uint64)1 << 30);
+	  s.avail_out = (uInt)std::min(out_left, (uint64)1 << 30);
+	  uInt in_before = s.avail_in, out_before = s.avail_out;
+	  int ret = inflate(&s, Z_NO_FLUSH);
+	  next += in_before - s.avail_in;
+	  left -= in_before - s.avail_in;
+	  out_left -= out_before - s.avail_out;
+	  if (ret == Z_STREAM_END && out_left > 0) {
+	       // end of a member. A raw stream stops before the 8-byte trailer.
+	       if (raw) {
+		    if (left < 8) {
+			 err = 1;
+			 break;
+		    }
+		    next += 8;
+		    left -= 8;
+		    raw = false;
+	       }
+	       Bytef * out_pos = s.next_out;
+	       inflateEnd(&s);
+	       memset(&s, 0, sizeof(s));
+	       if (inflateInit2(&s, 47) != Z_OK) return 1;
+	       s.next_out = out_pos;
+	  }
+	  else if (ret != Z_OK && ret != Z_STREAM_END) {
+	       err = 1;
+	  }
+	  else if (ret == Z_OK && in_before == s.avail_in && out_before == s.avail_out) {
+	       err = 1; // no progress: truncated input.
+	  }
+     }
+     inflateEnd(&s);
+     return err;
+}
+
+// inflate the chunks in parallel and write them to fd.
+static int inflate_chunks(const unsigned char * gz, uint64 n, const std::vector<GzChunk> & chunks, int fd)
+{
+     int err = 0;
+#pragma omp parallel reduction(+:err)
+     {
+	  std::vector<unsigned char> buf;
+#pragma omp for schedule(dynamic)
+	  for (long i = 0; i < (long)chunks.size(); i ++) {
+	       buf.resize(chunks[i].out_len);
+	       if (chunks[i].out_len == 0) continue;
+	       if (inflate_chunk(gz, n, chunks[i], &buf[0]) || !write_all(fd, &buf[0], buf.size(), chunks[i].out)) {
+		    err ++;
+	       }
+	  }
+     }
+     return err;
+}
+
+// inflate the whole file sequentially to fd, and save an access point at the
+// first deflate block boundary after every PGZ_SPAN bytes of output.
+static int inflate_and_index(const unsigned char * gz, uint64 n, int fd, GzIndex & index)
+{
+     z_stream s;
+     memset(&s, 0, sizeof(s));
+     if (inflateInit2(&s, 47) != Z_OK) return 1;
+     // the last WINDOW bytes of output stay at the front of buf after it is
+     // written, as the window of the next access point.
+     std::vector<unsigned char> buf(WINDOW + PGZ_SPAN);
+     size_t fill = 0, written = 0;
+     uint64 totout = 0, last = 0;
+     const unsigned char * next = gz;
+     uint64 left = n;
+     int err = 0;
+     while (err == 0) {
+	  if (fill == buf.size()) {
+	       if (!write_all(fd, &buf[written], fill - written, totout - (fill - written))) {
+		    err = 1;
+		    break;
+	       }
+	       memmove(&buf[0], &buf[fill - WINDOW], WINDOW);
+	       fill = written = WINDOW;
+	  }
+	  s.next_in = (Bytef *)next;
+	  s.avail_in = (uInt)std::min(left, (uint64)1 << 30);
+	  s.next_out = &buf[fill];
+	  s.avail_out = buf.size() - fill;
+	  uInt in_before = s.avail_in, out_before = s.avail_out;
+	  int ret = inflate(&s, Z_BLOCK);
+	  next += in_before - s.avail_in;
+	  left -= in_before - s.avail_in;
+	  fill += out_before - s.avail_out;
+	  totout += out_before - s.avail_out;
+	  if (ret == Z_STREAM_END) {
+	       // another member follows, or the end of the data.
+	       if (left >= 2 && next[0] == 0x1f && next[1] == 0x8b) {
+		    inflateReset(&s);
+		    continue;
+	       }
+	       break;
+	  }
+	  if (ret != Z_OK || (in_before == s.avail_in && out_before == s.avail_out)) {
+	       err = 1;
+	       break;
+	  }
+	  if ((s.data_type & 128) && !(s.data_type & 64) && totout - last > PGZ_SPAN && fill >= WINDOW) {
+	       GzPoint p;
+	       p.in = next - gz;
+	       p.out = totout;
+	       p.bits = s.data_type & 7;
+	       p.window.assign(buf.begin() + fill - WINDOW, buf.begin() + fill);
+	       index.points.push_back(p);
+	       last = totout;
+	  }
+     }
+     inflateEnd(&s);
+     if (err == 0 && !write_all(fd, &buf[written], fill - written, totout - (fill - written))) err = 1;
+     index.out_size = totout;
+     return err;
+}
+
+// the index file is the header, the access points, and the crc32 of all of
+// them, so a truncated or damaged index is rebuilt instead of used.
+static void put_field(std::vector<unsigned char> & buf, const void * p, size_t n)
+{
+     buf.insert(buf.end(), (const unsigned char *)p, (const unsigned char *)p + n);
+}
+
+static bool get_field(const std::vector<unsigned char> & buf, size_t & pos, void * p, size_t n)
+{
+     if (pos + n > buf.size()) return false;
+     memcpy(p, &buf[pos], n);
+     pos += n;
+     return true;
+}
+
+static bool read_index(const std::string & filename, GzIndex & index)
+{
+     struct stat st;
+     if (stat(filename.c_str(), &st) != 0 || st.st_size < 12) return false;
+     std::vector<unsigned char> buf(st.st_size);
+     FILE * fp = fopen(filename.c_str(), "rb");
+     if (!fp) return false;
+     bool ok = fread(&buf[0], 1, buf.size(), fp) == buf.size();
+     fclose(fp);
+     const size_t body = buf.size() - 4;
+     if (!ok || crc32(crc32(0L, Z_NULL, 0), &buf[0], body) != get32(&buf[body])) return false;
+     buf.resize(body);
+
+     size_t pos = 0;
+     char magic[8];
+     uint64 gz_size = 0, gz_ino = 0, out_size = 0, n_points = 0;
+     long long gz_mtime = 0;
+     ok = get_field(buf, pos, magic, 8) && memcmp(magic, "PGZIDX03", 8) == 0
+	  && get_field(buf, pos, &gz_size, sizeof(gz_size)) && get_field(buf, pos, &gz_ino, sizeof(gz_ino))
+	  && get_field(buf, pos, &gz_mtime, sizeof(gz_mtime))
+	  && get_field(buf, pos, &out_size, sizeof(out_size)) && get_field(buf, pos, &n_points, sizeof(n_points))
+	  && gz_size == index.gz_size && gz_ino == index.gz_ino && gz_mtime == index.gz_mtime;
+     for (uint64 i = 0; ok && i < n_points; i ++) {
+	  GzPoint p;
+	  int bits = 0;
+	  p.window.resize(WINDOW);
+	  ok = get_field(buf, pos, &p.in, sizeof(p.in)) && get_field(buf, pos, &p.out, sizeof(p.out))
+	       && get_field(buf, pos, &bits, sizeof(bits)) && get_field(buf, pos, &p.window[0], WINDOW)
+	       && p.in > 0 && p.in <= gz_size && p.out <= out_size && bits >= 0 && bits < 8;
+	  p.bits = bits;
+	  if (ok) index.points.push_back(p);
+     }
+     index.out_size = out_size;
+     if (!ok) index.points.clear();
+     return ok;
+}
+
+// the index is only an optimization, so failing to write it is not an error.
+// It is written to a unique temporary file and renamed, as several processes
+// may build the index of the same file at once.
+static void write_index(const std::string & filename, const GzIndex & index)
+{
+     std::vector<unsigned char> buf;
+     uint64 n_points = index.points.size();
+     put_field(buf, "PGZIDX03", 8);
+     put_field(buf, &index.gz_size, sizeof(index.gz_size));
+     put_field(buf, &index.gz_ino, sizeof(index.gz_ino));
+     put_field(buf, &index.gz_mtime, sizeof(index.gz_mtime));
+     put_field(buf, &index.out_size, sizeof(index.out_size));
+     put_field(buf, &n_points, sizeof(n_points));
+     for (size_t i = 0; i < index.points.size(); i ++) {
+	  const GzPoint & p = index.points[i];
+	  put_field(buf, &p.in, sizeof(p.in));
+	  put_field(buf, &p.out, sizeof(p.out));
+	  put_field(buf, &p.bits, sizeof(p.bits));
+	  put_field(buf, &p.window[0], WINDOW);
+     }
+     unsigned char crc[4];
+     put32(crc, crc32(crc32(0L, Z_NULL, 0), &buf[0], buf.size()));
+     put_field(buf, crc, 4);
+
+     std::vector<char> tmp(filename.begin(), filename.end());
+     const char suffix[] = ".XXXXXX";
+     tmp.insert(tmp.end(), suffix, suffix + sizeof(suffix));
+     int fd = mkstemp(&tmp[0]);
+     if (fd < 0) return;
+     fchmod(fd, 0644);
+     bool ok = write_all(fd, &buf[0], buf.size(), 0);
+     if (close(fd) != 0) ok = false;
+     if (!ok || rename(&tmp[0], filename.c_str()) != 0) remove(&tmp[0]);
+}
+
+int pgzip_decompress_file(const std::string & src, int fd, unsigned short verbose)
+{
+     struct stat st;
+     if (stat(src.c_str(), &st) != 0) return 1;
+     std::vector<unsigned char> gz(st.st_size);
+     FILE * fp = fopen(src.c_str(), "rb");
+     if (!fp) return 1;
+     bool ok = gz.empty() || fread(&gz[0], 1, gz.size(), fp) == gz.size();
+     fclose(fp);
+     if (!ok || gz.empty()) return 1;
+     const uint64 n = gz.size();
+
+     std::vector<GzChunk> chunks;
+     if (find_members(&gz[0], n, chunks)) {
+	  if (verbose >= 1) {
+	       printf("pgzip_decompress_file(): %s: %ld members.\n", src.c_str(), (long)chunks.size());
+	  }
+	  return inflate_chunks(&gz[0], n, chunks, fd);
+     }
+
+     std::string index_file = src + ".gzidx";
+     GzIndex index;
+     index.gz_size = n;
+     index.gz_ino = st.st_ino;
+     index.gz_mtime = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+     if (!read_index(index_file, index)) {
+	  int err = inflate_and_index(&gz[0], n, fd, index);
+	  if (err == 0 && index.points.size() > 0) {
+	       write_index(index_file, index);
+	  }
+	  if (verbose >= 1) {
+	       printf("pgzip_decompress_file(): %s: inflated sequentially, index of %ld access points built.\n", src.c_str(), (long)index.points.size());
+	  }
+	  return err;
+     }
+
+     // chunk 0 starts with the gzip header, the others at access points.
+     GzChunk c;
+     c.in = 0;
+     c.out = 0;
+     c.bits = 0;
+     c.raw = false;
+     c.window = 0;
+     chunks.push_back(c);
+     for (size_t i = 0; i < index.points.size(); i ++) {
+	  c.in = index.points[i].in;
+	  c.out = index.points[i].out;
+	  c.bits = index.points[i].bits;
+	  c.raw = true;
+	  c.window = &index.points[i].window[0];
+	  chunks.push_back(c);
+     }
+     for (size_t i = 0; i < chunks.size(); i ++) {
+	  uint64 end = i + 1 < chunks.size()? chunks[i + 1].out : index.out_size;
+	  if (end < chunks[i].out) return 1;
+	  chunks[i].out_len = end - chunks[i].out;
+     }
+     if (verbose >= 1) {
+	  printf("pgzip_decompress_file(): %s: %ld access points.\n", src.c_str(), (long)index.points.size());
+     }
+     return inflate_chunks(&gz[0], n, chunks, fd);
+}
@@ -0,0 +1,31 @@
+#ifndef __PGZIP_H__
+#define __PGZIP_H__
+
+#include <string>
+
+// Parallel gzip of whole files.
+//
+// Compression splits the data into blocks of PGZ_BLOCK bytes, compressed in
+// parallel into independent gzip members, same as pigz --independent. Each
+// member carries its compressed size in a gzip extra field (subfield 'V' 'B'),
+// so a reader can find all members without inflating them. Any gzip reader
+// reads the members as one stream.
+//
+// Decompression inflates the members in parallel if all of them carry the
+// size. Other gzip files (e.g. .nii.gz written by ITK) are inflated once
+// sequentially, and an index of access points every PGZ_SPAN bytes of output
+// is saved next to the file as <file>.gzidx, same as zlib's zran example.
+// Later reads inflate from all access points in parallel. The index is
+// rebuilt if the size, inode or modification time (in nanoseconds) of the
+// file changes, or if its checksum does not match.
+#define PGZ_BLOCK (1 << 20)
+#define PGZ_SPAN (4 << 20)
+
+// compress the file src into the .gz file dst.
+int pgzip_compress_file(const std::string & src, const std::string & dst);
+
+// decompress the .gz file src and write the data to the file descriptor fd,
+// from offset 0. Returns 0 on success.
+int pgzip_decompress_file(const std::string & src, int fd, unsigned short verbose = 0);
+
+#endif
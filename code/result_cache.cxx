@@ -0,0 +1,328 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "result_cache.h"
+
+// files are hashed in blocks, in parallel, and the block hashes are combined
+// in order, so a file hashed while it is copied gets the same hash.
+#define HASH_BLOCK (4 << 20)
+
+struct Hash128
+{
+     unsigned long long a, b;
+};
+
+static inline unsigned long long rotl(unsigned long long x, unsigned r)
+{
+     return (x << r) | (x >> (64 - r));
+}
+
+// two independent multiply-xorshift lanes over the 8-byte words of a block.
+// Not cryptographic, but 128 bits leave no practical chance of a collision
+// between the volumes of a local cache.
+static Hash128 hash_block(const unsigned char * data, size_t n)
+{
+     Hash128 h = {0x9e3779b97f4a7c15ULL ^ n, 0xc2b2ae3d27d4eb4fULL + n};
+     size_t i = 0;
+     for (; i + 8 <= n; i += 8) {
+	  unsigned long long w;
+	  memcpy(&w, data + i, 8);
+	  h.a = rotl((h.a ^ w) * 0xff51afd7ed558ccdULL, 31);
+	  h.b = rotl((h.b + w) * 0xc4ceb9fe1a85ec53ULL, 27) ^ h.a;
+     }
+     unsigned long long w = 0;
+     memcpy(&w, data + i, n - i);
+     h.a = rotl((h.a ^ w) * 0xff51afd7ed558ccdULL, 31);
+     h.b = rotl((h.b + w) * 0xc4ceb9fe1a85ec53ULL, 27) ^ h.a;
+     return h;
+}
+
+static void hash_combine(Hash128 & h, const Hash128 & block)
+{
+     h.a = (h.a ^ block.a) * 0x9e3779b97f4a7c15ULL;
+     h.a ^= h.a >> 32;
+     h.b = (h.b ^ block.b) * 0xd6e8feb86659fd93ULL;
+     h.b ^= h.b >> 29;
+}
+
+static std::string hash_hex(const Hash128 & h)
+{
+     char s[33];
+     snprintf(s, sizeof(s), "%016llx%016llx", h.a, h.b);
+     return s;
+}
+
+static Hash128 hash_string(const std::string & s)
+{
+     Hash128 h = {0, 0};
+     hash_combine(h, hash_block((const unsigned char *)s.data(), s.size()));
+     return h;
+}
+
+// the content hash of a file, with its blocks read and hashed in parallel.
+static int hash_file(const std::string & file, Hash128 & h)
+{
+     int fd = open(file.c_str(), O_RDONLY);
+     if (fd < 0) return 1;
+     struct stat st;
+     if (fstat(fd, &st) != 0) {
+	  close(fd);
+	  return 1;
+     }
+     const long n_blocks = (st.st_size + HASH_BLOCK - 1) / HASH_BLOCK;
+     std::vector<Hash128> blocks(n_blocks);
+     int err = 0;
+#pragma omp parallel
+     {
+	  std::vector<unsigned char> buf(HASH_BLOCK);
+#pragma omp for schedule(dynamic)
+	  for (long k = 0; k < n_blocks; k ++) {
+	       off_t offset = (off_t)k * HASH_BLOCK;
+	       size_t n = std::min((off_t)HASH_BLOCK, st.st_size - offset);
+	       if (pread(fd, &buf[0], n, offset) != (ssize_t)n) {
+#pragma omp atomic
+		    err ++;
+		    continue;
+	       }
+	       blocks[k] = hash_block(&buf[0], n);
+	  }
+     }
+     close(fd);
+     h.a = h.b = 0;
+     for (long k = 0; k < n_blocks; k ++) {
+	  hash_combine(h, blocks[k]);
+     }
+     return err? 1 : 0;
+}
+
+static std::string cache_root()
+{
+     const char * s = getenv("VESSEL_RESULT_CACHE");
+     return s && *s? s : "";
+}
+
+// file of the remembered content hash of a file, by its real path, size,
+// inode and modification time. Empty if the file does not exist.
+static std::string memo_file(const std::string & root, const std::string & file)
+{
+     struct stat st;
+     char real[PATH_MAX];
+     if (stat(file.c_str(), &st) != 0 || !realpath(file.c_str(), real)) return "";
+     char id[128];
+     snprintf(id, sizeof(id), ":%lld:%lld:%lld.%09ld", (long long)st.st_size, (long long)st.st_ino, (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+     return root + "/hashes/" + hash_hex(hash_string(std::string(real) + id));
+}
+
+static std::string read_line(const std::string & file)
+{
+     char s[128] = "";
+     FILE * fp = fopen(file.c_str(), "r");
+     if (!fp) return "";
+     if (!fgets(s, sizeof(s), fp)) s[0] = 0;
+     fclose(fp);
+     s[strcspn(s, "\n")] = 0;
+     return s;
+}
+
+static void write_line(const std::string & file, const std::string & line)
+{
+     FILE * fp = fopen(file.c_str(), "w");
+     if (!fp) return;
+     fprintf(fp, "%s\n", line.c_str());
+     fclose(fp);
+}
+
+// the content hash of a file as hex, remembered across runs. Empty if the
+// file cannot be read.
+static std::string content_hash(const std::string & root, const std::string & file)
+{
+     const std::string memo = memo_file(root, file);
+     if (memo.empty()) return "";
+     std::string hex = read_line(memo);
+     if (hex.size() == 32) return hex;
+     Hash128 h;
+     if (hash_file(file, h)) return "";
+     hex = hash_hex(h);
+     write_line(memo, hex);
+     return hex;
+}
+
+// copy a file, and its content hash as a side product. Returns 1 on error.
+static int copy_file(const std::string & src, const std::string & dst, std::string & hex)
+{
+     int in = open(src.c_str(), O_RDONLY);
+     if (in < 0) return 1;
+     int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+     if (out < 0) {
+	  close(in);
+	  return 1;
+     }
+     std::vector<unsigned char> buf(HASH_BLOCK);
+     Hash128 h = {0, 0};
+     int err = 0;
+     while (!err) {
+	  // fill whole blocks, so the block hashes are the same as hash_file().
+	  size_t n = 0;
+	  ssize_t r = 1;
+	  while (n < buf.size() && (r = read(in, &buf[n], buf.size() - n)) > 0) n += r;
+	  if (r < 0) err = 1;
+	  if (n == 0) break;
+	  hash_combine(h, hash_block(&buf[0], n));
+	  if (write(out, &buf[0], n) != (ssize_t)n) err = 1;
+	  if (n < buf.size()) break;
+     }
+     close(in);
+     if (close(out) != 0) err = 1;
+     hex = hash_hex(h);
+     return err;
+}
+
+// the values of an option as strings. Returns false for a type not known
+// here, and then the run is not cached.
+static bool option_values(const boost::any & v, std::vector<std::string> & out)
+{
+     char s[64];
+     out.clear();
+     if (const std::string * p = boost::any_cast<std::string>(&v)) out.push_back(*p);
+     else if (const std::vector<std::string> * p = boost::any_cast<std::vector<std::string> >(&v)) out = *p;
+     else if (const bool * p = boost::any_cast<bool>(&v)) out.push_back(*p? "1" : "0");
+     else if (const int * p = boost::any_cast<int>(&v)) { snprintf(s, sizeof(s), "%d", *p); out.push_back(s); }
+     else if (const unsigned * p = boost::any_cast<unsigned>(&v)) { snprintf(s, sizeof(s), "%u", *p); out.push_back(s); }
+     else if (const unsigned short * p = boost::any_cast<unsigned short>(&v)) { snprintf(s, sizeof(s), "%u", *p); out.push_back(s); }
+     else if (const unsigned long * p = boost::any_cast<unsigned long>(&v)) { snprintf(s, sizeof(s), "%lu", *p); out.push_back(s); }
+     else if (const float * p = boost::any_cast<float>(&v)) { snprintf(s, sizeof(s), "%.9g", *p); out.push_back(s); }
+     else if (const double * p = boost::any_cast<double>(&v)) { snprintf(s, sizeof(s), "%.17g", *p); out.push_back(s); }
+     else if (const std::vector<float> * p = boost::any_cast<std::vector<float> >(&v)) {
+	  for (size_t i = 0; i < p->size(); i ++) { snprintf(s, sizeof(s), "%.9g", (*p)[i]); out.push_back(s); }
+     }
+     else if (const std::vector<double> * p = boost::any_cast<std::vector<double> >(&v)) {
+	  for (size_t i = 0; i < p->size(); i ++) { snprintf(s, sizeof(s), "%.17g", (*p)[i]); out.push_back(s); }
+     }
+     else return false;
+     return true;
+}
+
+static bool contains(const std::vector<std::string> & v, const std::string & s)
+{
+     for (size_t i = 0; i < v.size(); i ++) {
+	  if (v[i] == s) return true;
+     }
+     return false;
+}
+
+// the extension of a file name, from the first '.' of its base name.
+static std::string extension(const std::string & file)
+{
+     size_t slash = file.rfind('/');
+     size_t dot = file.find('.', slash == std::string::npos? 0 : slash + 1);
+     return dot == std::string::npos? "" : file.substr(dot);
+}
+
+bool result_cache_restore(ResultCache & rc, const std::string & tool, const boost::program_options::variables_map & vm, const std::vector<std::string> & input_options, const std::vector<std::string> & output_options, const std::vector<std::string> & output_files, unsigned short verbose)
+{
+     rc.dir.clear();
+     rc.names.clear();
+     rc.outputs.clear();
+     const std::string root = cache_root();
+     if (root.empty()) return false;
+     mkdir(root.c_str(), 0777);
+     mkdir((root + "/hashes").c_str(), 0777);
+
+     // the key string: the tool and its executable, so a rebuilt tool does not
+     // get the outputs of the old one, then one line per option, in the order
+     // of the names. The diagnostic options do not change the outputs.
+     const std::string exe = content_hash(root, "/proc/self/exe");
+     if (exe.empty()) return false;
+     std::string key = tool + "\n" + exe + "\n";
+     std::vector<std::string> values;
+     for (boost::program_options::variables_map::const_iterator it = vm.begin(); it != vm.end(); ++ it) {
+	  const std::string & name = it->first;
+	  if (name == "help" || name == "verbose") continue;
+	  if (!option_values(it->second.value(), values)) {
+	       if (verbose >= 1) {
+		    std::cout << "result_cache_restore(): option " << name << " has a type not cached. Cache not used.\n";
+	       }
+	       return false;
+	  }
+	  key += name + "=";
+	  for (size_t i = 0; i < values.size(); i ++) {
+	       if (contains(input_options, name)) {
+		    const std::string hex = content_hash(root, values[i]);
+		    if (hex.empty()) return false;
+		    key += hex + " ";
+	       }
+	       else if (contains(output_options, name)) {
+		    char index[16];
+		    snprintf(index, sizeof(index), ".%u", (unsigned)i);
+		    key += "ext:" + extension(values[i]) + " ";
+		    rc.names.push_back(name + index + extension(values[i]));
+		    rc.outputs.push_back(values[i]);
+	       }
+	       else {
+		    key += values[i] + " ";
+	       }
+	  }
+	  key += "\n";
+     }
+     for (size_t i = 0; i < output_files.size(); i ++) {
+	  char index[16];
+	  snprintf(index, sizeof(index), "file.%u", (unsigned)i);
+	  key += "file=" + output_files[i] + "\n";
+	  rc.names.push_back(index + extension(output_files[i]));
+	  rc.outputs.push_back(output_files[i]);
+     }
+     rc.dir = root + "/" + hash_hex(hash_string(key));
+
+     struct stat st;
+     if (stat(rc.dir.c_str(), &st) != 0) return false;
+     for (size_t i = 0; i < rc.outputs.size(); i ++) {
+	  std::string hex;
+	  if (copy_file(rc.dir + "/" + rc.names[i], rc.outputs[i], hex)) {
+	       std::cerr << "result_cache_restore(): cannot restore " << rc.outputs[i] << " from " << rc.dir << ". Recomputing.\n";
+	       return false;
+	  }
+	  // the restored file is known, so the next tool does not hash it.
+	  const std::string memo = memo_file(root, rc.outputs[i]);
+	  if (!memo.empty()) write_line(memo, hex);
+	  std::cout << "result_cache_restore(): File " << rc.outputs[i] << " restored from the cache.\n";
+     }
+     return true;
+}
+
+void result_cache_store(const ResultCache & rc, unsigned short verbose)
+{
+     if (rc.dir.empty()) return;
+     const std::string root = cache_root();
+     std::string tmp = rc.dir + ".tmp.XXXXXX";
+     std::vector<char> tmp_name(tmp.begin(), tmp.end());
+     tmp_name.push_back(0);
+     if (!mkdtemp(&tmp_name[0])) return;
+     tmp = &tmp_name[0];
+
+     // the entry is filled in a temporary directory and renamed, so other
+     // processes see a whole entry or none.
+     int err = 0;
+     for (size_t i = 0; i < rc.outputs.size() && !err; i ++) {
+	  std::string hex;
+	  err = copy_file(rc.outputs[i], tmp + "/" + rc.names[i], hex);
+	  const std::string memo = memo_file(root, rc.outputs[i]);
+	  if (!err && !memo.empty()) write_line(memo, hex);
+     }
+     if (err || rename(tmp.c_str(), rc.dir.c_str()) != 0) {
+	  for (size_t i = 0; i < rc.names.size(); i ++) {
+	       remove((tmp + "/" + rc.names[i]).c_str());
+	  }
+	  rmdir(tmp.c_str());
+	  return;
+     }
+     if (verbose >= 1) {
+	  std::cout << "result_cache_store(): outputs saved in " << rc.dir << "\n";
+     }
+}
@@ -0,0 +1,47 @@
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <boost/program_options/variables_map.hpp>
+
+// Content-addressed cache of tool outputs. The key of a run is a hash of the
+// tool name, the contents of its executable and input files, and the values
+// of its other options (the outputs count by their file extension only, as
+// that picks the format, and --verbose does not count). A run with a key already in the cache copies the cached
+// outputs to its output files instead of computing them, so changing an
+// option late in a pipeline (fmm_upwind --stoptime, inverse_distmap -x) only
+// reruns the tools after it: the earlier tools get the same inputs and
+// options, and hit.
+//
+//     ResultCache rc;
+//     if (result_cache_restore(rc, "tool", vm, inputs, outputs, files, verbose)) return 0;
+//     ... read inputs, compute, save_volume() ...
+//     save_volume_flush();
+//     result_cache_store(rc);
+//
+// The content hash of a file is kept in the cache too, by path, size, inode
+// and modification time, so an unchanged input is read once to hash it.
+//
+// The cache is off unless VESSEL_RESULT_CACHE gives its directory. Entries
+// are never removed by the tools; remove the directory to clear the cache.
+struct ResultCache
+{
+     std::string dir;     // entry of the key, or empty if the cache is off.
+     std::vector<std::string> names;   // file names of the outputs in the entry.
+     std::vector<std::string> outputs; // output files of the run.
+};
+
+// compute the key of the run. input_options and output_options are the names
+// of the options that give input and output files (one or several values).
+// output_files are the other files the run writes, e.g. the volumes a tool
+// saves for debugging at some verbose levels; they are part of the key and
+// kept with the outputs. Returns true if the entry exists and all the outputs
+// were restored from it.
+bool result_cache_restore(ResultCache & rc, const std::string & tool, const boost::program_options::variables_map & vm, const std::vector<std::string> & input_options, const std::vector<std::string> & output_options, const std::vector<std::string> & output_files, unsigned short verbose = 0);
+
+// copy the outputs into the entry of the key, after they are written. Does
+// nothing if the cache is off, or an output is missing.
+void result_cache_store(const ResultCache & rc, unsigned short verbose = 0);
+
+#endif
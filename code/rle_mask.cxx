@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <climits>
+#include "rle_mask.h"
+
+void rle_allocate(RLEMask & mask, const unsigned size[3])
+{
+     for (unsigned d = 0; d < 3; d ++) mask.size[d] = size[d];
+     mask.row_start.assign(mask.n_rows() + 1, 0);
+     mask.runs.clear();
+}
+
+void rle_read(const std::string & filename, RLEMask & mask)
+{
+     ReaderType3UC::Pointer reader = ReaderType3UC::New();
+     reader->SetFileName(filename);
+     reader->Update();
+     rle_from_image(reader->GetOutput(), mask);
+}
+
+void rle_to_image(const RLEMask & mask, ImageType3UC::Pointer imagePtr, unsigned char foreground, unsigned char background)
+{
+     unsigned char * buffer = imagePtr->GetBufferPointer();
+     const long n_rows = mask.n_rows();
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  unsigned char * dst = buffer + r * mask.size[0];
+	  std::fill(dst, dst + mask.size[0], background);
+	  for (size_t i = mask.row_start[r]; i < mask.row_start[r + 1]; i ++) {
+	       std::fill(dst + mask.runs[i].x0, dst + mask.runs[i].x1, foreground);
+	  }
+     }
+}
+
+size_t rle_count(const RLEMask & mask)
+{
+     size_t n = 0;
+     for (size_t i = 0; i < mask.runs.size(); i ++) {
+	  n += mask.runs[i].x1 - mask.runs[i].x0;
+     }
+     return n;
+}
+
+bool rle_bounding_box(const RLEMask & mask, unsigned lo[3], unsigned hi[3])
+{
+     if (mask.runs.empty()) return false;
+     lo[0] = lo[1] = lo[2] = UINT_MAX;
+     hi[0] = hi[1] = hi[2] = 0;
+     const long n_rows = mask.n_rows();
+     for (long r = 0; r < n_rows; r ++) {
+	  size_t n = mask.n_runs(r);
+	  if (n == 0) continue;
+	  unsigned y = r % mask.size[1], z = r / mask.size[1];
+	  // runs are sorted, so only the first and last run matter for x.
+	  lo[0] = std::min(lo[0], mask.runs[mask.row_start[r]].x0);
+	  hi[0] = std::max(hi[0], mask.runs[mask.row_start[r + 1] - 1].x1 - 1);
+	  lo[1] = std::min(lo[1], y);
+	  hi[1] = std::max(hi[1], y);
+	  lo[2] = std::min(lo[2], z);
+	  hi[2] = std::max(hi[2], z);
+     }
+     return true;
+}
+
+enum RowOp {ROW_AND, ROW_OR, ROW_ANDNOT};
+
+// the k-th boundary of a row: x0 of run k/2 if k is even, x1 otherwise.
+static inline unsigned boundary(const RLERun * runs, size_t k)
+{
+     return k & 1? runs[k >> 1].x1 : runs[k >> 1].x0;
+}
+
+// sweep over the run boundaries of two rows, and append the maximal runs where
+// op(in a, in b) holds to out.
+static void row_combine(const RLERun * a, size_t na, const RLERun * b, size_t nb, RowOp op, std::vector<RLERun> & out)
+{
+     size_t i = 0, j = 0;
+     bool in_a = false, in_b = false, in = false;
+     unsigned start = 0;
+     while (i < 2 * na || j < 2 * nb) {
+	  unsigned x = std::min(i < 2 * na? boundary(a, i) : UINT_MAX, j < 2 * nb? boundary(b, j) : UINT_MAX);
+	  // touching runs have an end and a start at the same x.
+	  while (i < 2 * na && boundary(a, i) == x) {
+	       in_a = !(i & 1);
+	       i ++;
+	  }
+	  while (j < 2 * nb && boundary(b, j) == x) {
+	       in_b = !(j & 1);
+	       j ++;
+	  }
+	  bool now = op == ROW_AND? in_a && in_b : op == ROW_OR? in_a || in_b : in_a && !in_b;
+	  if (now && !in) {
+	       start = x;
+	  }
+	  else if (!now && in) {
+	       RLERun run = {start, x};
+	       out.push_back(run);
+	  }
+	  in = now;
+     }
+}
+
+// build out row by row from the runs of each row, computed in parallel into
+// per-row vectors and then packed.
+template <class TRowFunction>
+static void build_rows(const unsigned size[3], TRowFunction & f, RLEMask & out)
+{
+     rle_allocate(out, size);
+     const long n_rows = out.n_rows();
+     std::vector<std::vector<RLERun> > rows(n_rows);
+#pragma omp parallel for schedule(dynamic, 64)
+     for (long r = 0; r < n_rows; r ++) {
+	  f(r, rows[r]);
+	  out.row_start[r + 1] = rows[r].size();
+     }
+     for (long r = 0; r < n_rows; r ++) {
+	  out.row_start[r + 1] += out.row_start[r];
+     }
+     out.runs.resize(out.row_start[n_rows]);
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  std::copy(rows[r].begin(), rows[r].end(), out.runs.begin() + out.row_start[r]);
+     }
+}
+
+struct CombineRows
+{
+     const RLEMask & a;
+     const RLEMask & b;
+     RowOp op;
+     CombineRows(const RLEMask & a_, const RLEMask & b_, RowOp op_) : a(a_), b(b_), op(op_) {};
+     void operator()(long r, std::vector<RLERun> & out) const {
+	  row_combine(a.row(r), a.n_runs(r), b.row(r), b.n_runs(r), op, out);
+     }
+};
+
+void rle_and(const RLEMask & a, const RLEMask & b, RLEMask & out)
+{
+     CombineRows f(a, b, ROW_AND);
+     build_rows(a.size, f, out);
+}
+
+void rle_or(const RLEMask & a, const RLEMask & b, RLEMask & out)
+{
+     CombineRows f(a, b, ROW_OR);
+     build_rows(a.size, f, out);
+}
+
+struct NotRows
+{
+     const RLEMask & in;
+     NotRows(const RLEMask & in_) : in(in_) {};
+     void operator()(long r, std::vector<RLERun> & out) const {
+	  RLERun full = {0, in.size[0]};
+	  row_combine(&full, 1, in.row(r), in.n_runs(r), ROW_ANDNOT, out);
+     }
+};
+
+void rle_not(const RLEMask & in, RLEMask & out)
+{
+     NotRows f(in);
+     build_rows(in.size, f, out);
+}
+
+void rle_offsets(const RLEMask & mask, std::vector<unsigned> & offsets)
+{
+     offsets.resize(rle_count(mask));
+     const long n_rows = mask.n_rows();
+     size_t n = 0;
+     for (long r = 0; r < n_rows; r ++) {
+	  const unsigned base = r * mask.size[0];
+	  for (size_t i = mask.row_start[r]; i < mask.row_start[r + 1]; i ++) {
+	       for (unsigned x = mask.runs[i].x0; x < mask.runs[i].x1; x ++) {
+		    offsets[n ++] = base + x;
+	       }
+	  }
+     }
+}
+
+long rle_find(const RLEMask & mask, long r, unsigned x)
+{
+     // first run of the row that ends after x.
+     size_t lo = mask.row_start[r], hi = mask.row_start[r + 1];
+     while (lo < hi) {
+	  size_t mid = (lo + hi) / 2;
+	  if (mask.runs[mid].x1 <= x) lo = mid + 1;
+	  else hi = mid;
+     }
+     if (lo < mask.row_start[r + 1] && mask.runs[lo].x0 <= x) return lo;
+     return -1;
+}
+
+struct ContourRows
+{
+     const RLEMask & in;
+     ContourRows(const RLEMask & in_) : in(in_) {};
+     void operator()(long r, std::vector<RLERun> & out) const {
+	  const size_t n = in.n_runs(r);
+	  if (n == 0) return;
+	  const RLERun * runs = in.row(r);
+	  const unsigned nx = in.size[0], ny = in.size[1], nz = in.size[2];
+	  const unsigned y = r % ny, z = r / ny;
+
+	  // the ends of each run have a background neighbor along x, unless
+	  // they are on the border.
+	  std::vector<RLERun> acc, next, diff;
+	  for (size_t i = 0; i < n; i ++) {
+	       bool first = runs[i].x0 > 0, last = runs[i].x1 < nx;
+	       if (first && last && runs[i].x1 - runs[i].x0 <= 2) {
+		    acc.push_back(runs[i]);
+		    continue;
+	       }
+	       if (first) {
+		    RLERun run = {runs[i].x0, runs[i].x0 + 1};
+		    acc.push_back(run);
+	       }
+	       if (last) {
+		    RLERun run = {runs[i].x1 - 1, runs[i].x1};
+		    acc.push_back(run);
+	       }
+	  }
+
+	  // the voxels not covered by the runs of the neighbor rows along y and z.
+	  long nbrs[4];
+	  unsigned n_nbrs = 0;
+	  if (y > 0) nbrs[n_nbrs ++] = r - 1;
+	  if (y + 1 < ny) nbrs[n_nbrs ++] = r + 1;
+	  if (z > 0) nbrs[n_nbrs ++] = r - ny;
+	  if (z + 1 < nz) nbrs[n_nbrs ++] = r + ny;
+	  for (unsigned k = 0; k < n_nbrs; k ++) {
+	       diff.clear();
+	       row_combine(runs, n, in.row(nbrs[k]), in.n_runs(nbrs[k]), ROW_ANDNOT, diff);
+	       if (diff.empty()) continue;
+	       next.clear();
+	       row_combine(acc.empty()? 0 : &acc[0], acc.size(), &diff[0], diff.size(), ROW_OR, next);
+	       acc.swap(next);
+	  }
+	  out.swap(acc);
+     }
+};
+
+void rle_contour(const RLEMask & in, RLEMask & out)
+{
+     ContourRows f(in);
+     build_rows(in.size, f, out);
+}
@@ -0,0 +1,125 @@
+#ifndef __RLE_MASK_H__
+#define __RLE_MASK_H__
+
+#include <vector>
+#include <string>
+#include <common.h>
+
+// foreground run [x0, x1) of a row.
+struct RLERun
+{
+     unsigned x0;
+     unsigned x1;
+};
+
+// Binary volume stored as the foreground runs along x. Row r = z * size[1] + y
+// has the runs [row_start[r], row_start[r+1]), sorted and separated by at least
+// one background voxel. The first voxel of row r has buffer offset
+// r * size[0], same as an ITK image of this size.
+//
+// A lung or body mask has a few runs per row, so a loop over the runs visits
+// only the foreground and skips the background in O(runs):
+//
+//     for (long r = 0; r < n_rows; r ++)
+//          for (size_t i = mask.row_start[r]; i < mask.row_start[r+1]; i ++)
+//               for (unsigned x = mask.runs[i].x0; x < mask.runs[i].x1; x ++)
+//                    ... voxel with buffer offset r * size[0] + x ...
+struct RLEMask
+{
+     unsigned size[3];
+     std::vector<size_t> row_start;
+     std::vector<RLERun> runs;
+
+     long n_rows() const {
+	  return (long)size[1] * size[2];
+     }
+     size_t n_runs(long r) const {
+	  return row_start[r + 1] - row_start[r];
+     }
+     const RLERun * row(long r) const {
+	  return runs.empty()? 0 : &runs[row_start[r]];
+     }
+};
+
+// an empty mask of the given size.
+void rle_allocate(RLEMask & mask, const unsigned size[3]);
+
+// the runs of the voxels > 0 of a row of an image buffer.
+template <class TPixel>
+unsigned rle_row_runs(const TPixel * src, unsigned nx, RLERun * runs)
+{
+     unsigned n = 0;
+     unsigned x = 0;
+     while (x < nx) {
+	  while (x < nx && !(src[x] > 0)) x ++;
+	  if (x == nx) break;
+	  unsigned x0 = x;
+	  while (x < nx && src[x] > 0) x ++;
+	  if (runs) {
+	       runs[n].x0 = x0;
+	       runs[n].x1 = x;
+	  }
+	  n ++;
+     }
+     return n;
+}
+
+// the voxels > 0 of an ITK image, for any scalar pixel type (the masks are
+// read as unsigned char or char in different tools). The runs of each row are
+// counted in parallel, then written in parallel to their final place.
+template <class TImage>
+void rle_from_image(const TImage * image, RLEMask & mask)
+{
+     typename TImage::SizeType imageSize = image->GetLargestPossibleRegion().GetSize();
+     const unsigned size[3] = {(unsigned)imageSize[0], (unsigned)imageSize[1], (unsigned)imageSize[2]};
+     rle_allocate(mask, size);
+     const typename TImage::PixelType * buffer = image->GetBufferPointer();
+     const long n_rows = mask.n_rows();
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  mask.row_start[r + 1] = rle_row_runs(buffer + r * size[0], size[0], (RLERun *)0);
+     }
+     for (long r = 0; r < n_rows; r ++) {
+	  mask.row_start[r + 1] += mask.row_start[r];
+     }
+     mask.runs.resize(mask.row_start[n_rows]);
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  if (mask.n_runs(r) > 0) {
+	       rle_row_runs(buffer + r * size[0], size[0], &mask.runs[mask.row_start[r]]);
+	  }
+     }
+}
+
+// read a mask volume. Voxels > 0 are foreground.
+void rle_read(const std::string & filename, RLEMask & mask);
+
+// write foreground to the voxels in the mask and background to others. The
+// image must be allocated with the same size as the mask.
+void rle_to_image(const RLEMask & mask, ImageType3UC::Pointer imagePtr, unsigned char foreground, unsigned char background);
+
+// number of foreground voxels.
+size_t rle_count(const RLEMask & mask);
+
+// bounding box [lo, hi] of the foreground voxels, inclusive. Returns false if
+// the mask is empty.
+bool rle_bounding_box(const RLEMask & mask, unsigned lo[3], unsigned hi[3]);
+
+// set operations by merging the runs of each row. The masks must have the same
+// size. out may not be one of the inputs.
+void rle_and(const RLEMask & a, const RLEMask & b, RLEMask & out);
+void rle_or(const RLEMask & a, const RLEMask & b, RLEMask & out);
+void rle_not(const RLEMask & in, RLEMask & out);
+
+// buffer offsets of all foreground voxels, in buffer order.
+void rle_offsets(const RLEMask & mask, std::vector<unsigned> & offsets);
+
+// index of the run of row r that contains x, or -1 if (x, r) is background.
+long rle_find(const RLEMask & mask, long r, unsigned x);
+
+// the foreground voxels with a face neighbor (6-neighborhood) in the
+// background, same as LabelContourImageFilter with FullyConnected off on a
+// binary mask. Voxels outside the volume are not background.
+void rle_contour(const RLEMask & in, RLEMask & out);
+
+#endif
@@ -0,0 +1,63 @@
+#include <cstdio>
+#include "roi.h"
+
+int roi_init(VolumeROI & roi, const std::string & mode, const itk::ImageBase<3> * reference, const RLEMask & mask, unsigned margin, unsigned short verbose)
+{
+     roi.full = reference->GetLargestPossibleRegion();
+     roi.origin = reference->GetOrigin();
+     roi.spacing = reference->GetSpacing();
+     roi.direction = reference->GetDirection();
+     roi.region = roi.full;
+     roi.active = false;
+
+     if (mode == "full") return 0;
+     if (mode != "auto") {
+	  printf("roi_init(): unknown ROI mode %s. Must be full or auto.\n", mode.c_str());
+	  return 1;
+     }
+     for (unsigned d = 0; d < 3; d ++) {
+	  if (mask.size[d] != roi.full.GetSize(d)) {
+	       printf("roi_init(): mask has different size with input.\n");
+	       return 1;
+	  }
+     }
+
+     unsigned lo[3], hi[3];
+     if (!rle_bounding_box(mask, lo, hi)) {
+	  printf("roi_init(): mask is empty. The full volume is used.\n");
+	  return 0;
+     }
+     for (unsigned d = 0; d < 3; d ++) {
+	  lo[d] = lo[d] > margin? lo[d] - margin : 0;
+	  hi[d] = std::min((unsigned)roi.full.GetSize(d) - 1, hi[d] + margin);
+	  roi.region.SetIndex(d, lo[d]);
+	  roi.region.SetSize(d, hi[d] - lo[d] + 1);
+     }
+     roi.active = roi.region != roi.full;
+     if (verbose >= 1) {
+	  printf("roi_init(): ROI [%u %u %u] - [%u %u %u], %.1f%% of the volume.\n", lo[0], lo[1], lo[2], hi[0], hi[1], hi[2], 100.0 * roi.region.GetNumberOfPixels() / roi.full.GetNumberOfPixels());
+     }
+     return 0;
+}
+
+void roi_crop(const VolumeROI & roi, const RLEMask & in, RLEMask & out)
+{
+     if (!roi.active) {
+	  out = in;
+	  return;
+     }
+     const unsigned size[3] = {(unsigned)roi.region.GetSize(0), (unsigned)roi.region.GetSize(1), (unsigned)roi.region.GetSize(2)};
+     const unsigned x0 = roi.region.GetIndex(0), y0 = roi.region.GetIndex(1), z0 = roi.region.GetIndex(2);
+     const unsigned x1 = x0 + size[0];
+     rle_allocate(out, size);
+     const long n_rows = out.n_rows();
+     for (long r = 0; r < n_rows; r ++) {
+	  long in_r = ((long)z0 + r / size[1]) * in.size[1] + y0 + r % size[1];
+	  for (size_t i = in.row_start[in_r]; i < in.row_start[in_r + 1]; i ++) {
+	       if (in.runs[i].x1 <= x0 || in.runs[i].x0 >= x1) continue;
+	       RLERun run = {std::max(in.runs[i].x0, x0) - x0, std::min(in.runs[i].x1, x1) - x0};
+	       out.runs.push_back(run);
+	  }
+	  out.row_start[r + 1] = out.runs.size();
+     }
+}
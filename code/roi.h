@@ -0,0 +1,112 @@
+#ifndef __ROI_H__
+#define __ROI_H__
+
+#include <string>
+#include <algorithm>
+#include <common.h>
+#include "rle_mask.h"
+
+// Crop-to-ROI execution of a tool. With --roi auto, the tool processes only
+// the bounding box of its mask grown by a margin: the input volumes are
+// cropped after reading, and the outputs are pasted back into full-size
+// volumes with the geometry of the input before saving. With --roi full the
+// volumes are used as they are, and all the calls below pass them through.
+//
+//     VolumeROI roi;
+//     roi_init(roi, roi_mode, inPtr.GetPointer(), mask, margin, verbose);
+//     inPtr = roi_crop(roi, inPtr);
+//     roi_crop(roi, mask, mask_roi);
+//     ... process inPtr and mask_roi ...
+//     save_volume(roi_paste(roi, outPtr, 0), out_file);
+//
+// The cropped volumes have index 0, and their origin is the physical point of
+// the first voxel of the ROI, so the physical coordinates of the voxels do not
+// change.
+struct VolumeROI
+{
+     bool active; // false if the ROI is the full volume.
+     itk::ImageRegion<3> full; // largest region of the input volumes.
+     itk::ImageRegion<3> region; // the ROI. Volumes read from files have index 0.
+     ImageType3F::PointType origin;
+     ImageType3F::SpacingType spacing;
+     ImageType3F::DirectionType direction;
+};
+
+// set the ROI from the mode, "full" or "auto". With "auto", the ROI is the
+// bounding box of the mask grown by margin voxels and clipped to the volume.
+// The full volume is used if the mask is empty. reference gives the geometry
+// of the full volume, and must have the same size as the mask. Returns 1 on
+// a bad mode or size.
+int roi_init(VolumeROI & roi, const std::string & mode, const itk::ImageBase<3> * reference, const RLEMask & mask, unsigned margin, unsigned short verbose = 0);
+
+// the runs of the mask inside the ROI, shifted to the index of the ROI.
+void roi_crop(const VolumeROI & roi, const RLEMask & in, RLEMask & out);
+
+// copy the rows of the ROI from a full-size buffer to a buffer of the ROI
+// size, and back.
+template <class TPixel>
+void roi_crop_rows(const VolumeROI & roi, const TPixel * full, TPixel * part)
+{
+     const long nx = roi.full.GetSize(0), ny = roi.full.GetSize(1);
+     const long px = roi.region.GetSize(0), py = roi.region.GetSize(1);
+     const long x0 = roi.region.GetIndex(0), y0 = roi.region.GetIndex(1), z0 = roi.region.GetIndex(2);
+     const long n_rows = py * roi.region.GetSize(2);
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  const TPixel * src = full + ((z0 + r / py) * ny + y0 + r % py) * nx + x0;
+	  std::copy(src, src + px, part + r * px);
+     }
+}
+
+template <class TPixel>
+void roi_paste_rows(const VolumeROI & roi, const TPixel * part, TPixel * full)
+{
+     const long nx = roi.full.GetSize(0), ny = roi.full.GetSize(1);
+     const long px = roi.region.GetSize(0), py = roi.region.GetSize(1);
+     const long x0 = roi.region.GetIndex(0), y0 = roi.region.GetIndex(1), z0 = roi.region.GetIndex(2);
+     const long n_rows = py * roi.region.GetSize(2);
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  const TPixel * src = part + r * px;
+	  std::copy(src, src + px, full + ((z0 + r / py) * ny + y0 + r % py) * nx + x0);
+     }
+}
+
+// the ROI of a full-size volume, as a new volume.
+template <class TImage>
+typename TImage::Pointer roi_crop(const VolumeROI & roi, const itk::SmartPointer<TImage> & fullPtr)
+{
+     if (!roi.active) return fullPtr;
+     typename TImage::RegionType region;
+     region.SetSize(roi.region.GetSize());
+     typename TImage::PointType origin;
+     fullPtr->TransformIndexToPhysicalPoint(roi.region.GetIndex(), origin);
+
+     typename TImage::Pointer partPtr = TImage::New();
+     partPtr->SetRegions(region);
+     partPtr->Allocate();
+     partPtr->SetOrigin(origin);
+     partPtr->SetSpacing(fullPtr->GetSpacing());
+     partPtr->SetDirection(fullPtr->GetDirection());
+     roi_crop_rows(roi, fullPtr->GetBufferPointer(), partPtr->GetBufferPointer());
+     return partPtr;
+}
+
+// a full-size volume with the geometry of the input, with the ROI copied from
+// a volume of the ROI size and fill elsewhere.
+template <class TImage>
+typename TImage::Pointer roi_paste(const VolumeROI & roi, const itk::SmartPointer<TImage> & partPtr, typename TImage::PixelType fill)
+{
+     if (!roi.active) return partPtr;
+     typename TImage::Pointer fullPtr = TImage::New();
+     fullPtr->SetRegions(roi.full);
+     fullPtr->Allocate();
+     fullPtr->FillBuffer(fill);
+     fullPtr->SetOrigin(roi.origin);
+     fullPtr->SetSpacing(roi.spacing);
+     fullPtr->SetDirection(roi.direction);
+     roi_paste_rows(roi, partPtr->GetBufferPointer(), fullPtr->GetBufferPointer());
+     return fullPtr;
+}
+
+#endif
@@ -0,0 +1,353 @@
+#include <cmath>
+#include <cstdio>
+#include <utility.h>
+#include "itkFastMarchingImageToNodePairContainerAdaptor.h"
+#include "itkFastMarchingThresholdStoppingCriterion.h"
+#include <itkFastMarchingUpwindGradientImageFilterBase.h>
+#include "edt.h"
+#include "components.h"
+#include "roi.h"
+#include "stages.h"
+
+void lung_mask(ImageType3F::Pointer ctPtr, int low_th, int high_th, unsigned radius, bool edt, BitMask & lung, unsigned short verbose)
+{
+     ImageType3F::SizeType inSize = ctPtr->GetLargestPossibleRegion().GetSize();
+     const unsigned size[3] = {(unsigned)inSize[0], (unsigned)inSize[1], (unsigned)inSize[2]};
+     const float * inBuffer = ctPtr->GetBufferPointer();
+
+     // threshold. fslmaths -thr, -uthr, -abs and -bin on the integer volume
+     // keep the nonzero voxels in [low, high].
+     BitMask mask, tmp;
+     bm_allocate(mask, size);
+     const long n_rows = (long)size[1] * size[2];
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  const float * src = inBuffer + r * size[0];
+	  uint64_t * dst = &mask.bits[r * mask.n_words];
+	  for (unsigned x = 0; x < size[0]; x ++) {
+	       int v = (int)src[x];
+	       bool in_lung = v >= low_th && v <= high_th && v != 0;
+	       dst[x >> 6] |= (uint64_t)in_lung << (x & 63);
+	  }
+     }
+     if (verbose >= 1) printf("threshold: %ld voxels.\n", (long)bm_count(mask));
+
+     if (edt) edt_closing(mask, tmp, radius);
+     else bm_closing(mask, tmp, radius);
+     if (verbose >= 1) printf("closing: %ld voxels.\n", (long)bm_count(tmp));
+
+     if (edt) edt_opening(tmp, mask, radius);
+     else bm_opening(tmp, mask, radius);
+     if (verbose >= 1) printf("opening: %ld voxels.\n", (long)bm_count(mask));
+
+     unsigned n_comp = cc_keep_largest(mask, lung, 1, verbose);
+     if (verbose >= 1) printf("largest of %u components: %ld voxels.\n", n_comp, (long)bm_count(lung));
+}
+
+// CT intensities are integers, so the Gaussian density of all voxels is a
+// lookup table over the intensity range. Larger ranges, or non-integer
+// intensities, fall back to evaluating the density directly.
+#define MAX_LUT_SIZE (1 << 20)
+
+// per-class parameters. Each seed region defines one class and one output.
+struct DensityClass
+{
+     double mean;
+     double var;
+     double std;
+     double min_dist;             // min |x - mean| of the voxels in the body mask.
+     double max_dist;             // max |x - mean| of the voxels in the body mask.
+     double dmin;                 // min density of the whole volume.
+     double scale;                // 1 / (max density - min density).
+     std::vector<float> lut;      // normalized density of each integer intensity.
+     ImageType3F::Pointer outPtr;
+};
+
+static double gaussian_pdf(double x, double mean, double std)
+{
+     return exp(-0.5 * (x - mean) * (x - mean) / (std * std)) / (sqrt(2 * PI) * std);
+}
+
+static ImageType3F::Pointer new_like(ImageType3F::Pointer refPtr)
+{
+     ImageType3F::Pointer outPtr = ImageType3F::New();
+     outPtr->SetRegions(refPtr->GetLargestPossibleRegion());
+     outPtr->Allocate();
+     outPtr->SetOrigin(refPtr->GetOrigin());
+     outPtr->SetSpacing(refPtr->GetSpacing());
+     outPtr->SetDirection(refPtr->GetDirection());
+     return outPtr;
+}
+
+int density_map(ImageType3F::Pointer inPtr, const std::vector<ImageType3UC::Pointer> & seeds, const std::vector<float> & stds, const RLEMask & full_mask, const std::string & roi_mode, unsigned margin, bool speed_map, double alpha, std::vector<ImageType3F::Pointer> & outs, unsigned short verbose)
+{
+     const unsigned n_classes = seeds.size();
+     if (stds.size() != 1 && stds.size() != n_classes) {
+	  std::cout << "std must have one value, or one value for each seed region.\n";
+	  return 1;
+     }
+
+     // the seed and mask buffers are read at the offsets of the input voxels.
+     const ImageType3F::SizeType size = inPtr->GetLargestPossibleRegion().GetSize();
+     for (unsigned c = 0; c < n_classes; c ++) {
+	  if (seeds[c]->GetLargestPossibleRegion().GetSize() != size) {
+	       std::cout << "density_map(): seed region " << c << " has different size with input.
+";
+	       return 1;
+	  }
+     }
+     if (full_mask.size[0] != size[0] || full_mask.size[1] != size[1] || full_mask.size[2] != size[2]) {
+	  std::cout << "density_map(): mask has different size with input.
+";
+	  return 1;
+     }
+
+     RLEMask mask;
+     VolumeROI roi;
+     if (roi_init(roi, roi_mode, inPtr.GetPointer(), full_mask, margin, verbose)) {
+	  return 1;
+     }
+
+     const float * inBuffer = inPtr->GetBufferPointer();
+     const long n_voxels = inPtr->GetLargestPossibleRegion().GetNumberOfPixels();
+
+     // mean and variance of the intensity in each seed region (seed value 1).
+     std::vector<DensityClass> classes(n_classes);
+     for (unsigned c = 0; c < n_classes; c ++) {
+	  DensityClass & dc = classes[c];
+	  dc.std = stds.size() == 1? stds[0] : stds[c];
+	  const unsigned char * seedBuffer = seeds[c]->GetBufferPointer();
+
+	  double sum = 0, sum2 = 0;
+	  long n = 0;
+#pragma omp parallel for reduction(+:sum,sum2,n)
+	  for (long i = 0; i < n_voxels; i ++) {
+	       if (seedBuffer[i] == 1) {
+		    sum += inBuffer[i];
+		    sum2 += (double)inBuffer[i] * inBuffer[i];
+		    n ++;
+	       }
+	  }
+	  if (n == 0) {
+	       std::cout << "Seed region " << c << " is empty.\n";
+	       return 1;
+	  }
+	  dc.mean = sum / n;
+	  dc.var = n > 1? (sum2 - sum * sum / n) / (n - 1) : 0;
+	  if (verbose >=1 ) {
+	       printf("Seed region %u mean: %.2f, variance: %.2f.\n", c, dc.mean, dc.var);
+	  }
+     }
+
+     // the seed regions may be outside of the body mask, so only the rest is
+     // done on the ROI.
+     bool all_in_mask = (long)rle_count(full_mask) == n_voxels;
+     inPtr = roi_crop(roi, inPtr);
+     roi_crop(roi, full_mask, mask);
+     inBuffer = inPtr->GetBufferPointer();
+     const long n_rows = mask.n_rows();
+     const unsigned nx = mask.size[0];
+
+     // range of the intensity in the body mask, and the distance of the
+     // intensities to each class mean. The density is monotone in the
+     // distance, so these give the min and max density for normalization
+     // without computing the density volume first.
+     float lo = itk::NumericTraits<float>::max(), hi = itk::NumericTraits<float>::NonpositiveMin();
+     bool all_integer = true;
+     for (unsigned c = 0; c < n_classes; c ++) {
+	  classes[c].min_dist = itk::NumericTraits<double>::max();
+	  classes[c].max_dist = 0;
+     }
+#pragma omp parallel
+     {
+	  float my_lo = lo, my_hi = hi;
+	  bool my_integer = true;
+	  std::vector<double> my_min_dist(n_classes, itk::NumericTraits<double>::max()), my_max_dist(n_classes, 0);
+#pragma omp for schedule(dynamic, 64)
+	  for (long r = 0; r < n_rows; r ++) {
+	       for (size_t k = mask.row_start[r]; k < mask.row_start[r + 1]; k ++) {
+		    for (long i = r * nx + mask.runs[k].x0; i < r * nx + mask.runs[k].x1; i ++) {
+			 const float x = inBuffer[i];
+			 my_lo = std::min(my_lo, x);
+			 my_hi = std::max(my_hi, x);
+			 my_integer = my_integer && (x == floor(x));
+			 for (unsigned c = 0; c < n_classes; c ++) {
+			      double dist = fabs(x - classes[c].mean);
+			      my_min_dist[c] = std::min(my_min_dist[c], dist);
+			      my_max_dist[c] = std::max(my_max_dist[c], dist);
+			 }
+		    }
+	       }
+	  }
+#pragma omp critical
+	  {
+	       lo = std::min(lo, my_lo);
+	       hi = std::max(hi, my_hi);
+	       all_integer = all_integer && my_integer;
+	       for (unsigned c = 0; c < n_classes; c ++) {
+		    classes[c].min_dist = std::min(classes[c].min_dist, my_min_dist[c]);
+		    classes[c].max_dist = std::max(classes[c].max_dist, my_max_dist[c]);
+	       }
+	  }
+     }
+
+     if (lo > hi) {
+	  std::cout << "Body mask is empty.\n";
+	  return 1;
+     }
+     bool use_lut = all_integer && (hi - lo) < MAX_LUT_SIZE;
+     long lut_size = use_lut? (long)(hi - lo) + 1 : 0;
+     if (verbose >= 1) {
+	  printf("Intensity range in mask: [%.1f, %.1f]. %s.\n", lo, hi, use_lut? "Using lookup table" : "Lookup table not used");
+     }
+
+     // normalization to [0, 1] over the whole volume, same as a rescale
+     // intensity filter on the density volume. Voxels outside the body mask
+     // have zero density.
+     for (unsigned c = 0; c < n_classes; c ++) {
+	  DensityClass & dc = classes[c];
+	  double dmax = gaussian_pdf(dc.mean + dc.min_dist, dc.mean, dc.std);
+	  dc.dmin = all_in_mask? gaussian_pdf(dc.mean + dc.max_dist, dc.mean, dc.std) : 0;
+	  dc.scale = dmax > dc.dmin? 1 / (dmax - dc.dmin) : 0;
+	  if (use_lut) {
+	       dc.lut.resize(lut_size);
+	       for (long v = 0; v < lut_size; v ++) {
+		    dc.lut[v] = (gaussian_pdf(lo + v, dc.mean, dc.std) - dc.dmin) * dc.scale;
+	       }
+	  }
+	  dc.outPtr = new_like(inPtr);
+     }
+
+     // density, normalization, masking and optional speed regularization in
+     // one pass over each row. The row is filled with the value outside of the
+     // mask first, then the density is computed over the runs of the mask.
+     std::vector<float *> outBuffers(n_classes);
+     std::vector<float> outside(n_classes);
+     for (unsigned c = 0; c < n_classes; c ++) {
+	  outBuffers[c] = classes[c].outPtr->GetBufferPointer();
+	  outside[c] = - classes[c].dmin * classes[c].scale;
+     }
+     const float a = speed_map? alpha : 0, b = speed_map? 1 - alpha : 1;
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  for (unsigned c = 0; c < n_classes; c ++) {
+	       float * out = outBuffers[c] + r * nx;
+	       std::fill(out, out + nx, a + b * outside[c]);
+	       for (size_t k = mask.row_start[r]; k < mask.row_start[r + 1]; k ++) {
+		    for (long i = r * nx + mask.runs[k].x0; i < r * nx + mask.runs[k].x1; i ++) {
+			 float d;
+			 if (use_lut) {
+			      d = classes[c].lut[(long)(inBuffer[i] - lo)];
+			 }
+			 else {
+			      d = (gaussian_pdf(inBuffer[i], classes[c].mean, classes[c].std) - classes[c].dmin) * classes[c].scale;
+			 }
+			 outBuffers[c][i] = a + b * d;
+		    }
+	       }
+	  }
+     }
+
+     if (verbose >= 1) {
+	  // the density before normalization of the first class.
+	  ImageType3F::Pointer densityPtr = new_like(inPtr);
+	  densityPtr->FillBuffer(0);
+	  float * densityBuffer = densityPtr->GetBufferPointer();
+#pragma omp parallel for
+	  for (long r = 0; r < n_rows; r ++) {
+	       for (size_t k = mask.row_start[r]; k < mask.row_start[r + 1]; k ++) {
+		    for (long i = r * nx + mask.runs[k].x0; i < r * nx + mask.runs[k].x1; i ++) {
+			 densityBuffer[i] = gaussian_pdf(inBuffer[i], classes[0].mean, classes[0].std);
+		    }
+	       }
+	  }
+	  save_volume(roi_paste(roi, densityPtr, 0), "density.nii.gz");
+     }
+
+     outs.resize(n_classes);
+     for (unsigned c = 0; c < n_classes; c ++) {
+	  outs[c] = roi_paste(roi, classes[c].outPtr, a + b * outside[c]);
+     }
+     return 0;
+}
+
+typedef itk::FastMarchingUpwindGradientImageFilterBase< ImageType3F, ImageType3F > FastMarchingFilterType;
+typedef itk::FastMarchingImageToNodePairContainerAdaptor< ImageType3F, ImageType3F, ImageType3UC > AdaptorType;
+typedef FastMarchingFilterType::GradientImageType  FloatGradientImage;
+
+ImageType3F::Pointer fmm_time(ImageType3F::Pointer speedPtr, ImageType3UC::Pointer seedPtr, ImageType3UC::Pointer maskPtr, float stop_time, const std::string & roi_mode, unsigned margin, unsigned short verbose)
+{
+     // propagation stays in the mask, so the marcher only needs the bounding
+     // box of the mask.
+     RLEMask mask, outside;
+     rle_from_image(maskPtr.GetPointer(), mask);
+     VolumeROI roi;
+     if (roi_init(roi, roi_mode, maskPtr.GetPointer(), mask, margin, verbose)) {
+	  return 0;
+     }
+     speedPtr = roi_crop(roi, speedPtr);
+     maskPtr = roi_crop(roi, maskPtr);
+     seedPtr = roi_crop(roi, seedPtr);
+     rle_from_image(maskPtr.GetPointer(), mask);
+
+     FastMarchingFilterType::Pointer marcher = FastMarchingFilterType::New();
+     marcher->SetInput( speedPtr );
+
+     AdaptorType::Pointer adaptor = AdaptorType::New();
+     adaptor->SetTrialImage( seedPtr.GetPointer() );
+     adaptor->SetTrialValue( 1.0 );
+     adaptor->Update();
+
+     // the voxels outside of the mask are forbidden. They are collected from
+     // the gaps between the runs of the mask, instead of testing every voxel
+     // of the mask image in the adaptor.
+     rle_not(mask, outside);
+     typedef FastMarchingFilterType::NodePairContainerType NodePairContainerType;
+     typedef FastMarchingFilterType::NodePairType NodePairType;
+     NodePairContainerType::Pointer forbidden = NodePairContainerType::New();
+     forbidden->Reserve(rle_count(outside));
+     ImageType3UC::IndexType idx;
+     unsigned n = 0;
+     for (long r = 0; r < outside.n_rows(); r ++) {
+	  idx[1] = r % outside.size[1];
+	  idx[2] = r / outside.size[1];
+	  for (size_t k = outside.row_start[r]; k < outside.row_start[r + 1]; k ++) {
+	       for (unsigned x = outside.runs[k].x0; x < outside.runs[k].x1; x ++) {
+		    idx[0] = x;
+		    forbidden->InsertElement(n ++, NodePairType(idx, 0.0));
+	       }
+	  }
+     }
+
+     marcher->SetForbiddenPoints( forbidden );
+     marcher->SetTrialPoints( adaptor->GetTrialPoints() );
+
+     // stop criterion.
+     typedef  itk::FastMarchingThresholdStoppingCriterion< ImageType3F, ImageType3F > CriterionType;
+     CriterionType::Pointer criterion = CriterionType::New();
+     criterion->SetThreshold(stop_time);
+     marcher->SetStoppingCriterion( criterion );
+
+     // run the marcher.
+     marcher->Update();
+
+     if (verbose >= 1) {
+	  typedef itk::ImageFileWriter<FloatGradientImage> WriterType;
+	  WriterType::Pointer writer = WriterType::New();
+	  writer->SetInput(marcher->GetGradientImage());
+	  writer->SetFileName("fmm_gradient.mha");
+	  try {
+	       writer->Update();
+	       std::cout << "save_volume(): File " << "fmm_gradient.mha" << " saved.\n";
+	  }
+	  catch( itk::ExceptionObject & err )
+	  {
+	       std::cerr << "ExceptionObject caught !" << std::endl;
+	       std::cerr << err << std::endl;
+	  }
+     }
+
+     ImageType3F::Pointer timePtr = marcher->GetOutput();
+     timePtr->DisconnectPipeline();
+     return roi_paste(roi, timePtr, 0);
+}
@@ -0,0 +1,73 @@
+#ifndef __STAGES_H__
+#define __STAGES_H__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <common.h>
+#include "bitmask.h"
+#include "rle_mask.h"
+
+// In-memory stages of the lung and vessel extraction of documentation.tex.
+// Each tool of the sequence (lung_extract, est_density, fmm_upwind,
+// inverse_distmap) reads its inputs, calls its stage and saves the output;
+// vessel_pipeline calls all of them on volumes kept in memory.
+
+// lung mask of a CT volume: the nonzero voxels in [low_th, high_th], closing
+// and opening with a ball of the radius, and the largest connected component.
+// With edt, closing and opening are done by the distance transform, with the
+// same output.
+void lung_mask(ImageType3F::Pointer ctPtr, int low_th, int high_th, unsigned radius, bool edt, BitMask & lung, unsigned short verbose = 0);
+
+// Gaussian density of the intensity of each voxel, for one class per seed
+// volume (seed value 1). The mean is estimated from the seed region and the
+// standard deviation is given, one for all classes or one for each. The
+// density is normalized to [0, 1] over the whole volume and zero outside the
+// mask. With speed_map, the output is alpha + (1 - alpha) * density. roi_mode
+// and margin are the --roi and --margin options of the tools (see roi.h).
+// outs gets one full-size volume per class. Returns 1 on bad input. With
+// verbose >= 1, the density of the first class before normalization is also
+// saved as density.nii.gz.
+int density_map(ImageType3F::Pointer inPtr, const std::vector<ImageType3UC::Pointer> & seeds, const std::vector<float> & stds, const RLEMask & mask, const std::string & roi_mode, unsigned margin, bool speed_map, double alpha, std::vector<ImageType3F::Pointer> & outs, unsigned short verbose = 0);
+
+// time of arrival of the fast marching front on the speed volume, from the
+// seed voxels (value 1) until stop_time. The front does not leave the nonzero
+// voxels of the mask, and the time is 0 outside of them. Voxels of the mask
+// not reached before stop_time keep the large value of the marcher
+// (GetLargeValue()), which inverse_distance() turns into 0. Returns 0 on a
+// bad roi_mode. With verbose >= 1, the gradient of
+// the time is also saved as fmm_gradient.mha.
+ImageType3F::Pointer fmm_time(ImageType3F::Pointer speedPtr, ImageType3UC::Pointer seedPtr, ImageType3UC::Pointer maskPtr, float stop_time, const std::string & roi_mode, unsigned margin, unsigned short verbose = 0);
+
+// in place, max - value for the voxels of the mask with value below max, and 0
+// for other voxels. Turns a time of arrival into a heat map where vessels are
+// large.
+template <class TImage>
+void inverse_distance(TImage * image, const RLEMask & mask, unsigned max)
+{
+     typename TImage::PixelType * buffer = image->GetBufferPointer();
+
+     // the gaps between the runs of each row are outside of the mask and set
+     // to zero. Only the runs are inversed.
+     const long n_rows = mask.n_rows();
+     const unsigned nx = mask.size[0];
+#pragma omp parallel for
+     for (long r = 0; r < n_rows; r ++) {
+	  typename TImage::PixelType * row = buffer + r * nx;
+	  unsigned x = 0;
+	  for (size_t k = mask.row_start[r]; k < mask.row_start[r + 1]; k ++) {
+	       std::fill(row + x, row + mask.runs[k].x0, 0);
+	       for (x = mask.runs[k].x0; x < mask.runs[k].x1; x ++) {
+		    if (row[x] < max) {
+			 row[x] = max - row[x];
+		    }
+		    else {
+			 row[x] = 0;
+		    }
+	       }
+	  }
+	  std::fill(row + x, row + nx, 0);
+     }
+}
+
+#endif
@@ -1,254 +1,287 @@
 #include <common.h>
-int save_volume(ImageType3DF::Pointer ptr, std::string filename)
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include "pgzip.h"
+#include "utility.h"
+
+// save_volume() returns as soon as the volume is queued, and a few background
+// threads do the writing, so saving overlaps the computation after it. The
+// queue is flushed when the process exits.
+//
+// ITK writes .nii.gz through a single-threaded gzip stream. Instead, the
+// volume is written as .nii next to the output, then compressed in parallel
+// by pgzip_compress_file(). gzread, and so every NIfTI reader, reads the
+// members as one stream, and NiftiGzImageIO inflates them in parallel.
+#define N_SAVE_THREADS 2
+
+struct SaveJob
 {
+     itk::ProcessObject::Pointer writer; // writer of any image type.
+     std::string filename;
+     std::string tmp_file; // .nii written by the writer, or empty.
+};
 
-     WriterType3DF::Pointer writer = WriterType3DF::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
+struct SaveQueue
+{
+     pthread_mutex_t lock;
+     pthread_cond_t changed; // a job is queued or done, or stop is set.
+     std::deque<SaveJob> jobs;
+     unsigned n_busy;
+     unsigned n_failed;
+     bool stop;
+     std::vector<pthread_t> threads;
+
+     SaveQueue();
+     ~SaveQueue();
+     unsigned flush();
+};
+
+static void * save_worker(void * arg);
+
+SaveQueue::SaveQueue() : n_busy(0), n_failed(0), stop(false)
+{
+     pthread_mutex_init(&lock, 0);
+     pthread_cond_init(&changed, 0);
+     for (unsigned i = 0; i < N_SAVE_THREADS; i ++) {
+	  pthread_t t;
+	  if (pthread_create(&t, 0, save_worker, this) == 0) {
+	       threads.push_back(t);
+	  }
+     }
+}
 
-     return 0;
+// runs after main() returns. A failed save makes the exit status a failure.
+SaveQueue::~SaveQueue()
+{
+     unsigned n_failed = flush();
+     pthread_mutex_lock(&lock);
+     stop = true;
+     pthread_cond_broadcast(&changed);
+     pthread_mutex_unlock(&lock);
+     for (unsigned i = 0; i < threads.size(); i ++) {
+	  pthread_join(threads[i], 0);
+     }
+     if (n_failed > 0) {
+	  std::cerr << "save_volume(): " << n_failed << " volume(s) not saved.\n";
+	  // _exit() skips the flush of the stdio buffers at exit.
+	  std::cout.flush();
+	  fflush(0);
+	  _exit(EXIT_FAILURE);
+     }
 }
 
-int save_volume(ImageType3DI::Pointer ptr, std::string filename)
+// wait for the queued volumes. Returns the number of failed saves since the
+// last flush.
+unsigned SaveQueue::flush()
 {
+     pthread_mutex_lock(&lock);
+     while (!jobs.empty() || n_busy > 0) {
+	  pthread_cond_wait(&changed, &lock);
+     }
+     unsigned n = n_failed;
+     n_failed = 0;
+     pthread_mutex_unlock(&lock);
+     return n;
+}
 
-     WriterType3DI::Pointer writer = WriterType3DI::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
+// created by the first save_volume(), so it is destroyed before the ITK
+// globals created earlier.
+static SaveQueue & save_queue()
+{
+     static SaveQueue queue;
+     return queue;
+}
 
-     std::cout << "save_volume(): File " << filename << " saved.\n";
+static bool ends_with(const std::string & s, const std::string & suffix)
+{
+     return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
 
+static int run_job(SaveJob & job)
+{
+     try
+     {
+	  job.writer->Update();
+     }
+     catch( itk::ExceptionObject & err )
+     {
+	  std::cerr << "ExceptionObject caught !" << std::endl;
+	  std::cerr << err << std::endl;
+	  if (!job.tmp_file.empty()) remove(job.tmp_file.c_str());
+	  return EXIT_FAILURE;
+     }
+     if (!job.tmp_file.empty()) {
+	  int err = pgzip_compress_file(job.tmp_file, job.filename);
+	  remove(job.tmp_file.c_str());
+	  if (err) {
+	       std::cerr << "save_volume(): compressing " << job.filename << " failed.\n";
+	       return EXIT_FAILURE;
+	  }
+     }
+     std::cout << "save_volume(): File " << job.filename << " saved.\n";
      return 0;
 }
 
+static void * save_worker(void * arg)
+{
+     SaveQueue & q = *(SaveQueue *)arg;
+     pthread_mutex_lock(&q.lock);
+     while (true) {
+	  while (q.jobs.empty() && !q.stop) {
+	       pthread_cond_wait(&q.changed, &q.lock);
+	  }
+	  if (q.jobs.empty()) break;
+	  SaveJob job = q.jobs.front();
+	  q.jobs.pop_front();
+	  q.n_busy ++;
+	  pthread_mutex_unlock(&q.lock);
+
+	  int failed = run_job(job);
+	  // release the writer and so the buffer before taking the next job.
+	  job.writer = 0;
+
+	  pthread_mutex_lock(&q.lock);
+	  q.n_busy --;
+	  if (failed) q.n_failed ++;
+	  pthread_cond_broadcast(&q.changed);
+     }
+     pthread_mutex_unlock(&q.lock);
+     return 0;
+}
 
-int save_volume(ImageType3DU::Pointer ptr, std::string filename)
+unsigned save_volume_flush()
 {
+     return save_queue().flush();
+}
 
-     WriterType3DU::Pointer writer = WriterType3DU::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
+// run the pipeline of the volume on the calling thread, and queue a writer of
+// a copy that shares the buffer but not the pipeline, so the caller may
+// release its filters before the file is written. The volume must not be
+// changed after it is saved.
+template <class TImage>
+static int queue_volume(typename TImage::Pointer ptr, const std::string & filename)
+{
+     SaveQueue & q = save_queue();
+     typename TImage::Pointer copy = TImage::New();
+     try
+     {
+	  ptr->UpdateOutputInformation();
+	  ptr->SetRequestedRegionToLargestPossibleRegion();
+	  ptr->Update();
+	  copy->Graft(ptr);
+     }
+     catch( itk::ExceptionObject & err )
+     {
+	  std::cerr << "ExceptionObject caught !" << std::endl;
+	  std::cerr << err << std::endl;
 	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
-
+     }
+
+     SaveJob job;
+     job.filename = filename;
+     std::string write_file = filename;
+     if (ends_with(filename, ".nii.gz")) {
+	  // a unique name next to the output, so concurrent writers of the same
+	  // output do not share the temporary file.
+	  std::string name = filename + ".XXXXXX.nii";
+	  std::vector<char> tmp(name.begin(), name.end());
+	  tmp.push_back(0);
+	  int fd = mkstemps(&tmp[0], 4);
+	  if (fd < 0) {
+	       std::cerr << "save_volume(): can not create a temporary file for " << filename << ".\n";
+	       return EXIT_FAILURE;
+	  }
+	  close(fd);
+	  job.tmp_file = &tmp[0];
+	  write_file = job.tmp_file;
+     }
+
+     // the image IO is created on the calling thread, so the save threads do
+     // not use the IO factories.
+     itk::ImageIOBase::Pointer io = itk::ImageIOFactory::CreateImageIO(write_file.c_str(), itk::ImageIOFactory::WriteMode);
+     if (io.IsNull()) {
+	  std::cerr << "save_volume(): no image IO for " << filename << ".\n";
+	  if (!job.tmp_file.empty()) remove(job.tmp_file.c_str());
+	  return EXIT_FAILURE;
+     }
+     typedef itk::ImageFileWriter<TImage> WriterType;
+     typename WriterType::Pointer writer = WriterType::New();
+     writer->SetImageIO(io);
+     writer->SetInput(copy);
+     writer->SetFileName(write_file);
+     job.writer = writer.GetPointer();
+
+     // no thread could be started. Write here.
+     if (q.threads.empty()) {
+	  return run_job(job);
+     }
+     pthread_mutex_lock(&q.lock);
+     q.jobs.push_back(job);
+     pthread_cond_broadcast(&q.changed);
+     pthread_mutex_unlock(&q.lock);
      return 0;
 }
 
-
-int save_volume(ImageType3DC::Pointer ptr, std::string filename)
+int save_volume(ImageType3DF::Pointer ptr, std::string filename)
 {
+     return queue_volume<ImageType3DF>(ptr, filename);
+}
 
-     WriterType3DC::Pointer writer = WriterType3DC::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
+int save_volume(ImageType3DI::Pointer ptr, std::string filename)
+{
+     return queue_volume<ImageType3DI>(ptr, filename);
+}
 
-     std::cout << "save_volume(): File " << filename << " saved.\n";
+int save_volume(ImageType3DU::Pointer ptr, std::string filename)
+{
+     return queue_volume<ImageType3DU>(ptr, filename);
+}
 
-     return 0;
+int save_volume(ImageType3DC::Pointer ptr, std::string filename)
+{
+     return queue_volume<ImageType3DC>(ptr, filename);
 }
 
 int save_volume(ImageType3DUC::Pointer ptr, std::string filename)
 {
-
-     WriterType3DUC::Pointer writer = WriterType3DUC::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
-
-     return 0;
+     return queue_volume<ImageType3DUC>(ptr, filename);
 }
 
 int save_volume(ImageType3B::Pointer ptr, std::string filename)
 {
-
-     WriterType3B::Pointer writer = WriterType3B::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
-
-     return 0;
+     return queue_volume<ImageType3B>(ptr, filename);
 }
 
 int save_volume(ImageType2UC::Pointer ptr, std::string filename)
 {
-
-     WriterType2UC::Pointer writer = WriterType2UC::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
-
-     return 0;
+     return queue_volume<ImageType2UC>(ptr, filename);
 }
+
 int save_volume(ImageType3D::Pointer ptr, std::string filename)
 {
-
-     WriterType3D::Pointer writer = WriterType3D::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
-
-     return 0;
+     return queue_volume<ImageType3D>(ptr, filename);
 }
 
 int save_volume(ImageTypeArray3D::Pointer ptr, std::string filename)
 {
-
-     WriterTypeArray3D::Pointer writer = WriterTypeArray3D::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
-
-     return 0;
+     return queue_volume<ImageTypeArray3D>(ptr, filename);
 }
 
 int save_volume(ImageTypeArray3F::Pointer ptr, std::string filename)
 {
-
-     WriterTypeArray3F::Pointer writer = WriterTypeArray3F::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
-
-     return 0;
+     return queue_volume<ImageTypeArray3F>(ptr, filename);
 }
 
 int save_volume(ImageType4D::Pointer ptr, std::string filename)
 {
+     return queue_volume<ImageType4D>(ptr, filename);
+}
 
-     WriterType4D::Pointer writer = WriterType4D::New();
-	  
-     writer->SetInput(ptr);
-     writer->SetFileName(filename);
-     try 
-     { 
-	  writer->Update(); 
-     } 
-     catch( itk::ExceptionObject & err ) 
-     { 
-	  std::cerr << "ExceptionObject caught !" << std::endl; 
-	  std::cerr << err << std::endl; 
-	  return EXIT_FAILURE;
-     } 
-
-     std::cout << "save_volume(): File " << filename << " saved.\n";
-
-     return 0;
+int save_volume(ImageType4F::Pointer ptr, std::string filename)
+{
+     return queue_volume<ImageType4F>(ptr, filename);
 }
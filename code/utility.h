@@ -9,4 +9,10 @@ int save_volume(ImageType2UC::Pointer ptr, std::string filename);
 int save_volume(ImageType3D::Pointer ptr, std::string filename);
 int save_volume(ImageTypeArray3D::Pointer ptr, std::string filename);
 int save_volume(ImageType4D::Pointer ptr, std::string filename);
+int save_volume(ImageType4F::Pointer ptr, std::string filename);
 int save_volume(ImageTypeArray3F::Pointer ptr, std::string filename);
+
+// save_volume() queues the volume and returns, and background threads write
+// it. Wait for the queued volumes to be written. Returns the number of volumes
+// that could not be saved. Called at exit, too.
+unsigned save_volume_flush();
@@ -0,0 +1,66 @@
+#include <common.h>
+#include <unistd.h>
+#include "batch.h"
+
+namespace po = boost::program_options;
+int main(int argc, char* argv[])
+{
+     std::string manifest_file, stage_file, log_dir;
+     unsigned n_cores = 0;
+     unsigned long mem_mb = 0;
+     unsigned short verbose = 0;
+
+     po::options_description mydesc("Options can only used at commandline");
+     mydesc.add_options()
+	  ("help,h", "Run the stages of a pipeline on all the subjects of a manifest, in parallel under a core and memory budget.")
+	  ("manifest,m", po::value<std::string>(&manifest_file)->default_value("subjects.txt"),
+	   "Subjects, one per line: name key=value ... A command gets the name as {subject} and each value as {key}.")
+	  ("stages,s", po::value<std::string>(&stage_file)->default_value("stages.txt"),
+	   "Stages, one per line: name cores mem_mb deps command... deps is a comma separated list of earlier stages, or - for none.")
+	  ("cores,c", po::value<unsigned>(&n_cores)->default_value(0),
+	   "Number of cores to use. 0 for all the cores of the node.")
+	  ("mem", po::value<unsigned long>(&mem_mb)->default_value(0),
+	   "Memory in MB that the running stages may reserve together. 0 for the physical memory of the node.")
+	  ("logdir,l", po::value<std::string>(&log_dir),
+	   "If given, the output of each stage goes to logdir/subject.stage.log.")
+	  ("verbose,v", po::value<unsigned short>(&verbose)->default_value(0),
+	   "verbose level. 0 for minimal output. 3 for most output.");
+
+     po::variables_map vm;
+     po::store(po::parse_command_line(argc, argv, mydesc), vm);
+     po::notify(vm);
+
+     try {
+	  if ( (vm.count("help")) | (argc == 1) ) {
+	       std::cout << "Usage: vessel_batch [options]\n";
+	       std::cout << mydesc << "\n";
+	       return 0;
+	  }
+     }
+     catch(std::exception& e) {
+	  std::cout << e.what() << "\n";
+	  return 1;
+     }
+
+     std::vector<BatchStage> stages;
+     std::vector<BatchSubject> subjects;
+     if (batch_read_stages(stage_file, stages) || batch_read_manifest(manifest_file, subjects)) {
+	  return 1;
+     }
+     if (n_cores == 0) {
+	  n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+     }
+     if (mem_mb == 0) {
+	  mem_mb = (unsigned long)((double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / (1 << 20));
+     }
+     if (verbose >= 1) {
+	  printf("%u subjects, %u stages, %u cores, %lu MB.\n", (unsigned)subjects.size(), (unsigned)stages.size(), n_cores, mem_mb);
+     }
+
+     unsigned n_failed = batch_run(stages, subjects, n_cores, mem_mb, log_dir, verbose);
+     if (n_failed > 0) {
+	  std::cout << "vessel_batch: " << n_failed << " task(s) failed or skipped.\n";
+	  return 1;
+     }
+     return 0;
+}
@@ -0,0 +1,218 @@
+#include <cmath>
+#include <cstdio>
+#include "vessel_graph.h"
+
+int build_graph(lemon::StaticDigraph & g,
+		const RLEMask & mask,
+		ImageType3DU::Pointer nodemapPtr,
+		const ParType & par)
+{
+     // xplus, xminus, yplus, yminus, zplus, zminus
+     // std::array<unsigned int, 6 > neiIdxSet = {{14, 12, 16, 10, 22, 4}}; 
+     unsigned int nei_set_array[] = {4, 10, 12, 14, 16, 22, // 6 neighborhood
+				     1, 3, 5, 7, 9, 11, 15, 17, 19, 21, 23, 25, // 18 neighborhood
+				     0, 2, 6, 8, 18, 20, 24, 26}; // 26 neighborhood
+
+     if (par.n_nbrs != 6 && par.n_nbrs != 18 && par.n_nbrs != 26) {
+	  printf("build_graph(): number of neighbors must be 6, 18, or 26.\n");
+	  return 1;
+     }
+
+     const long nx = mask.size[0], ny = mask.size[1], nz = mask.size[2];
+     const long n_rows = mask.n_rows();
+     unsigned * nodemapBuffer = nodemapPtr->GetBufferPointer();
+
+     // compute total number of nodes, and build nodemap. This must be separate
+     // from building the edges below, since we need to know the nodemap in
+     // order to build edges. Nodes are numbered in the raster order of the
+     // voxels in the mask.
+     unsigned n_nodes = 0;
+     for (long r = 0; r < n_rows; r ++) {
+	  for (size_t k = mask.row_start[r]; k < mask.row_start[r + 1]; k ++) {
+	       for (long x = mask.runs[k].x0; x < mask.runs[k].x1; x ++) {
+		    nodemapBuffer[r * nx + x] = n_nodes;
+		    n_nodes ++;
+	       }
+	  }
+     }
+
+     // build edges, and also the costs. A neighbor is in the mask if it is in
+     // the volume and in a run of its row. The neighborhood index
+     // (dz+1)*9 + (dy+1)*3 + (dx+1) is the same as the one of a
+     // NeighborhoodIterator of radius 1.
+     std::vector<std::pair<int,int> > arcs;
+     unsigned short offset = 0;
+     unsigned cur_node_id = 0, nbr_node_id = 0;
+     for (long r = 0; r < n_rows; r ++) {
+	  const long y = r % ny, z = r / ny;
+	  for (size_t k = mask.row_start[r]; k < mask.row_start[r + 1]; k ++) {
+	       for (long x = mask.runs[k].x0; x < mask.runs[k].x1; x ++) {
+		    cur_node_id = nodemapBuffer[r * nx + x];
+		    for (unsigned neiIdx = 0; neiIdx < par.n_nbrs; neiIdx ++) {
+			 offset = nei_set_array[neiIdx];
+			 long nbr_x = x + offset % 3 - 1, nbr_y = y + offset / 3 % 3 - 1, nbr_z = z + offset / 9 - 1;
+			 if (nbr_x < 0 || nbr_x >= nx || nbr_y < 0 || nbr_y >= ny || nbr_z < 0 || nbr_z >= nz) continue;
+			 long nbr_r = nbr_z * ny + nbr_y;
+			 if (rle_find(mask, nbr_r, nbr_x) >= 0) {
+			      // neighbor also in mask.
+			      nbr_node_id = nodemapBuffer[nbr_r * nx + nbr_x];
+			      // undirected graph is represented by directed garph
+			      // with two arcs. Each node has the chance of becoming
+			      // neighboring node, hence two arcs will be added
+			      // eventrually.
+			      arcs.push_back(std::make_pair(cur_node_id, nbr_node_id));
+			 }
+		    } // neiIdx
+	       } // x
+	  } // k
+     } // r
+
+     // build the graph. 
+     g.build(n_nodes, arcs.begin(), arcs.end());     
+     return 0;
+}
+
+int build_ijk_map(lemon::StaticDigraph & g,
+		  lemon::StaticDigraph::NodeMap<itk::Index<3> > & ijkmap,
+		  const RLEMask & mask,
+		  ImageType3DU::Pointer nodemapPtr)
+
+{
+     const unsigned * nodemapBuffer = nodemapPtr->GetBufferPointer();
+     const long nx = mask.size[0], ny = mask.size[1];
+     itk::Index<3> idx;
+
+     // we use a push method. Given the ijk voxel coordinates, find the node, and update the ijkmap. 
+     for (long r = 0; r < mask.n_rows(); r ++) {
+	  idx[1] = r % ny;
+	  idx[2] = r / ny;
+	  for (size_t k = mask.row_start[r]; k < mask.row_start[r + 1]; k ++) {
+	       for (long x = mask.runs[k].x0; x < mask.runs[k].x1; x ++) {
+		    idx[0] = x;
+		    ijkmap[g.node(nodemapBuffer[r * nx + x])] = idx;
+	       }
+	  }
+     }
+     return 0;
+}
+
+
+int build_cost_map(lemon::StaticDigraph & g,
+		   ImageType3DF::Pointer vnessPtr,
+		   ImageTypeArray3F::Pointer evPtr,
+		   lemon::StaticDigraph::NodeMap<itk::Index<3> > & ijkmap,		   
+		   lemon::StaticDigraph::ArcMap<double> & costmap)
+{
+     itk::Offset<3> offset;
+     offset.Fill(0);
+     double sum_of_square = 0;
+     double proj_weight = 0; // the weight of vesselness when projected on a
+			     // axis.
+     double proj_vness = 0;
+     double mag = 0; // offset unit vector magnitude
+     ImageTypeArray3D::IndexType idx;
+     idx.Fill(0);
+     Array3F ev;
+     ev.Fill(0);
+
+     // we use offset as a unit vector, and project Hessian's eigenvector to
+     // this unit vector.
+     
+     for (lemon::StaticDigraph::ArcIt arcIt(g); arcIt != lemon::INVALID; ++ arcIt) {
+	  offset = ijkmap[g.target(arcIt)] - ijkmap[g.source(arcIt)];
+	  sum_of_square = (double)(offset[0]*offset[0] + offset[1]*offset[1] + offset[2]*offset[2]);
+	  mag = sqrt(sum_of_square);
+
+	  // eigenvector is assumed to be unit already.
+	  idx = ijkmap[g.source(arcIt)];
+	  ev = evPtr->GetPixel(idx);
+	  proj_weight = (ev[0] * (double)offset[0] + ev[1] * (double)offset[1] + ev[2] * (double)offset[2]);
+	  proj_weight = fabs(proj_weight) / mag;
+	  proj_vness = vnessPtr->GetPixel(idx) * proj_weight;
+	  // costmap[arcIt] = 1 / (proj_vness + 1);
+	  costmap[arcIt] = exp(- proj_vness);
+	  // costmap[arcIt] = exp(- vnessPtr->GetPixel(ijkmap[g.source(arcIt)]) ); 
+
+     }
+     return 0;
+}
+
+int find_target_nodes(std::set<lemon::StaticDigraph::Node> & target_set,
+		      lemon::StaticDigraph & g,
+		      ImageType3DC::Pointer maskPtr,
+		      ImageType3DU::Pointer nodemapPtr,
+		      const ParType & par)
+{
+     typedef itk::NeighborhoodIterator< ImageType3DC> NeighborhoodIteratorType;
+     typedef itk::ConstantBoundaryCondition<ImageType3DC>  BoundaryConditionType;
+
+     // Define neighborhood iterator on mask.
+     NeighborhoodIteratorType::RadiusType radius;
+     radius.Fill(1);
+     NeighborhoodIteratorType maskIt(radius, maskPtr, maskPtr->GetLargestPossibleRegion() );
+     BoundaryConditionType constCondition;
+     constCondition.SetConstant(-1);     
+     maskIt.OverrideBoundaryCondition(&constCondition);
+
+     ImageType3DU::IndexType nodemapIdx;
+     
+     // xplus, xminus, yplus, yminus, zplus, zminus
+     // std::array<unsigned int, 6 > neiIdxSet = {{14, 12, 16, 10, 22, 4}}; 
+     unsigned int nei_set_array[] = {4, 10, 12, 14, 16, 22, // 6 neighborhood
+				     1, 3, 5, 7, 9, 11, 15, 17, 19, 21, 23, 25, // 18 neighborhood
+				     0, 2, 6, 8, 18, 20, 24, 26}; // 26 neighborhood
+
+     if (par.n_nbrs != 6 && par.n_nbrs != 18 && par.n_nbrs != 26) {
+	  printf("find_target_nodes(): number of neighbors must be 6, 18, or 26.\n");
+	  return 1;
+     }
+
+     IteratorType3DU nodemapIt(nodemapPtr, nodemapPtr->GetLargestPossibleRegion());
+
+     // build edges.
+     std::vector<std::pair<int,int> > arcs;
+     unsigned short offset = 0;
+     unsigned cur_node_id = 0, nbr_node_id = 0;
+     ImageType3DC::SizeType maskSize = maskPtr->GetLargestPossibleRegion().GetSize();
+     if (maskSize[2] == 1) { // 2D image.
+	  for (maskIt.GoToBegin(), nodemapIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ nodemapIt) {
+	       if (maskIt.GetCenterPixel() > 0) {
+		    if (maskIt.GetPixel(10) <=0 || maskIt.GetPixel(12) <= 0 || maskIt.GetPixel(14) <= 0 || maskIt.GetPixel(16) <= 0) {
+			 // one neighbor falls outside of mask. Current voxel
+			 // must be on boundary.
+			 cur_node_id = nodemapIt.Get();
+			 target_set.insert(g.node(cur_node_id));
+		    }
+	       }
+	  } // maskIt
+     }
+
+     else { // 3D volume
+	  for (maskIt.GoToBegin(), nodemapIt.GoToBegin(); !maskIt.IsAtEnd(); ++ maskIt, ++ nodemapIt) {
+	       if (maskIt.GetCenterPixel() > 0) {
+		    unsigned neiIdx = 0;
+		    bool outside_nbr = false; // one neighbor is outside mask. 
+		    do {
+			 // for (unsigned neiIdx = 0; neiIdx < par.n_nbrs; neiIdx ++) {
+			 offset = nei_set_array[neiIdx];
+			 if (maskIt.GetPixel(offset) <= 0) {
+			      // tell if one neighbor is outside.
+			      outside_nbr = true;
+			      // std::cout << "find_target_nodes(): found " << maskIt.GetIndex() << std::endl;
+			 }
+			 neiIdx ++;
+		    }
+		    while(neiIdx < par.n_nbrs && !outside_nbr);
+
+		    if (outside_nbr) {
+			 // one neighbor falls outside of mask. Current voxel
+			 // must be on boundary.
+			 cur_node_id = nodemapIt.Get();
+			 target_set.insert(g.node(cur_node_id));
+		    }
+	       }
+	  } // maskIt
+     }
+
+     return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef __VESSEL_GRAPH_H__
+#define __VESSEL_GRAPH_H__
+
+#include <set>
+#include <common.h>
+#include "rle_mask.h"
+
+// Graph of the voxels of a mask for the minimal paths of dijk. Each voxel of
+// the mask is a node, numbered in the raster order of the voxels, and each
+// pair of neighbor voxels in the mask is joined by two arcs.
+
+// build the graph of the voxels of mask, with par.n_nbrs (6, 18 or 26)
+// neighbors. nodemapPtr, of the size of the mask, gets the node id of each
+// voxel of the mask. Returns 1 on a bad number of neighbors.
+int build_graph(lemon::StaticDigraph & g,
+		const RLEMask & mask,
+		ImageType3DU::Pointer nodemapPtr,
+		const ParType & par);
+
+// the voxel of each node of the graph built by build_graph().
+int build_ijk_map(lemon::StaticDigraph & g,
+		  lemon::StaticDigraph::NodeMap<itk::Index<3> > & ijkmap,
+		  const RLEMask & mask,
+		  ImageType3DU::Pointer nodemapPtr);
+
+// cost of each arc, exp(-v), where v is the vesselness of the source voxel
+// times the cosine of the angle between the arc and the Hessian eigenvector
+// of the voxel (assumed of unit length).
+int build_cost_map(lemon::StaticDigraph & g,
+		   ImageType3DF::Pointer vnessPtr,
+		   ImageTypeArray3F::Pointer evPtr,
+		   lemon::StaticDigraph::NodeMap<itk::Index<3> > & ijkmap,
+		   lemon::StaticDigraph::ArcMap<double> & costmap);
+
+// the nodes of the voxels of the mask with one of their par.n_nbrs neighbors
+// outside of the mask (4 face neighbors in a 2D image). Returns 1 on a bad
+// number of neighbors.
+int find_target_nodes(std::set<lemon::StaticDigraph::Node> & target_set,
+		      lemon::StaticDigraph & g,
+		      ImageType3DC::Pointer maskPtr,
+		      ImageType3DU::Pointer nodemapPtr,
+		      const ParType & par);
+
+#endif
@@ -0,0 +1,147 @@
+#include <common.h>
+#include <utility.h>
+#include "result_cache.h"
+#include "fillhole.h"
+#include "stages.h"
+
+namespace po = boost::program_options;
+int main(int argc, char* argv[])
+{
+     std::string in_file, seed_file, out_file, lung_file, density_file, fmm_file, roi_mode;
+     int low_th = -900, high_th = -360;
+     unsigned short radius = 5, verbose = 0;
+     unsigned margin = 1;
+     bool edt = false, fillhole = false;
+     float std = 120, stop_time = 500;
+
+     po::options_description mydesc("Because of the need of negative number as arguments, there is no short form of argument in this code.");
+     mydesc.add_options()
+	  ("help,h", "Lung and vessel extraction of documentation.tex in one process: lung_extract, (fillhole_filter), est_density, fmm_upwind and inverse_distmap, with all the intermediate volumes in memory.")
+	  ("input", po::value<std::string>(&in_file)->default_value("input.nii.gz"),
+	   "Input CT volume.")
+	  ("seed", po::value<std::string>(&seed_file)->default_value("seeds.nii.gz"),
+	   "Mask file of the seed region (value 1), for both the density estimation and the fast marching.")
+	  ("output", po::value<std::string>(&out_file)->default_value("vessel.nii.gz"),
+	   "Output vessel heat map, as inverse_distmap.")
+	  ("lung", po::value<std::string>(&lung_file),
+	   "If given, also save the lung mask.")
+	  ("density", po::value<std::string>(&density_file),
+	   "If given, also save the density map.")
+	  ("fmm", po::value<std::string>(&fmm_file),
+	   "If given, also save the time map of the fast marching.")
+	  ("low", po::value<int>(&low_th)->default_value(-900),
+	   "Lower threshold of the lung, as lung_extract.")
+	  ("high", po::value<int>(&high_th)->default_value(-360),
+	   "Higher threshold of the lung, as lung_extract.")
+	  ("radius", po::value<unsigned short>(&radius)->default_value(5),
+	   "Radius of the structure element of closing and opening of the lung.")
+	  ("edt", po::bool_switch(&edt),
+	   "Use the distance transform for closing and opening.")
+	  ("fillhole", po::bool_switch(&fillhole),
+	   "Fill the holes of the lung mask in each axial slice, as fillhole_filter.")
+	  ("std", po::value<float>(&std)->default_value(120),
+	   "Standard deviation of the Gaussian density, as est_density.")
+	  ("stoptime", po::value<float>(&stop_time)->default_value(500),
+	   "Stop time of the fast marching, and the max value of the heat map.")
+	  ("roi", po::value<std::string>(&roi_mode)->default_value("auto"),
+	   "full or auto, as the --roi of est_density and fmm_upwind.")
+	  ("margin", po::value<unsigned>(&margin)->default_value(1),
+	   "Margin of the ROI in voxels, with --roi auto.")
+	  ("verbose", po::value<unsigned short>(&verbose)->default_value(0),
+	   "verbose level. 0 for minimal output. 3 for most output.");
+
+     po::variables_map vm;
+     po::store(po::parse_command_line(argc, argv, mydesc, po::command_line_style::unix_style ^ po::command_line_style::allow_short), vm);
+     po::notify(vm);
+
+     try {
+	  if ( (vm.count("help")) | (argc == 1) ) {
+	       std::cout << "Usage: vessel_pipeline [options]\n";
+	       std::cout << mydesc << "\n";
+	       return 0;
+	  }
+     }
+     catch(std::exception& e) {
+	  std::cout << e.what() << "\n";
+	  return 1;
+     }
+
+     // reuse the outputs of an earlier run with the same inputs and options.
+     const char * cache_inputs[] = {"input", "seed"};
+     const char * cache_outputs[] = {"output", "lung", "density", "fmm"};
+     ResultCache rc;
+     // the volumes saved for debugging.
+     std::vector<std::string> debug_files;
+     if (verbose >= 1) {
+	  debug_files.push_back("density.nii.gz");
+	  debug_files.push_back("fmm_gradient.mha");
+     }
+     if (result_cache_restore(rc, "vessel_pipeline", vm, std::vector<std::string>(cache_inputs, cache_inputs + 2), std::vector<std::string>(cache_outputs, cache_outputs + 4), debug_files, verbose)) {
+	  return 0;
+     }
+
+     ReaderType3F::Pointer inReader = ReaderType3F::New();
+     inReader->SetFileName(in_file);
+     inReader->Update();
+     ImageType3F::Pointer inPtr = inReader->GetOutput();
+     inPtr->DisconnectPipeline();
+     inReader = 0;
+
+     ReaderType3UC::Pointer seedReader = ReaderType3UC::New();
+     seedReader->SetFileName(seed_file);
+     seedReader->Update();
+     ImageType3UC::Pointer seedPtr = seedReader->GetOutput();
+
+     // lung_extract, and optionally fillhole_filter.
+     BitMask lung;
+     lung_mask(inPtr, low_th, high_th, radius, edt, lung, verbose);
+     if (fillhole) {
+	  bm_fill_holes_2d(lung);
+	  if (verbose >= 1) printf("fill holes: %ld voxels.\n", (long)bm_count(lung));
+     }
+     ImageType3UC::Pointer lungPtr = ImageType3UC::New();
+     lungPtr->SetRegions(inPtr->GetLargestPossibleRegion());
+     lungPtr->Allocate();
+     lungPtr->SetOrigin(inPtr->GetOrigin());
+     lungPtr->SetSpacing(inPtr->GetSpacing());
+     lungPtr->SetDirection(inPtr->GetDirection());
+     bm_to_image(lung, lungPtr, 1, 0);
+     lung.bits.clear();
+     if (!lung_file.empty()) save_volume(lungPtr, lung_file);
+     RLEMask mask;
+     rle_from_image(lungPtr.GetPointer(), mask);
+
+     // est_density. The CT volume is not needed after it.
+     std::vector<ImageType3UC::Pointer> seeds(1, seedPtr);
+     std::vector<float> stds(1, std);
+     std::vector<ImageType3F::Pointer> densities;
+     if (density_map(inPtr, seeds, stds, mask, roi_mode, margin, false, 0, densities, verbose)) {
+	  return 1;
+     }
+     inPtr = 0;
+     if (!density_file.empty()) save_volume(densities[0], density_file);
+
+     // fmm_upwind with the density as the speed.
+     ImageType3F::Pointer timePtr = fmm_time(densities[0], seedPtr, lungPtr, stop_time, roi_mode, margin, verbose);
+     if (!timePtr) {
+	  return 1;
+     }
+     densities.clear();
+
+     // inverse_distmap, in place on the time map. The queued save of the time
+     // map must be written first.
+     unsigned n_failed = 0;
+     if (!fmm_file.empty()) {
+	  save_volume(timePtr, fmm_file);
+	  n_failed += save_volume_flush();
+     }
+     inverse_distance(timePtr.GetPointer(), mask, (unsigned)stop_time);
+     save_volume(timePtr, out_file);
+
+     n_failed += save_volume_flush();
+     if (n_failed > 0) {
+	  return 1;
+     }
+     result_cache_store(rc, verbose);
+     return 0;
+}
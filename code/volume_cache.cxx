@@ -0,0 +1,191 @@
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cerrno>
+#include <ctime>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "pgzip.h"
+#include "volume_cache.h"
+
+// a temporary file not modified for this long is left by a process that
+// died, even if its pid is running again.
+#define CACHE_STALE_AGE 3600
+
+struct CacheEntry
+{
+     std::string path;
+     time_t mtime; // time of the last use.
+     off_t size;
+     nlink_t nlink; // more than 1 if pinned.
+     bool operator<(const CacheEntry & e) const { return mtime < e.mtime; }
+};
+
+static unsigned long long cache_limit()
+{
+     const char * s = getenv("VESSEL_CACHE_MB");
+     return s? strtoull(s, 0, 10) << 20 : 0;
+}
+
+static std::string cache_dir()
+{
+     const char * s = getenv("VESSEL_CACHE_DIR");
+     return s && *s? s : "/dev/shm/vessel_cache";
+}
+
+// FNV-1a of the key.
+static unsigned long long hash_key(const std::string & key)
+{
+     unsigned long long h = 14695981039346656037ULL;
+     for (size_t i = 0; i < key.size(); i ++) {
+	  h ^= (unsigned char)key[i];
+	  h *= 1099511628211ULL;
+     }
+     return h;
+}
+
+// the pid in the name of a temporary file or pin, <hex>.tmp.<pid>.* or
+// <hex>.pin.<pid>.*. 0 if the name is neither.
+static long owner_pid(const std::string & name, bool & tmp)
+{
+     size_t p = name.find(".tmp.");
+     tmp = p != std::string::npos;
+     if (!tmp) p = name.find(".pin.");
+     return p == std::string::npos? 0 : atol(name.c_str() + p + 5);
+}
+
+// remove the least recently used entries until n_bytes more fit in limit.
+// The temporary files and pins of running processes count in the size; those
+// of processes that died are removed.
+static void evict(const std::string & dir, unsigned long long limit, unsigned long long n_bytes)
+{
+     DIR * d = opendir(dir.c_str());
+     if (!d) return;
+     std::vector<CacheEntry> entries;
+     std::set<ino_t> inodes; // a pin shares the space of its entry.
+     unsigned long long total = 0;
+     const time_t now = time(0);
+     struct dirent * de;
+     while ((de = readdir(d)) != 0) {
+	  std::string name = de->d_name;
+	  if (name == "." || name == "..") continue;
+	  CacheEntry e;
+	  e.path = dir + "/" + name;
+	  struct stat st;
+	  if (stat(e.path.c_str(), &st) != 0) continue;
+	  bool tmp = false;
+	  const long pid = owner_pid(name, tmp);
+	  if (pid > 0) {
+	       bool stale = (kill(pid, 0) != 0 && errno == ESRCH) || (tmp && now - st.st_mtime > CACHE_STALE_AGE);
+	       if (stale && remove(e.path.c_str()) == 0) continue;
+	  }
+	  else if (name.size() < 4 || name.compare(name.size() - 4, 4, ".nii") != 0) {
+	       continue;
+	  }
+	  if (inodes.insert(st.st_ino).second) total += st.st_size;
+	  if (pid > 0) continue;
+	  e.mtime = st.st_mtime;
+	  e.size = st.st_size;
+	  e.nlink = st.st_nlink;
+	  entries.push_back(e);
+     }
+     closedir(d);
+     std::sort(entries.begin(), entries.end());
+     // a pinned entry is removed from the cache, but its space is only freed
+     // when the pins are.
+     for (size_t i = 0; i < entries.size() && total + n_bytes > limit; i ++) {
+	  if (remove(entries[i].path.c_str()) == 0 && entries[i].nlink == 1) total -= entries[i].size;
+     }
+}
+
+// a hard link to path under a name of this process, so the data stays while
+// the caller reads it, even if another process evicts the entry. The name is
+// made unique by a mkstemp placeholder. Returns "" if path is gone.
+static std::string pin(const std::string & dir, const std::string & name, const std::string & path)
+{
+     char suffix[48];
+     snprintf(suffix, sizeof(suffix), ".pin.%ld.XXXXXX", (long)getpid());
+     const std::string s = dir + name + suffix;
+     std::vector<char> placeholder(s.begin(), s.end());
+     placeholder.push_back(0);
+     int fd = mkstemp(&placeholder[0]);
+     if (fd < 0) return "";
+     close(fd);
+     std::string pinned = std::string(&placeholder[0]) + ".nii";
+     if (link(path.c_str(), pinned.c_str()) != 0) pinned.clear();
+     remove(&placeholder[0]);
+     return pinned;
+}
+
+std::string volume_cache_get(const std::string & gz_file, bool & owned, unsigned short verbose)
+{
+     owned = false;
+     const unsigned long long limit = cache_limit();
+     if (limit == 0) return "";
+     struct stat st;
+     char real[PATH_MAX];
+     if (stat(gz_file.c_str(), &st) != 0 || !realpath(gz_file.c_str(), real)) return "";
+
+     // the modification time to the nanosecond and the inode, so a file
+     // rewritten within a second at the same size gets a new entry.
+     char key[96];
+     snprintf(key, sizeof(key), ":%lld:%lld:%lld.%09ld", (long long)st.st_size, (long long)st.st_ino, (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+     char name[32];
+     snprintf(name, sizeof(name), "/%016llx", hash_key(std::string(real) + key));
+     const std::string dir = cache_dir();
+     const std::string path = dir + name + ".nii";
+
+     // a hit, if the entry can be pinned. The modification time records the
+     // use for the eviction.
+     std::string pinned = pin(dir, name, path);
+     if (!pinned.empty()) {
+	  utimes(pinned.c_str(), 0);
+	  if (verbose >= 1) {
+	       printf("volume_cache_get(): %s found in the cache.\n", gz_file.c_str());
+	  }
+	  owned = true;
+	  return pinned;
+     }
+
+     mkdir(dir.c_str(), 0777);
+     char suffix[48];
+     snprintf(suffix, sizeof(suffix), ".tmp.%ld.XXXXXX.nii", (long)getpid());
+     std::string tmp = dir + name + suffix;
+     std::vector<char> tmp_name(tmp.begin(), tmp.end());
+     tmp_name.push_back(0);
+     int fd = mkstemps(&tmp_name[0], 4);
+     if (fd < 0) return "";
+     tmp = &tmp_name[0];
+     int err = pgzip_decompress_file(gz_file, fd, verbose);
+     if (fstat(fd, &st) != 0) err = 1;
+     if (close(fd) != 0) err = 1;
+     if (err) {
+	  remove(tmp.c_str());
+	  return "";
+     }
+     if ((unsigned long long)st.st_size > limit) {
+	  owned = true;
+	  return tmp;
+     }
+     // processes that miss at the same time all decompress, and the last
+     // rename wins. The new entry is pinned before it is visible to the
+     // eviction of other processes.
+     evict(dir, limit, st.st_size);
+     pinned = pin(dir, name, tmp);
+     owned = true;
+     if (pinned.empty() || rename(tmp.c_str(), path.c_str()) != 0) {
+	  if (!pinned.empty()) remove(pinned.c_str());
+	  return tmp;
+     }
+     if (verbose >= 1) {
+	  printf("volume_cache_get(): %s added to the cache.\n", gz_file.c_str());
+     }
+     return pinned;
+}
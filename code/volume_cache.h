@@ -0,0 +1,30 @@
+#ifndef __VOLUME_CACHE_H__
+#define __VOLUME_CACHE_H__
+
+#include <string>
+
+// Cache of decompressed volumes shared by the tools of a pipeline run. The
+// first read of a .nii.gz decompresses it into a .nii in the cache directory,
+// on tmpfs (/dev/shm, where POSIX shared memory lives) by default. Later
+// reads of the same file by any process use that .nii: readers skip the
+// decompression, and read_volume_mapped() maps it without reading at all.
+//
+// Entries are keyed by the real path, size, inode and modification time (in
+// nanoseconds) of the .nii.gz, so a rewritten file gets a new entry. When an entry is added, the
+// least recently used entries are removed until the cache fits its size.
+// Processes that have an entry open or mapped keep it until they close it,
+// and an entry handed out by volume_cache_get() is pinned by a hard link
+// until the caller removes it. Temporary files and pins left by processes
+// that died are removed by the eviction.
+//
+// The cache is off unless VESSEL_CACHE_MB gives its size in MB.
+// VESSEL_CACHE_DIR sets the directory (default /dev/shm/vessel_cache).
+
+// the decompressed .nii of a .nii.gz. On a miss the file is decompressed
+// into the cache. The returned file is private to the caller: a link to the
+// entry, or a copy if the .nii could not be kept in the cache (it is larger
+// than the cache). owned is set if the caller must remove it after use.
+// Returns "" if the cache is off or the file cannot be decompressed.
+std::string volume_cache_get(const std::string & gz_file, bool & owned, unsigned short verbose = 0);
+
+#endif
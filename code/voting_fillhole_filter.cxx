@@ -1,13 +1,14 @@
 #include <common.h>
 #include <utility.h>
-#include <itkVotingBinaryHoleFillingImageFilter.h>
 #include "itkSubtractImageFilter.h"
+#include "votingfill.h"
 
 namespace po = boost::program_options;
 int main(int argc, char* argv[])
 {
      std::string in_file, out_file, diff_file;
      unsigned short radius = 5, verbose = 0;
+     unsigned majority = 1, maxit = 1;
      bool diff = false;
 
      po::options_description mydesc("Options can only used at commandline");
@@ -19,6 +20,10 @@ int main(int argc, char* argv[])
 	    "Output binary volumge.")
 	  ("radius,r", po::value<unsigned short>(&radius)->default_value(5), 
 	   "Radius of the structure elment.")  
+	  ("majority,j", po::value<unsigned>(&majority)->default_value(1),
+	   "A background voxel is filled if the foreground voxels in its neighborhood exceed half of the neighborhood by this number.")
+	  ("maxit,n", po::value<unsigned>(&maxit)->default_value(1),
+	   "Max number of voting iterations. Stops early if no voxel changes. 0 to iterate until no voxel changes.")
 	  ("diff,d", po::bool_switch(&diff),
 	   "Whether print the different of the intput and output images.")       
 	   ("diffout,t", po::value<std::string>(&diff_file)->default_value("diff.nii.gz"), 
@@ -49,26 +54,27 @@ int main(int argc, char* argv[])
      inReader->Update();
      ImageType3UC::Pointer inPtr = inReader->GetOutput();
 
-     typedef itk::VotingBinaryHoleFillingImageFilter <ImageType3UC, ImageType3UC>  FilterType;
-     FilterType::Pointer myFilter = FilterType::New();
-     FilterType::InputSizeType radiusSize;
-     radiusSize[0] = radius;
-     radiusSize[1] = radius;
-     radiusSize[2] = radius;
+     // vote on a copy of the input, so the difference can still be saved.
+     ImageType3UC::Pointer outPtr = ImageType3UC::New();
+     outPtr->SetRegions(inPtr->GetLargestPossibleRegion());
+     outPtr->Allocate();
+     outPtr->SetOrigin(inPtr->GetOrigin());
+     outPtr->SetSpacing(inPtr->GetSpacing());
+     outPtr->SetDirection(inPtr->GetDirection());
+     ImageType3UC::SizeType inSize = inPtr->GetLargestPossibleRegion().GetSize();
+     const unsigned size[3] = {(unsigned)inSize[0], (unsigned)inSize[1], (unsigned)inSize[2]};
+     std::copy(inPtr->GetBufferPointer(), inPtr->GetBufferPointer() + inPtr->GetLargestPossibleRegion().GetNumberOfPixels(), outPtr->GetBufferPointer());
 
-     myFilter->SetInput(inPtr);
-     myFilter->SetForegroundValue(1);
-     myFilter->SetBackgroundValue(0);
-     myFilter->SetRadius(radiusSize);
-     myFilter->Update();
-     save_volume(myFilter->GetOutput(), out_file);
+     unsigned long n_filled = voting_fill_holes(outPtr->GetBufferPointer(), size, radius, majority, maxit, 1, 0, verbose);
+     if (verbose >= 1) printf("%ld voxels filled.\n", (long)n_filled);
+     save_volume(outPtr, out_file);
 
      // print
      if (diff) {
 	  typedef itk::SubtractImageFilter<ImageType3UC> SubtractType;
 	  SubtractType::Pointer diff = SubtractType::New();
 	  diff->SetInput1(inPtr);
-	  diff->SetInput2(myFilter->GetOutput());
+	  diff->SetInput2(outPtr);
 	  save_volume(diff->GetOutput(), diff_file);
      }
 
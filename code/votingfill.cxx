@@ -0,0 +1,217 @@
+#include <cstdio>
+#include <climits>
+#include <algorithm>
+#include <vector>
+#include "votingfill.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// voxels to vote on: the rectangle [x0, x1) x [y0, y1) of the slices [z0, z1).
+struct VoteJob
+{
+     unsigned z0, z1;
+     unsigned x0, x1;
+     unsigned y0, y1;
+};
+
+// scratch buffers of one thread.
+struct VoteScratch
+{
+     std::vector<unsigned char> pad;
+     std::vector<unsigned> xsum;
+     std::vector<unsigned> colsum;
+     std::vector<std::vector<unsigned> > planes; // ring of 2r+1 square sums.
+     std::vector<unsigned> zsum;
+};
+
+static inline unsigned clamp(long i, unsigned n)
+{
+     return i < 0? 0 : (i >= (long)n? n - 1 : i);
+}
+
+// foreground count of the (2r+1)^2 square around each voxel of the job
+// rectangle of slice z, by sliding sums along x, then along y.
+static void square_sums(const unsigned char * buffer, const unsigned size[3], const VoteJob & job, unsigned z, unsigned r, unsigned char foreground, VoteScratch & s, std::vector<unsigned> & plane)
+{
+     const unsigned nx = size[0], ny = size[1];
+     const unsigned w = job.x1 - job.x0, h = job.y1 - job.y0;
+     // rows needed by the y window of the rectangle.
+     const unsigned ylo = job.y0 > r? job.y0 - r : 0, yhi = std::min(ny, job.y1 + r);
+
+     s.pad.resize(w + 2 * r + 1);
+     s.xsum.resize((size_t)(yhi - ylo) * w);
+     for (unsigned y = ylo; y < yhi; y ++) {
+	  const unsigned char * row = buffer + ((size_t)z * ny + y) * nx;
+	  // the row with the border voxels repeated, as 0/1.
+	  for (unsigned i = 0; i < w + 2 * r + 1; i ++) {
+	       s.pad[i] = row[clamp((long)job.x0 - (long)r + i, nx)] == foreground;
+	  }
+	  unsigned sum = 0;
+	  for (unsigned i = 0; i < 2 * r + 1; i ++) sum += s.pad[i];
+	  unsigned * dst = &s.xsum[(size_t)(y - ylo) * w];
+	  for (unsigned j = 0; j < w; j ++) {
+	       dst[j] = sum;
+	       sum += s.pad[j + 2 * r + 1];
+	       sum -= s.pad[j];
+	  }
+     }
+
+     s.colsum.assign(w, 0);
+     for (long d = - (long)r; d <= (long)r; d ++) {
+	  const unsigned * src = &s.xsum[(size_t)(clamp((long)job.y0 + d, ny) - ylo) * w];
+	  for (unsigned j = 0; j < w; j ++) s.colsum[j] += src[j];
+     }
+     plane.resize((size_t)h * w);
+     for (unsigned y = job.y0; y < job.y1; y ++) {
+	  std::copy(s.colsum.begin(), s.colsum.end(), plane.begin() + (size_t)(y - job.y0) * w);
+	  if (y + 1 == job.y1) break;
+	  const unsigned * add = &s.xsum[(size_t)(clamp((long)y + r + 1, ny) - ylo) * w];
+	  const unsigned * sub = &s.xsum[(size_t)(clamp((long)y - r, ny) - ylo) * w];
+	  for (unsigned j = 0; j < w; j ++) s.colsum[j] += add[j] - sub[j];
+     }
+}
+
+// vote on the voxels of a job. The square sums of the slices in the z window
+// are kept in a ring, and the box count is their running sum along z. The
+// offsets of the voxels to fill are appended to changed.
+static void vote(const unsigned char * buffer, const unsigned size[3], const VoteJob & job, unsigned r, unsigned birth, unsigned char foreground, unsigned char background, VoteScratch & s, std::vector<size_t> & changed)
+{
+     const unsigned nx = size[0], ny = size[1], nz = size[2];
+     const unsigned w = job.x1 - job.x0, h = job.y1 - job.y0;
+     const unsigned n_slots = 2 * r + 1;
+     s.planes.resize(n_slots);
+
+     // the window of distinct slices spans at most 2r+1 consecutive slices, so
+     // slice k can always live in slot k % (2r+1).
+     for (unsigned k = clamp((long)job.z0 - r, nz); k <= clamp((long)job.z0 + r, nz); k ++) {
+	  square_sums(buffer, size, job, k, r, foreground, s, s.planes[k % n_slots]);
+     }
+     s.zsum.assign((size_t)h * w, 0);
+     for (long d = - (long)r; d <= (long)r; d ++) {
+	  const std::vector<unsigned> & p = s.planes[clamp((long)job.z0 + d, nz) % n_slots];
+	  for (size_t i = 0; i < s.zsum.size(); i ++) s.zsum[i] += p[i];
+     }
+
+     for (unsigned z = job.z0; z < job.z1; z ++) {
+	  for (unsigned y = job.y0; y < job.y1; y ++) {
+	       size_t offset = ((size_t)z * ny + y) * nx + job.x0;
+	       const unsigned * count = &s.zsum[(size_t)(y - job.y0) * w];
+	       for (unsigned j = 0; j < w; j ++) {
+		    if (buffer[offset + j] == background && count[j] >= birth) {
+			 changed.push_back(offset + j);
+		    }
+	       }
+	  }
+	  if (z + 1 == job.z1) break;
+
+	  // slide the window: slice z-r leaves, slice z+r+1 enters.
+	  const std::vector<unsigned> & sub = s.planes[clamp((long)z - r, nz) % n_slots];
+	  for (size_t i = 0; i < s.zsum.size(); i ++) s.zsum[i] -= sub[i];
+	  if (z + r + 1 < nz) {
+	       square_sums(buffer, size, job, z + r + 1, r, foreground, s, s.planes[(z + r + 1) % n_slots]);
+	  }
+	  const std::vector<unsigned> & add = s.planes[clamp((long)z + r + 1, nz) % n_slots];
+	  for (size_t i = 0; i < s.zsum.size(); i ++) s.zsum[i] += add[i];
+     }
+}
+
+// split the slices [z0, z1) with the rectangle into jobs for the threads. A
+// job starts with 2r+1 square sums, so jobs are not much shorter than that.
+static void add_jobs(std::vector<VoteJob> & jobs, unsigned z0, unsigned z1, unsigned x0, unsigned x1, unsigned y0, unsigned y1, unsigned r)
+{
+     unsigned n_threads = 1;
+#ifdef _OPENMP
+     n_threads = omp_get_max_threads();
+#endif
+     unsigned len = std::max(2 * (2 * r + 1), (z1 - z0 + n_threads - 1) / n_threads);
+     for (unsigned z = z0; z < z1; z += len) {
+	  VoteJob job = {z, std::min(z1, z + len), x0, x1, y0, y1};
+	  jobs.push_back(job);
+     }
+}
+
+unsigned long voting_fill_holes(unsigned char * buffer, const unsigned size[3], unsigned radius, unsigned majority, unsigned max_iter, unsigned char foreground, unsigned char background, unsigned short verbose)
+{
+     const unsigned nx = size[0], ny = size[1], nz = size[2], r = radius;
+     const unsigned side = 2 * r + 1;
+     const unsigned birth = side * side * side / 2 + majority;
+
+     // the first iteration votes on all voxels.
+     std::vector<VoteJob> jobs;
+     add_jobs(jobs, 0, nz, 0, nx, 0, ny, r);
+
+     unsigned long n_filled = 0;
+     std::vector<size_t> changed;
+     for (unsigned it = 0; (max_iter == 0 || it < max_iter) && !jobs.empty(); it ++) {
+	  size_t n_voted = 0;
+	  for (unsigned j = 0; j < jobs.size(); j ++) {
+	       n_voted += (size_t)(jobs[j].z1 - jobs[j].z0) * (jobs[j].y1 - jobs[j].y0) * (jobs[j].x1 - jobs[j].x0);
+	  }
+
+	  // all jobs vote on the result of the previous iteration, and the
+	  // changes are applied afterwards.
+	  changed.clear();
+#pragma omp parallel
+	  {
+	       VoteScratch scratch;
+	       std::vector<size_t> my_changed;
+#pragma omp for schedule(dynamic)
+	       for (int j = 0; j < (int)jobs.size(); j ++) {
+		    vote(buffer, size, jobs[j], r, birth, foreground, background, scratch, my_changed);
+	       }
+#pragma omp critical
+	       changed.insert(changed.end(), my_changed.begin(), my_changed.end());
+	  }
+	  for (size_t i = 0; i < changed.size(); i ++) {
+	       buffer[changed[i]] = foreground;
+	  }
+	  n_filled += changed.size();
+	  if (verbose >= 1) {
+	       printf("voting_fill_holes(): iteration %u, %ld voxels voted, %ld voxels filled.\n", it + 1, (long)n_voted, (long)changed.size());
+	  }
+
+	  // active set of the next iteration: the counts only change within r
+	  // of a filled voxel. Bounding rectangle of the changes of each slice,
+	  // grown by r in x and y, and spread to the slices within r.
+	  std::vector<unsigned> cx0(nz, UINT_MAX), cx1(nz, 0), cy0(nz, UINT_MAX), cy1(nz, 0);
+	  for (size_t i = 0; i < changed.size(); i ++) {
+	       unsigned x = changed[i] % nx, y = changed[i] / nx % ny, z = changed[i] / ((size_t)nx * ny);
+	       cx0[z] = std::min(cx0[z], x);
+	       cx1[z] = std::max(cx1[z], x + 1);
+	       cy0[z] = std::min(cy0[z], y);
+	       cy1[z] = std::max(cy1[z], y + 1);
+	  }
+	  std::vector<unsigned> ax0(nz, UINT_MAX), ax1(nz, 0), ay0(nz, UINT_MAX), ay1(nz, 0);
+	  for (unsigned z = 0; z < nz; z ++) {
+	       if (cx0[z] == UINT_MAX) continue;
+	       for (unsigned k = clamp((long)z - r, nz); k <= clamp((long)z + r, nz); k ++) {
+		    ax0[k] = std::min(ax0[k], cx0[z] > r? cx0[z] - r : 0);
+		    ax1[k] = std::max(ax1[k], std::min(nx, cx1[z] + r));
+		    ay0[k] = std::min(ay0[k], cy0[z] > r? cy0[z] - r : 0);
+		    ay1[k] = std::max(ay1[k], std::min(ny, cy1[z] + r));
+	       }
+	  }
+
+	  // runs of active slices share the union of their rectangles, so the
+	  // square sums can slide along z.
+	  jobs.clear();
+	  unsigned z = 0;
+	  while (z < nz) {
+	       if (ax0[z] == UINT_MAX) {
+		    z ++;
+		    continue;
+	       }
+	       unsigned z0 = z, x0 = ax0[z], x1 = ax1[z], y0 = ay0[z], y1 = ay1[z];
+	       for (; z < nz && ax0[z] != UINT_MAX; z ++) {
+		    x0 = std::min(x0, ax0[z]);
+		    x1 = std::max(x1, ax1[z]);
+		    y0 = std::min(y0, ay0[z]);
+		    y1 = std::max(y1, ay1[z]);
+	       }
+	       add_jobs(jobs, z0, z, x0, x1, y0, y1, r);
+	  }
+     }
+     return n_filled;
+}
@@ -0,0 +1,20 @@
+#ifndef __VOTINGFILL_H__
+#define __VOTINGFILL_H__
+
+// Voting hole filling on a volume buffer, same as ITK's
+// VotingBinaryHoleFillingImageFilter (max_iter = 1) and
+// VotingBinaryIterativeHoleFillingImageFilter: a background voxel becomes
+// foreground if at least (2r+1)^3 / 2 + majority voxels of the box of radius r
+// around it are foreground. Voxels outside the volume take the value of the
+// nearest voxel on the border, as ITK's ZeroFluxNeumannBoundaryCondition.
+// Each iteration votes on the result of the previous one, until no voxel
+// changes or max_iter iterations are done. max_iter = 0 iterates to
+// convergence.
+//
+// The box counts are separable sliding sums along x, y and z, so the cost per
+// voxel does not depend on the radius. After the first iteration, only the
+// slices within r of a change are voted again, on the bounding rectangle of
+// the changes grown by r. Returns the number of voxels filled.
+unsigned long voting_fill_holes(unsigned char * buffer, const unsigned size[3], unsigned radius, unsigned majority, unsigned max_iter, unsigned char foreground, unsigned char background, unsigned short verbose = 0);
+
+#endif
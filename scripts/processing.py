@@ -15,6 +15,7 @@ def convert_dicom(in_dir, out_dir, n_cores):
     n_cores: the number of cpu cores available for conversion. The script use a pool of size n_cores for parallel converting multiple files. 
     """
 
+    bin_dir = '/home/weiliu/projects/vessel/build/'
     all_dicom_dirs = [d for d in os.listdir(in_dir) if fnmatch.fnmatch(d, 'PE*')]
     all_dicom_dirs.sort()
 
@@ -48,7 +49,7 @@ def convert_dicom(in_dir, out_dir, n_cores):
                 (this_name, this_ext) = os.path.splitext(dicom_files[0])
                 if (this_ext == '.dcm') or  (this_ext == '.dcm '):
                     print 'working on {}'.format(dicom_dir)
-                    proc_set.add(subprocess.Popen(['/scratch/packages/itk_apps/ConvertBetweenFileFormats/ConvertBetweenFileFormats', dicom_dir, os.path.join(out_dir, this_PE + '.nii.gz')], stdout = subprocess.PIPE))
+                    proc_set.add(subprocess.Popen([os.path.join(bin_dir, 'dicom_to_volume'), '-i', dicom_dir, '-o', os.path.join(out_dir, this_PE + '.nii.gz')], stdout = subprocess.PIPE))
                 else:
                     print '{} does not have .dcm. {} need manual conversion'.format(dicom_files[0], dicom_dir)
 
@@ -72,21 +73,8 @@ def extract_lung(in_image, out_image, low_th, high_th):
     """
 
     bin_dir = '/home/weiliu/projects/vessel/build/'
-    subprocess.call(['fslmaths', '-dt', 'int', in_image, '-thr', low_th, out_image, '-odt', 'int'])
-    subprocess.call(['fslmaths', '-dt', 'int', out_image, '-uthr', high_th, out_image, '-odt', 'int'])
-    subprocess.call(['fslmaths', '-dt', 'int', out_image, '-abs', out_image, '-odt', 'int'])
-
-    subprocess.call(['fslmaths', out_image, '-bin', out_image, '-odt', 'char'])
-    # multiple by 255 so the morphology filter can handle it.
-    subprocess.call(['fslmaths', out_image, '-mul', '255', out_image])
-
-    # morphology closing
-    subprocess.call([os.path.join(bin_dir, 'closing_filter'), '-i', out_image, '-o', out_image, '-r', '5'])
-
-    # morphology opening
-    subprocess.call([os.path.join(bin_dir, 'opening_filter'), '-i', out_image, '-o', out_image, '-r', '5'])
-    # find the largest component.
-    subprocess.call([os.path.join(bin_dir, 'connected_comp'), '-i', out_image, '-o', out_image])
+    # threshold, closing, opening and the largest component in one process.
+    subprocess.call([os.path.join(bin_dir, 'lung_extract'), '--input', in_image, '--output', out_image, '--low={}'.format(low_th), '--high={}'.format(high_th), '--radius', '5'])
 
 
 def extract_body(in_image, out_image, th):
@@ -100,25 +88,10 @@ def extract_body(in_image, out_image, th):
     """
     
     bin_dir = '/home/weiliu/projects/vessel/build/'
-    subprocess.call(['fslmaths', '-dt', 'int', in_image, '-uthr', th, out_image, '-odt', 'int'])
-
-    # add one, so body will be one, and backgrounds are still negative. 
-    subprocess.call(['fslmaths', '-dt', 'int', out_image, '-add', '1', out_image])
-
-    # binary image. Body will remain one, background will be zero. 
-    subprocess.call(['fslmaths', '-dt', 'int', out_image, '-bin', out_image, '-odt', 'int'])
-
-    # lung still outside of body, add it in by filling hole.
-    subprocess.call([os.path.join(bin_dir, 'fillhole_filter'), '-i', out_image, '-o', out_image])
-
-    # morphology closing, to remove small regions connected to the main body.
-    subprocess.call([os.path.join(bin_dir, 'closing_filter'), '-i', out_image, '-o', out_image, '-r', '5'])
-
-    # # morphology opening
-    # subprocess.call([os.path.join(bin_dir, 'opening_filter'), '-i', out_image, '-o', out_image, '-r', '5'])
-
-    # find the largest component.
-    subprocess.call([os.path.join(bin_dir, 'connected_comp'), '-i', out_image, '-o', out_image])
+    # threshold, hole filling, closing and the largest component in one
+    # process. The bounding box of the body is saved next to the mask.
+    bbox_file = os.path.splitext(os.path.splitext(out_image)[0])[0] + '_bbox.txt'
+    subprocess.call([os.path.join(bin_dir, 'body_extract'), '--input', in_image, '--output', out_image, '--th={}'.format(th), '--radius', '5', '--bbox', bbox_file])
 
 def invert_dist_map(in_dist_file, lungmask_file, out_file, out_max):
     """
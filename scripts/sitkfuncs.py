@@ -162,6 +162,38 @@ def lung_extraction_wrapper(in_dir, out_dir):
         # extract_comp(os.path.join(out_dir, sub_id, 'gmm_seg.nii.gz'), os.path.join(out_dir, sub_id, 'cc.nii.gz'))
 
 
+def lung_extraction_batch(in_dir, out_dir, model_file, warmit = 0):
+    """
+    Same with lung_extraction_wrapper, but the GMM is estimated only once.
+
+    The model is estimated on the first subject and saved to model_file (if
+    model_file does not exist yet), then all subjects are classified with the
+    saved model by a single gmm process, in parallel.
+
+    in_dir: dir contains raw CT volume.
+    out_dir: cotains subject folder which contains results.
+    model_file: GMM model file.
+    warmit: number of EM iterations started from the saved model for each subject.
+    """
+    gmm_bin = '/home/weiliu/projects/vessel/build/gmm'
+    all_files = [f for f in os.listdir(in_dir) if f.endswith('.nii.gz')]
+    all_files.sort()
+
+    batch_lines = []
+    for sub_file in all_files:
+        sub_id, ext = os.path.splitext(sub_file) # remove gz
+        sub_id, ext = os.path.splitext(sub_id) # remove nii
+        batch_lines.append(' '.join([os.path.join(in_dir, sub_file), os.path.join(out_dir, sub_id, 'round_mask.nii.gz'), os.path.join(out_dir, sub_id, 'gmm_seg.nii.gz')]))
+
+    if not os.path.exists(model_file):
+        first = batch_lines[0].split()
+        subprocess.call([gmm_bin, '--input', first[0], '--mask', first[1], '--seg', first[2], '--ncomp', '3', '--mean', '-800', '0', '100', '--sigma', '100', '100', '100', '--prop', '0.33', '0.33', '0.33', '--maxit', '30', '--savemodel', model_file])
+
+    batch_file = os.path.join(out_dir, 'gmm_batch.txt')
+    with open(batch_file, 'w') as f:
+        f.write('\n'.join(batch_lines) + '\n')
+    subprocess.call([gmm_bin, '--model', model_file, '--batch', batch_file, '--warmit', str(warmit)])
+
 def lung_extraction_subs(in_dir, sub_list, out_dir):
     """
     wrapper func for lung extraction. Same with lung_extraction_wrapper but with list of subjects as input. 